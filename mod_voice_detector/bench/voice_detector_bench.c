@@ -0,0 +1,460 @@
+// Offline benchmark and replay harness for the detection pipeline.
+//
+// Replays WAV (16-bit PCM mono) or raw s16le corpora as fixed-length frames over N simulated
+// channels spread across T threads, through the same detector core the module runs
+// (decimator, energy and spectral VAD, noise floor, word/silence state machine). Reports
+// frames/sec per core, p50/p99 per-frame latency and, when a corpus has a label file next
+// to it (same name, .lab extension, one "start_ms end_ms" pair per line), detection
+// onsets against the labelled speech.
+//
+// Build with `make bench`, the FreeSWITCH tree is not needed.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../voice_detector_core.h"
+#include "../voice_detector_energy.h"
+
+#define BENCH_MAX_LABELS 4096
+#define BENCH_MAX_DETECTIONS 4096
+#define BENCH_LATENCY_SAMPLES (1 << 20)  // Per thread, later frames are not sampled
+
+typedef struct {
+    int start_ms;
+    int end_ms;
+} bench_label_t;
+
+typedef struct {
+    const char *path;
+    int16_t *samples;
+    uint32_t count;
+    int rate;
+    bench_label_t *labels;
+    int label_count;
+} bench_corpus_t;
+
+typedef struct {
+    voice_detector_core_config_t core;  // Times in ms, rates are filled in per corpus
+    int frame_ms;
+    int spectral;
+    int analysis_rate;
+    int raw_rate;
+    int tolerance_ms;
+    int loops;
+} bench_options_t;
+
+typedef struct {
+    bench_corpus_t *corpus;
+    uint32_t position;
+    int stream_frame_samples;
+    voice_detector_core_t core;
+    voice_detector_decimator_t decimator;
+    int16_t analysis_buffer[VOICE_DETECTOR_DECIMATOR_MAX_INPUT / 2 + 1];
+    voice_detector_spectral_t spectral;
+    // Onsets are only kept for the first channel that plays a corpus
+    int record_detections;
+    int detections[BENCH_MAX_DETECTIONS];
+    int detection_count;
+} bench_channel_t;
+
+typedef struct {
+    pthread_t thread;
+    const bench_options_t *options;
+    bench_channel_t *channels;
+    int channel_count;
+    uint32_t *latencies;  // ns
+    uint32_t latency_count;
+    uint64_t frames;
+    uint64_t cpu_ns;
+} bench_worker_t;
+
+static uint64_t bench_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t bench_read_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Load a corpus file, WAV when it has a RIFF header and raw s16le at raw_rate otherwise
+static int bench_load_audio(bench_corpus_t *corpus, int raw_rate)
+{
+    FILE *file = fopen(corpus->path, "rb");
+    unsigned char header[12], chunk[8], fmt[16];
+    long data_offset = 0, data_size = -1;
+    uint32_t size;
+
+    if (!file) {
+        fprintf(stderr, "%s: %s\n", corpus->path, strerror(errno));
+        return -1;
+    }
+
+    corpus->rate = raw_rate;
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) && !memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WAVE", 4)) {
+        while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+            size = bench_read_u32(chunk + 4);
+            if (!memcmp(chunk, "fmt ", 4) && size >= sizeof(fmt)) {
+                if (fread(fmt, 1, sizeof(fmt), file) != sizeof(fmt)) {
+                    break;
+                }
+                if (fmt[0] != 1 || fmt[2] != 1 || fmt[14] != 16) {
+                    fprintf(stderr, "%s: only 16-bit PCM mono WAV is supported\n", corpus->path);
+                    fclose(file);
+                    return -1;
+                }
+                corpus->rate = (int)bench_read_u32(fmt + 4);
+                fseek(file, (long)(size - sizeof(fmt) + (size & 1)), SEEK_CUR);
+            } else if (!memcmp(chunk, "data", 4)) {
+                data_offset = ftell(file);
+                data_size = size;
+                break;
+            } else {
+                fseek(file, (long)(size + (size & 1)), SEEK_CUR);
+            }
+        }
+        if (data_size < 0) {
+            fprintf(stderr, "%s: no data chunk\n", corpus->path);
+            fclose(file);
+            return -1;
+        }
+    } else {
+        fseek(file, 0, SEEK_END);
+        data_size = ftell(file);
+    }
+
+    fseek(file, data_offset, SEEK_SET);
+    corpus->count = (uint32_t)(data_size / 2);
+    if (!(corpus->samples = malloc(sizeof(int16_t) * (corpus->count ? corpus->count : 1))) ||
+        fread(corpus->samples, sizeof(int16_t), corpus->count, file) != corpus->count) {
+        fprintf(stderr, "%s: short read\n", corpus->path);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Labels live next to the corpus: foo.wav -> foo.lab
+static void bench_load_labels(bench_corpus_t *corpus)
+{
+    char path[1024], line[256];
+    const char *dot = strrchr(corpus->path, '.');
+    size_t base = dot && !strchr(dot, '/') ? (size_t)(dot - corpus->path) : strlen(corpus->path);
+    FILE *file;
+    bench_label_t label;
+
+    if (base + 5 > sizeof(path)) {
+        return;
+    }
+    memcpy(path, corpus->path, base);
+    strcpy(path + base, ".lab");
+
+    if (!(file = fopen(path, "r"))) {
+        return;
+    }
+
+    corpus->labels = calloc(BENCH_MAX_LABELS, sizeof(bench_label_t));
+    while (corpus->labels && corpus->label_count < BENCH_MAX_LABELS && fgets(line, sizeof(line), file)) {
+        if (line[0] != '#' && sscanf(line, "%d %d", &label.start_ms, &label.end_ms) == 2) {
+            corpus->labels[corpus->label_count++] = label;
+        }
+    }
+
+    fclose(file);
+}
+
+static void bench_channel_init(bench_channel_t *channel, bench_corpus_t *corpus, const bench_options_t *options)
+{
+    voice_detector_core_config_t config = options->core;
+    voice_detector_decimator_t *decimator = NULL;
+    int factor;
+
+    memset(channel, 0, sizeof(*channel));
+    channel->corpus = corpus;
+    channel->stream_frame_samples = corpus->rate * options->frame_ms / 1000;
+
+    config.sample_rate = corpus->rate;
+    config.frame_samples = channel->stream_frame_samples;
+    if (options->analysis_rate > 0 && options->analysis_rate < corpus->rate &&
+        (factor = voice_detector_decimator_configure(&channel->decimator, corpus->rate, options->analysis_rate)) > 1) {
+        decimator = &channel->decimator;
+        config.sample_rate = corpus->rate / factor;
+        config.frame_samples = channel->stream_frame_samples / factor;
+    }
+
+    voice_detector_core_init(&channel->core, &config, decimator, decimator ? channel->analysis_buffer : NULL,
+                             options->spectral ? &channel->spectral : NULL, NULL);
+}
+
+// One frame through the core, confirmed voice starts are the detections. Digital silence takes
+// the same fast path as in the module.
+static void bench_process_frame(bench_channel_t *channel, const int16_t *audio, int samples)
+{
+    voice_detector_core_event_t events[VOICE_DETECTOR_CORE_MAX_EVENTS];
+    int count;
+    int i;
+
+    if (voice_detector_energy_is_zero(audio, (size_t)samples)) {
+        count = voice_detector_core_process_silence(&channel->core, samples, events);
+    } else {
+        count = voice_detector_core_process_frame(&channel->core, audio, samples, events);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (events[i].type == VOICE_DETECTOR_CORE_SEGMENT_START && !events[i].value &&
+            channel->record_detections && channel->detection_count < BENCH_MAX_DETECTIONS) {
+            channel->detections[channel->detection_count++] = (int)((int64_t)channel->position * 1000 / channel->corpus->rate);
+        }
+    }
+}
+
+// Each thread steps its channels in lockstep, one frame per channel per round, like a media tick
+static void *bench_worker_thread(void *obj)
+{
+    bench_worker_t *worker = obj;
+    const bench_options_t *options = worker->options;
+    uint64_t cpu_start = bench_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int loop, active, i;
+
+    for (loop = 0; loop < options->loops; loop++) {
+        for (i = 0; i < worker->channel_count; i++) {
+            worker->channels[i].position = 0;
+            worker->channels[i].record_detections &= loop == 0;
+        }
+
+        do {
+            active = 0;
+            for (i = 0; i < worker->channel_count; i++) {
+                bench_channel_t *channel = &worker->channels[i];
+                uint32_t left = channel->corpus->count - channel->position;
+                int samples = (int)(left < (uint32_t)channel->stream_frame_samples ? left : (uint32_t)channel->stream_frame_samples);
+                uint64_t started;
+
+                if (samples <= 0) {
+                    continue;
+                }
+
+                started = bench_clock_ns(CLOCK_MONOTONIC);
+                bench_process_frame(channel, channel->corpus->samples + channel->position, samples);
+                if (worker->latency_count < BENCH_LATENCY_SAMPLES) {
+                    worker->latencies[worker->latency_count++] = (uint32_t)(bench_clock_ns(CLOCK_MONOTONIC) - started);
+                }
+
+                channel->position += samples;
+                worker->frames++;
+                active = 1;
+            }
+        } while (active);
+    }
+
+    worker->cpu_ns = bench_clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+    return NULL;
+}
+
+static int bench_compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Match detected onsets to labelled speech starts within the tolerance
+static void bench_report_accuracy(const bench_channel_t *channel, const bench_options_t *options)
+{
+    const bench_corpus_t *corpus = channel->corpus;
+    int matched = 0, false_alarms = 0, used, i, j;
+    long delay_sum = 0;
+    char *hit;
+
+    if (!corpus->label_count) {
+        printf("  %s: %d onsets, no labels\n", corpus->path, channel->detection_count);
+        return;
+    }
+
+    hit = calloc(corpus->label_count, 1);
+    for (i = 0; i < channel->detection_count; i++) {
+        int onset = channel->detections[i];
+
+        used = 0;
+        for (j = 0; hit && j < corpus->label_count; j++) {
+            if (!hit[j] && onset >= corpus->labels[j].start_ms - options->tolerance_ms &&
+                onset <= corpus->labels[j].end_ms && onset <= corpus->labels[j].start_ms + options->tolerance_ms * 10) {
+                hit[j] = 1;
+                matched++;
+                delay_sum += onset - corpus->labels[j].start_ms;
+                used = 1;
+                break;
+            }
+        }
+        false_alarms += !used;
+    }
+    free(hit);
+
+    printf("  %s: %d/%d labelled starts detected, %d missed, %d false alarms, mean onset delay %ld ms\n",
+           corpus->path, matched, corpus->label_count, corpus->label_count - matched, false_alarms,
+           matched ? delay_sum / matched : 0);
+}
+
+static void bench_usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] corpus.wav|corpus.raw ...\n"
+            "  -c channels         simulated channels (1)\n"
+            "  -t threads          worker threads (1)\n"
+            "  -n loops            replays of each corpus (1)\n"
+            "  -f frame_ms         frame length (20)\n"
+            "  -e energy_threshold normalized 0-1 (0.05)\n"
+            "  -H hits             voiced frames to confirm voice (2)\n"
+            "  -S max_silence      ms of silence that ends voice (2000)\n"
+            "  -W max_word_length  ms of continuous voice before a reset (3500)\n"
+            "  -N                  adapt the threshold to the noise floor\n"
+            "  -m energy|spectral  vad_mode (energy)\n"
+            "  -a analysis_rate    decimate to this rate, 0 = off (0)\n"
+            "  -R rate             sample rate of raw corpora (8000)\n"
+            "  -T tolerance_ms     onset match tolerance (200)\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t options = { { 0 }, 20, 0, 0, 8000, 200, 1 };
+    int channel_count = 1, thread_count = 1, corpus_count, opt, i, c;
+    bench_corpus_t *corpora;
+    bench_channel_t *channels;
+    bench_worker_t *workers;
+    uint32_t *latencies;
+    uint64_t frames = 0, cpu_ns = 0, wall_start, wall_ns;
+    uint32_t latency_count = 0;
+
+    // Same defaults as the module's runtime parameters
+    options.core.hits = 2;
+    options.core.debounce_ms = 500;
+    options.core.min_word_length = 100;
+    options.core.maximum_word_length = 3500;
+    options.core.between_words_silence = 50;
+    options.core.max_silence = 2000;
+    options.core.hangover_ms = 200;
+    options.core.energy_threshold = 0.05f;
+    options.core.noise_margin = 3.0f;
+    options.core.noise_floor_min = 0.005f;
+    options.core.spectral_flatness = 0.4f;
+    options.core.spectral_band_ratio = 0.25f;
+    options.core.spectral_zcr = 0.45f;
+
+    while ((opt = getopt(argc, argv, "c:t:n:f:e:H:S:W:Nm:a:R:T:h")) != -1) {
+        switch (opt) {
+        case 'c': channel_count = atoi(optarg); break;
+        case 't': thread_count = atoi(optarg); break;
+        case 'n': options.loops = atoi(optarg); break;
+        case 'f': options.frame_ms = atoi(optarg); break;
+        case 'e': options.core.energy_threshold = (float)atof(optarg); break;
+        case 'H': options.core.hits = atoi(optarg); break;
+        case 'S': options.core.max_silence = atoi(optarg); break;
+        case 'W': options.core.maximum_word_length = atoi(optarg); break;
+        case 'N': options.core.noise_floor = 1; break;
+        case 'm': options.spectral = !strcmp(optarg, "spectral"); break;
+        case 'a': options.analysis_rate = atoi(optarg); break;
+        case 'R': options.raw_rate = atoi(optarg); break;
+        case 'T': options.tolerance_ms = atoi(optarg); break;
+        default:
+            bench_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    corpus_count = argc - optind;
+    if (corpus_count < 1 || channel_count < 1 || thread_count < 1 || options.loops < 1 || options.frame_ms < 1) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if (thread_count > channel_count) {
+        thread_count = channel_count;
+    }
+
+    printf("Energy kernel: %s\n", voice_detector_energy_init());
+    voice_detector_spectral_init();
+    voice_detector_decimator_init();
+
+    corpora = calloc(corpus_count, sizeof(bench_corpus_t));
+    channels = calloc(channel_count, sizeof(bench_channel_t));
+    workers = calloc(thread_count, sizeof(bench_worker_t));
+    if (!corpora || !channels || !workers) {
+        return 1;
+    }
+
+    for (i = 0; i < corpus_count; i++) {
+        corpora[i].path = argv[optind + i];
+        if (bench_load_audio(&corpora[i], options.raw_rate) != 0) {
+            return 1;
+        }
+        bench_load_labels(&corpora[i]);
+    }
+
+    // Channel i replays corpus i % corpus_count, the first channel of each corpus is scored
+    for (c = 0; c < channel_count; c++) {
+        bench_channel_init(&channels[c], &corpora[c % corpus_count], &options);
+        channels[c].record_detections = c < corpus_count;
+    }
+
+    wall_start = bench_clock_ns(CLOCK_MONOTONIC);
+    for (i = 0; i < thread_count; i++) {
+        int first = (int)((int64_t)channel_count * i / thread_count);
+        int last = (int)((int64_t)channel_count * (i + 1) / thread_count);
+
+        workers[i].options = &options;
+        workers[i].channels = channels + first;
+        workers[i].channel_count = last - first;
+        if (!(workers[i].latencies = malloc(sizeof(uint32_t) * BENCH_LATENCY_SAMPLES)) ||
+            pthread_create(&workers[i].thread, NULL, bench_worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker %d\n", i);
+            return 1;
+        }
+    }
+    for (i = 0; i < thread_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        frames += workers[i].frames;
+        cpu_ns += workers[i].cpu_ns;
+        latency_count += workers[i].latency_count;
+    }
+    wall_ns = bench_clock_ns(CLOCK_MONOTONIC) - wall_start;
+
+    latencies = malloc(sizeof(uint32_t) * (latency_count ? latency_count : 1));
+    latency_count = 0;
+    for (i = 0; latencies && i < thread_count; i++) {
+        memcpy(latencies + latency_count, workers[i].latencies, sizeof(uint32_t) * workers[i].latency_count);
+        latency_count += workers[i].latency_count;
+    }
+    if (latencies && latency_count) {
+        qsort(latencies, latency_count, sizeof(uint32_t), bench_compare_u32);
+    }
+
+    printf("Channels: %d, threads: %d, frames: %llu, frame: %d ms, vad_mode: %s\n", channel_count, thread_count,
+           (unsigned long long)frames, options.frame_ms, options.spectral ? "spectral" : "energy");
+    printf("Throughput: %.0f frames/s wall, %.0f frames/s per core\n",
+           wall_ns ? frames * 1e9 / wall_ns : 0.0, cpu_ns ? frames * 1e9 / cpu_ns : 0.0);
+    printf("Channels per core at real time: %.0f\n", cpu_ns ? frames * 1e9 / cpu_ns * options.frame_ms / 1000.0 : 0.0);
+    if (latencies && latency_count) {
+        printf("Per-frame latency: p50 %u ns, p99 %u ns, max %u ns\n", latencies[latency_count / 2],
+               latencies[(uint32_t)((uint64_t)latency_count * 99 / 100)], latencies[latency_count - 1]);
+    }
+
+    printf("Detections:\n");
+    for (c = 0; c < channel_count && c < corpus_count; c++) {
+        bench_report_accuracy(&channels[c], &options);
+    }
+
+    return 0;
+}
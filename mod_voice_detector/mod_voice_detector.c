@@ -1,162 +1,324 @@
-#include <switch.h>
-
-SWITCH_MODULE_LOAD_FUNCTION(mod_voice_detector_load);
-SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_voice_detector_shutdown);
-SWITCH_MODULE_DEFINITION(mod_voice_detector, mod_voice_detector_load, mod_voice_detector_shutdown, NULL);
-
-// Runtime parameters structure
-typedef struct {
-    int silence_ms;
-    float threshold;
-    int hits;
-    int timeout;
-    int interrupt_ms;
-    float energy_threshold;
-    int total_analysis_time;
-    int min_word_length;
-    int maximum_word_length;
-    int between_words_silence;
-    int max_silence;
-    int auto_record;
-    int recording_format;
-    char *recording_path;
-    char *recording_prefix;
-    char *leg; // Added for leg parameter
-} voice_detector_runtime_params_t;
-
-// Configuration structure
-typedef struct {
-    char *api_url;
-    char *api_key;
-    char *recording_path;
-    char *recording_prefix;
-    switch_memory_pool_t *pool;
-    switch_mutex_t *mutex;
-    switch_hash_t *sessions;
-    int energy_threshold;
-    int silence_threshold;
-    int frame_size;
-    int sample_rate;
-    int debounce_ms;
-    int max_silence_duration;
-    int auto_record;
-    int recording_format;
-} voice_detector_global_t;
-
-// Session-specific data
-typedef struct {
-    switch_core_session_t *session;
-    switch_media_bug_t *bug;
-    switch_time_t last_voice_time;
-    switch_time_t last_api_call_time;
-    int voice_detected;
-    int silence_frames;
-    int total_frames;
-    char *uuid;
-    switch_memory_pool_t *pool;
-    // Recording specific fields - simplified for compatibility
-    char *recording_file;
-    int is_recording;
-    switch_time_t recording_start_time;
-    switch_time_t recording_duration;
-    // Runtime parameters
-    voice_detector_runtime_params_t runtime_params;
-    // Advanced voice detection fields
-    int consecutive_hits;
-    int word_start_time;
-    int word_end_time;
-    int current_word_length;
-    int between_words_silence_frames;
-    int max_silence_frames;
-} voice_detector_session_t;
+#include "mod_voice_detector.h"
 
 // Global configuration
 static voice_detector_global_t *globals = NULL;
 
-// Forward declarations
-static switch_status_t voice_detector_callback(switch_media_bug_t *bug, void *user_data, switch_frame_t *frame);
-static switch_status_t voice_detector_session_cleanup(voice_detector_session_t *session_data);
-static switch_status_t voice_detector_api_call(const char *uuid, int voice_detected, int energy_level, const char *leg);
-static switch_status_t voice_detector_parse_config(switch_loadable_module_interface_t **mod_interface, switch_memory_pool_t *pool);
-static switch_status_t voice_detector_start_recording(voice_detector_session_t *session_data);
-static switch_status_t voice_detector_stop_recording(voice_detector_session_t *session_data);
-static switch_status_t voice_detector_get_recording_filename(voice_detector_session_t *session_data, char **filename);
-static switch_status_t voice_detector_parse_runtime_params(const char *data, voice_detector_runtime_params_t *params);
-static switch_status_t voice_detector_apply_runtime_params(voice_detector_session_t *session_data, const voice_detector_runtime_params_t *params);
-
-// Parse runtime parameters from application data
+// Runtime parameter table, overrides and profile params are both dispatched through it
+static const voice_detector_param_def_t voice_detector_param_defs[] = {
+    { "silence_ms", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, silence_ms), 0 },
+    { "threshold", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, threshold), 0 },
+    { "hits", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, hits), 0 },
+    { "timeout", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, timeout), 0 },
+    { "interrupt_ms", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, interrupt_ms), 0 },
+    { "energy_threshold", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, energy_threshold), 0 },
+    { "total_analysis_time", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, total_analysis_time), 0 },
+    { "min_word_length", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, min_word_length), 0 },
+    { "maximum_word_length", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, maximum_word_length), 0 },
+    { "between_words_silence", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, between_words_silence), 0 },
+    { "max_silence", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, max_silence), 0 },
+    { "auto_record", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, auto_record), 0 },
+    { "recording_format", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, recording_format), 0 },
+    { "recording_path", VOICE_DETECTOR_PARAM_STRING, offsetof(voice_detector_runtime_params_t, recording_path), VOICE_DETECTOR_MAX_PATH },
+    { "recording_prefix", VOICE_DETECTOR_PARAM_STRING, offsetof(voice_detector_runtime_params_t, recording_prefix), VOICE_DETECTOR_MAX_PREFIX },
+    { "leg", VOICE_DETECTOR_PARAM_LEG, offsetof(voice_detector_runtime_params_t, leg), 8 },
+    { "vad_mode", VOICE_DETECTOR_PARAM_VAD_MODE, offsetof(voice_detector_runtime_params_t, vad_mode), 0 },
+    { "spectral_flatness", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, spectral_flatness), 0 },
+    { "spectral_band_ratio", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, spectral_band_ratio), 0 },
+    { "spectral_zcr", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, spectral_zcr), 0 },
+    { "noise_floor", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, noise_floor), 0 },
+    { "noise_margin", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, noise_margin), 0 },
+    { "noise_floor_min", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, noise_floor_min), 0 },
+    { "analysis_rate", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, analysis_rate), 0 },
+    { "preroll_ms", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, preroll_ms), 0 },
+    { "record_mode", VOICE_DETECTOR_PARAM_RECORD_MODE, offsetof(voice_detector_runtime_params_t, record_mode), 0 },
+    { "hangover_ms", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, hangover_ms), 0 },
+    { "amd", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, amd), 0 },
+    { "amd_greeting", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, amd_greeting), 0 },
+    { "amd_after_greeting_silence", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, amd_after_greeting_silence), 0 },
+    { "amd_initial_silence", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, amd_initial_silence), 0 },
+    { "amd_max_words", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, amd_max_words), 0 },
+    { "beep_min_length", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, beep_min_length), 0 },
+    { "beep_ratio", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, beep_ratio), 0 },
+    { "stream_url", VOICE_DETECTOR_PARAM_URL, offsetof(voice_detector_runtime_params_t, stream_url), VOICE_DETECTOR_MAX_URL },
+    { "sink", VOICE_DETECTOR_PARAM_SINK, offsetof(voice_detector_runtime_params_t, sink), 0 },
+    { "native_g711", VOICE_DETECTOR_PARAM_INT, offsetof(voice_detector_runtime_params_t, native_g711), 0 },
+    { "nn_threshold", VOICE_DETECTOR_PARAM_FLOAT, offsetof(voice_detector_runtime_params_t, nn_threshold), 0 },
+};
+
+#define VOICE_DETECTOR_PARAM_COUNT ((int)(sizeof(voice_detector_param_defs) / sizeof(voice_detector_param_defs[0])))
+
+// Leg tag per VOICE_DETECTOR_DIRECTION_*
+static const char *voice_detector_direction_legs[VOICE_DETECTOR_DIRECTIONS] = { "a", "b" };
+
+// Event sink subclasses, indexed by VOICE_DETECTOR_EVENT_*
+static const char *voice_detector_event_subclasses[VOICE_DETECTOR_EVENT_TYPES] = {
+    VOICE_DETECTOR_EVENT_SUBCLASS_VOICE_END,
+    VOICE_DETECTOR_EVENT_SUBCLASS_VOICE_START,
+    VOICE_DETECTOR_EVENT_SUBCLASS_RECORDING_START,
+    VOICE_DETECTOR_EVENT_SUBCLASS_RECORDING_STOP,
+    VOICE_DETECTOR_EVENT_SUBCLASS_WORD_DETECTED,
+    VOICE_DETECTOR_EVENT_SUBCLASS_DOUBLE_TALK,
+    VOICE_DETECTOR_EVENT_SUBCLASS_AMD,
+    VOICE_DETECTOR_EVENT_SUBCLASS_BEEP,
+    VOICE_DETECTOR_EVENT_SUBCLASS_ANALYSIS_COMPLETE,
+};
+
+// AMD result names, indexed by VOICE_DETECTOR_AMD_*
+static const char *voice_detector_amd_results[] = { "", "human", "machine", "notsure" };
+#define VOICE_DETECTOR_AMD_RESULTS ((int)(sizeof(voice_detector_amd_results) / sizeof(voice_detector_amd_results[0])))
+
+// Analysis end reasons, indexed by VOICE_DETECTOR_FINISHED_*
+static const char *voice_detector_finished_reasons[] = { "", "analysis_time", "timeout" };
+#define VOICE_DETECTOR_FINISHED_REASONS ((int)(sizeof(voice_detector_finished_reasons) / sizeof(voice_detector_finished_reasons[0])))
+
+// Perfect hash over the parameter names: slot -> index into voice_detector_param_defs, -1 = empty
+static int8_t voice_detector_param_hash_table[VOICE_DETECTOR_PARAM_HASH_SIZE];
+static uint32_t voice_detector_param_hash_seed;
+
+// Seeded, case-insensitive FNV-1a
+static uint32_t voice_detector_param_hash(const char *key, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+
+    while (*key) {
+        hash ^= (uint8_t)switch_tolower((unsigned char)*key++);
+        hash *= 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
+
+// Search for a seed that maps every parameter name to its own slot, done once at load
+static switch_status_t voice_detector_param_hash_init(void)
+{
+    uint32_t seed;
+    int i;
+
+    for (seed = 1; seed < VOICE_DETECTOR_PARAM_HASH_MAX_SEED; seed++) {
+        memset(voice_detector_param_hash_table, -1, sizeof(voice_detector_param_hash_table));
+
+        for (i = 0; i < VOICE_DETECTOR_PARAM_COUNT; i++) {
+            uint32_t slot = voice_detector_param_hash(voice_detector_param_defs[i].name, seed) & (VOICE_DETECTOR_PARAM_HASH_SIZE - 1);
+            if (voice_detector_param_hash_table[slot] >= 0) {
+                break;
+            }
+            voice_detector_param_hash_table[slot] = (int8_t)i;
+        }
+
+        if (i == VOICE_DETECTOR_PARAM_COUNT) {
+            voice_detector_param_hash_seed = seed;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Parameter hash: %d keys in %d slots, seed %u\n",
+                              VOICE_DETECTOR_PARAM_COUNT, VOICE_DETECTOR_PARAM_HASH_SIZE, seed);
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No perfect hash seed found for %d runtime parameters\n", VOICE_DETECTOR_PARAM_COUNT);
+    return SWITCH_STATUS_FALSE;
+}
+
+// One hash and one confirming compare per key
+static const voice_detector_param_def_t *voice_detector_param_lookup(const char *key)
+{
+    int index = voice_detector_param_hash_table[voice_detector_param_hash(key, voice_detector_param_hash_seed) & (VOICE_DETECTOR_PARAM_HASH_SIZE - 1)];
+
+    if (index < 0 || strcasecmp(voice_detector_param_defs[index].name, key)) {
+        return NULL;
+    }
+
+    return &voice_detector_param_defs[index];
+}
+
+// Set one runtime parameter, fails on unknown keys and malformed values
+static switch_status_t voice_detector_set_param(voice_detector_runtime_params_t *params, const char *key, const char *value)
+{
+    const voice_detector_param_def_t *def = voice_detector_param_lookup(key);
+    char *field;
+
+    if (!def || !value) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    field = (char *)params + def->offset;
+
+    switch (def->type) {
+    case VOICE_DETECTOR_PARAM_INT:
+        if (!switch_is_number(value)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        *(int *)field = atoi(value);
+        break;
+    case VOICE_DETECTOR_PARAM_FLOAT:
+        if (!switch_is_number(value)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        *(float *)field = (float)atof(value);
+        break;
+    case VOICE_DETECTOR_PARAM_STRING:
+        switch_copy_string(field, value, def->size);
+        break;
+    case VOICE_DETECTOR_PARAM_LEG:
+        if (strcasecmp(value, "a") && strcasecmp(value, "b") && strcasecmp(value, "both")) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_copy_string(field, value, def->size);
+        break;
+    case VOICE_DETECTOR_PARAM_VAD_MODE:
+        if (!strcasecmp(value, "spectral")) {
+            *(int *)field = VOICE_DETECTOR_VAD_MODE_SPECTRAL;
+        } else if (!strcasecmp(value, "energy")) {
+            *(int *)field = VOICE_DETECTOR_VAD_MODE_ENERGY;
+        } else if (!strcasecmp(value, "nn")) {
+            *(int *)field = VOICE_DETECTOR_VAD_MODE_NN;
+        } else {
+            return SWITCH_STATUS_FALSE;
+        }
+        break;
+    case VOICE_DETECTOR_PARAM_URL:
+        if (strncasecmp(value, "ws://", 5) && strncasecmp(value, "wss://", 6)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_copy_string(field, value, def->size);
+        break;
+    case VOICE_DETECTOR_PARAM_RECORD_MODE:
+        if (!strcasecmp(value, "continuous")) {
+            *(int *)field = VOICE_DETECTOR_RECORD_MODE_CONTINUOUS;
+        } else if (!strcasecmp(value, "segments")) {
+            *(int *)field = VOICE_DETECTOR_RECORD_MODE_SEGMENTS;
+        } else if (!strcasecmp(value, "speech")) {
+            *(int *)field = VOICE_DETECTOR_RECORD_MODE_SPEECH;
+        } else {
+            return SWITCH_STATUS_FALSE;
+        }
+        break;
+    case VOICE_DETECTOR_PARAM_SINK:
+        if (!strcasecmp(value, "http")) {
+            *(int *)field = VOICE_DETECTOR_SINK_HTTP;
+        } else if (!strcasecmp(value, "event")) {
+            *(int *)field = VOICE_DETECTOR_SINK_EVENT;
+        } else if (!strcasecmp(value, "both")) {
+            *(int *)field = VOICE_DETECTOR_SINK_BOTH;
+        } else {
+            return SWITCH_STATUS_FALSE;
+        }
+        break;
+    default:
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Built-in runtime parameter defaults
+static void voice_detector_runtime_params_defaults(voice_detector_runtime_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->silence_ms = DEFAULT_SILENCE_MS;
+    params->threshold = DEFAULT_THRESHOLD;
+    params->hits = DEFAULT_HITS;
+    params->timeout = DEFAULT_TIMEOUT;
+    params->interrupt_ms = DEFAULT_INTERRUPT_MS;
+    params->energy_threshold = DEFAULT_RUNTIME_ENERGY_THRESHOLD;
+    params->total_analysis_time = DEFAULT_TOTAL_ANALYSIS_TIME;
+    params->min_word_length = DEFAULT_MIN_WORD_LENGTH;
+    params->maximum_word_length = DEFAULT_MAXIMUM_WORD_LENGTH;
+    params->between_words_silence = DEFAULT_BETWEEN_WORDS_SILENCE;
+    params->max_silence = DEFAULT_MAX_SILENCE;
+    params->auto_record = DEFAULT_AUTO_RECORD;
+    params->recording_format = DEFAULT_RECORDING_FORMAT;
+    params->recording_path[0] = '\0';
+    params->recording_prefix[0] = '\0';
+    switch_copy_string(params->leg, DEFAULT_LEG, sizeof(params->leg));
+    params->vad_mode = VOICE_DETECTOR_VAD_MODE_ENERGY;
+    params->spectral_flatness = DEFAULT_SPECTRAL_FLATNESS;
+    params->spectral_band_ratio = DEFAULT_SPECTRAL_BAND_RATIO;
+    params->spectral_zcr = DEFAULT_SPECTRAL_ZCR;
+    params->noise_floor = 0;
+    params->noise_margin = DEFAULT_NOISE_MARGIN;
+    params->noise_floor_min = DEFAULT_NOISE_FLOOR_MIN;
+    params->analysis_rate = 0;
+    params->preroll_ms = DEFAULT_PREROLL_MS;
+    params->record_mode = VOICE_DETECTOR_RECORD_MODE_CONTINUOUS;
+    params->hangover_ms = DEFAULT_HANGOVER_MS;
+    params->sink = VOICE_DETECTOR_SINK_HTTP;
+    params->amd = 0;
+    params->amd_greeting = DEFAULT_AMD_GREETING;
+    params->amd_after_greeting_silence = DEFAULT_AMD_AFTER_GREETING_SILENCE;
+    params->amd_initial_silence = DEFAULT_AMD_INITIAL_SILENCE;
+    params->amd_max_words = DEFAULT_AMD_MAX_WORDS;
+    params->beep_min_length = DEFAULT_BEEP_MIN_LENGTH;
+    params->beep_ratio = DEFAULT_BEEP_RATIO;
+    params->native_g711 = 0;
+    params->nn_threshold = DEFAULT_NN_THRESHOLD;
+}
+
+// Copy a named profile's frozen parameters, false if there is no such profile
+static switch_bool_t voice_detector_profile_get(const char *name, voice_detector_runtime_params_t *params)
+{
+    voice_detector_profile_t *profile;
+    switch_bool_t found = SWITCH_FALSE;
+
+    switch_thread_rwlock_rdlock(globals->profiles_lock);
+    if (globals->profiles && (profile = switch_core_hash_find(globals->profiles, name))) {
+        memcpy(params, &profile->params, sizeof(*params));
+        found = SWITCH_TRUE;
+    }
+    switch_thread_rwlock_unlock(globals->profiles_lock);
+
+    return found;
+}
+
+// Parse runtime parameters from application data.
+// profile=<name> selects the base set wherever it appears, the remaining key=value tokens override it.
 static switch_status_t voice_detector_parse_runtime_params(const char *data, voice_detector_runtime_params_t *params)
 {
-    // Set default values
-    params->silence_ms = 150;
-    params->threshold = 0.5f;
-    params->hits = 2;
-    params->timeout = 2000;
-    params->interrupt_ms = 50;
-    params->energy_threshold = 0.05f;
-    params->total_analysis_time = 4000;
-    params->min_word_length = 100;
-    params->maximum_word_length = 3500;
-    params->between_words_silence = 50;
-    params->max_silence = 2000;
-    params->auto_record = 1;
-    params->recording_format = 0;
-    params->recording_path = NULL;
-    params->recording_prefix = NULL;
-    params->leg = "a";  // Default to leg A
+    voice_detector_runtime_params_defaults(params);
 
     if (!data || !*data) {
         return SWITCH_STATUS_SUCCESS; // Use defaults
     }
 
-    char *mycmd = switch_core_strdup(switch_core_permanent_pool(), data);
-    char *argv[20] = { 0 };
+    // Tokenize a stack copy, nothing parsed here outlives the call. One slot per parameter plus
+    // profile=, and a spare one that catches the unsplit rest of a longer list.
+    char mycmd[VOICE_DETECTOR_MAX_APP_DATA];
+    char *argv[VOICE_DETECTOR_PARAM_COUNT + 2] = { 0 };
+    char *values[VOICE_DETECTOR_PARAM_COUNT + 2] = { 0 };
     int argc = 0;
 
+    if (strlen(data) >= sizeof(mycmd)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "voice_detector parameters longer than %d bytes, the rest is ignored: %s\n",
+                          VOICE_DETECTOR_MAX_APP_DATA - 1, data + sizeof(mycmd) - 1);
+    }
+    switch_copy_string(mycmd, data, sizeof(mycmd));
     argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
+    if (argc > VOICE_DETECTOR_PARAM_COUNT + 1) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "More than %d voice_detector parameters, the rest is ignored: %s\n",
+                          VOICE_DETECTOR_PARAM_COUNT + 1, argv[VOICE_DETECTOR_PARAM_COUNT + 1]);
+        argc = VOICE_DETECTOR_PARAM_COUNT + 1;
+    }
 
     for (int i = 0; i < argc; i++) {
-        char *arg = argv[i];
-        if (!arg || !*arg) continue;
-
-        char *equals = strchr(arg, '=');
-        if (!equals) continue;
+        char *equals;
 
+        if (!argv[i] || !(equals = strchr(argv[i], '='))) {
+            argv[i] = NULL;
+            continue;
+        }
         *equals = '\0';
-        char *value = equals + 1;
-
-        if (!strcasecmp(arg, "silence_ms")) {
-            params->silence_ms = atoi(value);
-        } else if (!strcasecmp(arg, "threshold")) {
-            params->threshold = atof(value);
-        } else if (!strcasecmp(arg, "hits")) {
-            params->hits = atoi(value);
-        } else if (!strcasecmp(arg, "timeout")) {
-            params->timeout = atoi(value);
-        } else if (!strcasecmp(arg, "interrupt_ms")) {
-            params->interrupt_ms = atoi(value);
-        } else if (!strcasecmp(arg, "energy_threshold")) {
-            params->energy_threshold = atof(value);
-        } else if (!strcasecmp(arg, "total_analysis_time")) {
-            params->total_analysis_time = atoi(value);
-        } else if (!strcasecmp(arg, "min_word_length")) {
-            params->min_word_length = atoi(value);
-        } else if (!strcasecmp(arg, "maximum_word_length")) {
-            params->maximum_word_length = atoi(value);
-        } else if (!strcasecmp(arg, "between_words_silence")) {
-            params->between_words_silence = atoi(value);
-        } else if (!strcasecmp(arg, "max_silence")) {
-            params->max_silence = atoi(value);
-        } else if (!strcasecmp(arg, "auto_record")) {
-            params->auto_record = atoi(value);
-        } else if (!strcasecmp(arg, "recording_format")) {
-            params->recording_format = atoi(value);
-        } else if (!strcasecmp(arg, "recording_path")) {
-            params->recording_path = switch_core_strdup(switch_core_permanent_pool(), value);
-        } else if (!strcasecmp(arg, "recording_prefix")) {
-            params->recording_prefix = switch_core_strdup(switch_core_permanent_pool(), value);
-        } else if (!strcasecmp(arg, "leg")) {
-            params->leg = switch_core_strdup(switch_core_permanent_pool(), value);
+        values[i] = equals + 1;
+
+        if (!strcasecmp(argv[i], "profile")) {
+            if (!voice_detector_profile_get(values[i], params)) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown voice_detector profile '%s'\n", values[i]);
+                return SWITCH_STATUS_FALSE;
+            }
+            argv[i] = NULL;
+        }
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (argv[i] && voice_detector_set_param(params, argv[i], values[i]) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Ignoring runtime parameter %s=%s\n", argv[i], values[i]);
         }
     }
 
@@ -170,20 +332,153 @@ static switch_status_t voice_detector_apply_runtime_params(voice_detector_sessio
     memcpy(&session_data->runtime_params, params, sizeof(voice_detector_runtime_params_t));
     
     // Set default values for recording path and prefix if not specified
-    if (!session_data->runtime_params.recording_path) {
-        session_data->runtime_params.recording_path = globals->recording_path;
+    if (!*session_data->runtime_params.recording_path) {
+        switch_copy_string(session_data->runtime_params.recording_path, globals->recording_path, sizeof(session_data->runtime_params.recording_path));
     }
-    if (!session_data->runtime_params.recording_prefix) {
-        session_data->runtime_params.recording_prefix = globals->recording_prefix;
+    if (!*session_data->runtime_params.recording_prefix) {
+        switch_copy_string(session_data->runtime_params.recording_prefix, globals->recording_prefix, sizeof(session_data->runtime_params.recording_prefix));
+    }
+
+    voice_detector_core_config_t config;
+    int direction;
+
+    // A stream_url this libcurl cannot open is dropped here, before it sizes the pre-roll
+    if (*params->stream_url && !voice_detector_stream_supported(params->stream_url)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "stream_url %s needs libcurl with WebSocket support, ASR streaming disabled for %s\n",
+                          params->stream_url, session_data->uuid);
+        *session_data->runtime_params.stream_url = '\0';
+    }
+    params = &session_data->runtime_params;
+
+    // The arena block is picked once, from what these parameters enable
+    voice_detector_arena_reserve(session_data, voice_detector_arena_need(session_data, params));
+
+    // Pre-roll is kept at the stream rate from the recorded direction, the recording gets undecimated audio
+    session_data->record_write_stream = !strcasecmp(session_data->runtime_params.leg, "b");
+    session_data->preroll_samples = 0;
+    if ((params->auto_record || *params->stream_url) && params->preroll_ms > 0) {
+        uint32_t wanted = (uint32_t)((int64_t)params->preroll_ms * session_data->stream_rate / 1000);
+        uint32_t capacity = voice_detector_ring_ceil_pow2(wanted);
+        int16_t *storage;
+
+        if (capacity > VOICE_DETECTOR_PREROLL_MAX_SAMPLES) {
+            capacity = VOICE_DETECTOR_PREROLL_MAX_SAMPLES;
+            wanted = VOICE_DETECTOR_PREROLL_MAX_SAMPLES;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "preroll_ms=%d capped at %u samples\n", params->preroll_ms, wanted);
+        }
+        if ((storage = voice_detector_arena_alloc(session_data, sizeof(int16_t) * capacity))) {
+            voice_detector_ring_init(&session_data->preroll, storage, capacity);
+            session_data->preroll_samples = wanted;
+        }
+    }
+
+    // Each monitored direction gets its own detector, so leg=both never mixes the two parties
+    session_data->monitored[VOICE_DETECTOR_DIRECTION_READ] = strcasecmp(session_data->runtime_params.leg, "b") != 0;
+    session_data->monitored[VOICE_DETECTOR_DIRECTION_WRITE] = strcasecmp(session_data->runtime_params.leg, "a") != 0;
+    session_data->double_talk = 0;
+
+    config.hits = params->hits;
+    config.debounce_ms = globals->debounce_ms;
+    config.min_word_length = params->min_word_length;
+    config.maximum_word_length = params->maximum_word_length;
+    config.between_words_silence = params->between_words_silence;
+    config.max_silence = params->max_silence;
+    config.hangover_ms = params->hangover_ms;
+    config.energy_threshold = params->energy_threshold;
+    config.noise_floor = params->noise_floor;
+    config.noise_margin = params->noise_margin;
+    config.noise_floor_min = params->noise_floor_min;
+    config.spectral_flatness = params->spectral_flatness;
+    config.spectral_band_ratio = params->spectral_band_ratio;
+    config.spectral_zcr = params->spectral_zcr;
+    config.amd = params->amd;
+    config.amd_greeting = params->amd_greeting;
+    config.amd_after_greeting_silence = params->amd_after_greeting_silence;
+    config.amd_initial_silence = params->amd_initial_silence;
+    config.amd_max_words = params->amd_max_words;
+    config.analysis_time = params->total_analysis_time;
+    config.timeout = params->timeout;
+    config.amd_total_analysis_time = params->total_analysis_time ? params->total_analysis_time : DEFAULT_AMD_TOTAL_ANALYSIS_TIME;
+    config.beep_min_length = params->beep_min_length;
+    config.beep_ratio = params->beep_ratio;
+    for (direction = 0; direction < VOICE_DETECTOR_DIRECTIONS; direction++) {
+        if (session_data->monitored[direction]) {
+            voice_detector_core_setup(session_data, &config, direction);
+        }
     }
-    
-    // Convert time values to frame counts
-    session_data->max_silence_frames = (params->max_silence * globals->sample_rate) / (globals->frame_size * 1000);
-    session_data->between_words_silence_frames = (params->between_words_silence * globals->sample_rate) / (globals->frame_size * 1000);
     
     return SWITCH_STATUS_SUCCESS;
 }
 
+// Allocate one direction's optional detector stages from the arena and initialise its core.
+// config carries everything but the rates, which depend on the decimation.
+static void voice_detector_core_setup(voice_detector_session_t *session_data, voice_detector_core_config_t *config, int direction)
+{
+    const voice_detector_runtime_params_t *params = &session_data->runtime_params;
+    voice_detector_decimator_t *decimator = NULL;
+    int16_t *analysis_buffer = NULL;
+    voice_detector_spectral_t *spectral = NULL;
+    voice_detector_tone_t *tone = NULL;
+
+    // Wideband legs can be analysed at a lower rate, recording still gets the full-rate stream
+    config->sample_rate = session_data->stream_rate;
+    config->frame_samples = session_data->stream_frame_samples;
+    if (params->analysis_rate > 0 && params->analysis_rate < session_data->stream_rate) {
+        int factor;
+
+        decimator = voice_detector_arena_alloc(session_data, sizeof(voice_detector_decimator_t));
+        factor = decimator ? voice_detector_decimator_configure(decimator, session_data->stream_rate, params->analysis_rate) : 0;
+        if (factor > 1 && (analysis_buffer = voice_detector_arena_alloc(session_data, sizeof(int16_t) * (VOICE_DETECTOR_DECIMATOR_MAX_INPUT / 2 + 1)))) {
+            config->sample_rate = session_data->stream_rate / factor;
+            config->frame_samples = session_data->stream_frame_samples / factor;
+        } else {
+            decimator = NULL;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Cannot decimate %dHz to %dHz, analysing at the stream rate\n",
+                              session_data->stream_rate, params->analysis_rate);
+        }
+    }
+
+    // Spectral mode: the analysis state lives in the arena, the core sizes its tables once
+    if (params->vad_mode == VOICE_DETECTOR_VAD_MODE_SPECTRAL) {
+        spectral = voice_detector_arena_alloc(session_data, sizeof(voice_detector_spectral_t));
+    }
+
+    // Beep detection comes with AMD, the Goertzel bank is built for the analysis rate
+    if (params->amd) {
+        tone = voice_detector_arena_alloc(session_data, sizeof(voice_detector_tone_t));
+    }
+
+    // Neural mode: windows of the analysis-rate audio are scored on a worker, the core takes the voicing
+    config->external_vad = 0;
+    if (params->vad_mode == VOICE_DETECTOR_VAD_MODE_NN &&
+        (session_data->nn[direction] = voice_detector_nn_channel_create(session_data, config->sample_rate))) {
+        config->external_vad = 1;
+    }
+
+    voice_detector_core_init(&session_data->core[direction], config, decimator, analysis_buffer, spectral, tone);
+}
+
+// Take the analysis rate and frame size from the monitored stream's codec, config values are the fallback
+static void voice_detector_init_timing(voice_detector_session_t *session_data, switch_bool_t write_stream)
+{
+    switch_codec_implementation_t impl = { 0 };
+    switch_status_t status;
+
+    if (write_stream) {
+        status = switch_core_session_get_write_impl(session_data->session, &impl);
+    } else {
+        status = switch_core_session_get_read_impl(session_data->session, &impl);
+    }
+
+    if (status == SWITCH_STATUS_SUCCESS && impl.actual_samples_per_second && impl.samples_per_packet) {
+        session_data->stream_rate = impl.actual_samples_per_second;
+        session_data->stream_frame_samples = impl.samples_per_packet;
+    } else {
+        session_data->stream_rate = globals->sample_rate;
+        session_data->stream_frame_samples = globals->frame_size;
+    }
+}
+
 // Parse configuration from XML
 static switch_status_t voice_detector_parse_config(switch_loadable_module_interface_t **mod_interface, switch_memory_pool_t *pool)
 {
@@ -200,6 +495,33 @@ static switch_status_t voice_detector_parse_config(switch_loadable_module_interf
     const char *max_silence_duration = NULL;
     const char *auto_record = NULL;
     const char *recording_format = NULL;
+    const char *dispatcher_threads = NULL;
+    const char *event_queue_size = NULL;
+    const char *batch_max_events = NULL;
+    const char *batch_max_latency_ms = NULL;
+    const char *spool_dir = NULL;
+    const char *spool_max_events = NULL;
+    const char *spool_retry_min_ms = NULL;
+    const char *spool_retry_max_ms = NULL;
+    const char *writer_threads = NULL;
+    const char *writer_queue_size = NULL;
+    const char *stream_threads = NULL;
+    const char *stream_queue_size = NULL;
+    const char *processing_threads = NULL;
+    const char *encoder_threads = NULL;
+    const char *encoder_queue_size = NULL;
+    const char *processing_queue_size = NULL;
+    const char *processing_batch = NULL;
+    const char *processing_affinity = NULL;
+    const char *overload_sessions = NULL;
+    const char *overload_idle_cpu = NULL;
+    const char *overload_analysis_time = NULL;
+    const char *nn_backend = NULL;
+    const char *nn_model = NULL;
+    const char *nn_threads = NULL;
+    const char *nn_batch = NULL;
+    const char *nn_max_wait_ms = NULL;
+    const char *nn_queue_size = NULL;
 
     // Set defaults
     globals->energy_threshold = 1000;
@@ -210,6 +532,27 @@ static switch_status_t voice_detector_parse_config(switch_loadable_module_interf
     globals->max_silence_duration = 2000;
     globals->auto_record = 1;
     globals->recording_format = 0; // 0 = wav, 1 = mp3, 2 = ogg
+    globals->dispatcher_threads = DEFAULT_DISPATCHER_THREADS;
+    globals->event_queue_size = DEFAULT_EVENT_QUEUE_SIZE;
+    globals->batch_max_events = DEFAULT_BATCH_MAX_EVENTS;
+    globals->batch_max_latency_ms = DEFAULT_BATCH_MAX_LATENCY_MS;
+    globals->spool_max_events = DEFAULT_SPOOL_MAX_EVENTS;
+    globals->spool_retry_min_ms = DEFAULT_SPOOL_RETRY_MIN_MS;
+    globals->spool_retry_max_ms = DEFAULT_SPOOL_RETRY_MAX_MS;
+    globals->writer_threads = DEFAULT_WRITER_THREADS;
+    globals->writer_queue_size = DEFAULT_WRITER_QUEUE_SIZE;
+    globals->stream_threads = DEFAULT_STREAM_THREADS;
+    globals->stream_queue_size = DEFAULT_STREAM_QUEUE_SIZE;
+    globals->processing_threads = DEFAULT_PROCESSING_THREADS;
+    globals->encoder_threads = DEFAULT_ENCODER_THREADS;
+    globals->encoder_queue_size = DEFAULT_ENCODER_QUEUE_SIZE;
+    globals->processing_queue_size = DEFAULT_PROCESSING_QUEUE_SIZE;
+    globals->processing_batch = DEFAULT_PROCESSING_BATCH;
+    globals->overload_analysis_time = DEFAULT_OVERLOAD_ANALYSIS_TIME;
+    globals->nn_threads = DEFAULT_NN_THREADS;
+    globals->nn_batch = DEFAULT_NN_BATCH;
+    globals->nn_max_wait_ms = DEFAULT_NN_MAX_WAIT_MS;
+    globals->nn_queue_size = DEFAULT_NN_QUEUE_SIZE;
 
     // Load configuration
     if (!(xml = switch_xml_open_cfg(getenv("SWITCH_CONF_DIR") ? getenv("SWITCH_CONF_DIR") : SWITCH_GLOBAL_dirs.conf_dir, "voice_detector.conf", &cfg))) {
@@ -246,6 +589,60 @@ static switch_status_t voice_detector_parse_config(switch_loadable_module_interf
                 auto_record = val;
             } else if (!strcasecmp(var, "recording-format")) {
                 recording_format = val;
+            } else if (!strcasecmp(var, "dispatcher-threads")) {
+                dispatcher_threads = val;
+            } else if (!strcasecmp(var, "event-queue-size")) {
+                event_queue_size = val;
+            } else if (!strcasecmp(var, "batch-max-events")) {
+                batch_max_events = val;
+            } else if (!strcasecmp(var, "batch-max-latency-ms")) {
+                batch_max_latency_ms = val;
+            } else if (!strcasecmp(var, "spool-dir")) {
+                spool_dir = val;
+            } else if (!strcasecmp(var, "spool-max-events")) {
+                spool_max_events = val;
+            } else if (!strcasecmp(var, "spool-retry-min-ms")) {
+                spool_retry_min_ms = val;
+            } else if (!strcasecmp(var, "spool-retry-max-ms")) {
+                spool_retry_max_ms = val;
+            } else if (!strcasecmp(var, "recording-writer-threads")) {
+                writer_threads = val;
+            } else if (!strcasecmp(var, "recording-writer-queue-size")) {
+                writer_queue_size = val;
+            } else if (!strcasecmp(var, "recording-encoder-threads")) {
+                encoder_threads = val;
+            } else if (!strcasecmp(var, "recording-encoder-queue-size")) {
+                encoder_queue_size = val;
+            } else if (!strcasecmp(var, "stream-threads")) {
+                stream_threads = val;
+            } else if (!strcasecmp(var, "stream-queue-size")) {
+                stream_queue_size = val;
+            } else if (!strcasecmp(var, "processing-threads")) {
+                processing_threads = val;
+            } else if (!strcasecmp(var, "processing-queue-size")) {
+                processing_queue_size = val;
+            } else if (!strcasecmp(var, "processing-batch")) {
+                processing_batch = val;
+            } else if (!strcasecmp(var, "processing-cpu-affinity")) {
+                processing_affinity = val;
+            } else if (!strcasecmp(var, "overload-sessions")) {
+                overload_sessions = val;
+            } else if (!strcasecmp(var, "overload-idle-cpu")) {
+                overload_idle_cpu = val;
+            } else if (!strcasecmp(var, "overload-analysis-time")) {
+                overload_analysis_time = val;
+            } else if (!strcasecmp(var, "nn-backend")) {
+                nn_backend = val;
+            } else if (!strcasecmp(var, "nn-model")) {
+                nn_model = val;
+            } else if (!strcasecmp(var, "nn-threads")) {
+                nn_threads = val;
+            } else if (!strcasecmp(var, "nn-batch")) {
+                nn_batch = val;
+            } else if (!strcasecmp(var, "nn-max-wait-ms")) {
+                nn_max_wait_ms = val;
+            } else if (!strcasecmp(var, "nn-queue-size")) {
+                nn_queue_size = val;
             }
         }
     }
@@ -257,6 +654,7 @@ static switch_status_t voice_detector_parse_config(switch_loadable_module_interf
     if (api_key) {
         globals->api_key = switch_core_strdup(globals->pool, api_key);
     }
+    voice_detector_build_http_headers();
     if (recording_path) {
         globals->recording_path = switch_core_strdup(globals->pool, recording_path);
     } else {
@@ -291,13 +689,179 @@ static switch_status_t voice_detector_parse_config(switch_loadable_module_interf
     if (recording_format) {
         globals->recording_format = atoi(recording_format);
     }
+    if (dispatcher_threads && atoi(dispatcher_threads) > 0) {
+        globals->dispatcher_threads = atoi(dispatcher_threads);
+    }
+    if (event_queue_size && atoi(event_queue_size) > 0) {
+        globals->event_queue_size = atoi(event_queue_size);
+    }
+    if (batch_max_events && atoi(batch_max_events) > 0) {
+        globals->batch_max_events = atoi(batch_max_events);
+    }
+    if (batch_max_latency_ms && atoi(batch_max_latency_ms) >= 0) {
+        globals->batch_max_latency_ms = atoi(batch_max_latency_ms);
+    }
+    if (spool_dir) {
+        globals->spool_dir = switch_core_strdup(globals->pool, spool_dir);
+    } else {
+        globals->spool_dir = switch_core_sprintf(globals->pool, "%s%svoice_detector", SWITCH_GLOBAL_dirs.storage_dir, SWITCH_PATH_SEPARATOR);
+    }
+    if (spool_max_events && atoi(spool_max_events) >= 0) {
+        globals->spool_max_events = atoi(spool_max_events);
+    }
+    if (spool_retry_min_ms && atoi(spool_retry_min_ms) > 0) {
+        globals->spool_retry_min_ms = atoi(spool_retry_min_ms);
+    }
+    if (spool_retry_max_ms && atoi(spool_retry_max_ms) > 0) {
+        globals->spool_retry_max_ms = atoi(spool_retry_max_ms);
+    }
+    if (globals->spool_retry_max_ms < globals->spool_retry_min_ms) {
+        globals->spool_retry_max_ms = globals->spool_retry_min_ms;
+    }
+    if (writer_threads && atoi(writer_threads) > 0) {
+        globals->writer_threads = atoi(writer_threads);
+    }
+    if (writer_queue_size && atoi(writer_queue_size) > VOICE_DETECTOR_WRITER_RESERVE) {
+        globals->writer_queue_size = atoi(writer_queue_size);
+    }
+    if (encoder_threads && atoi(encoder_threads) >= 0) {
+        globals->encoder_threads = atoi(encoder_threads);
+    }
+    if (encoder_queue_size && atoi(encoder_queue_size) > 0) {
+        globals->encoder_queue_size = atoi(encoder_queue_size);
+    }
+    if (stream_threads && atoi(stream_threads) > 0) {
+        globals->stream_threads = atoi(stream_threads);
+    }
+    if (stream_queue_size && atoi(stream_queue_size) > VOICE_DETECTOR_WRITER_RESERVE) {
+        globals->stream_queue_size = atoi(stream_queue_size);
+    }
+    if (processing_threads && atoi(processing_threads) >= 0) {
+        globals->processing_threads = atoi(processing_threads);
+    }
+    if (processing_queue_size && atoi(processing_queue_size) > VOICE_DETECTOR_BATCH_RESERVE) {
+        globals->processing_queue_size = atoi(processing_queue_size);
+    }
+    if (processing_batch && atoi(processing_batch) > 0) {
+        globals->processing_batch = atoi(processing_batch);
+    }
+    if (processing_affinity) {
+        globals->processing_affinity = switch_true(processing_affinity);
+    }
+    if (overload_sessions && atoi(overload_sessions) >= 0) {
+        globals->overload_sessions = atoi(overload_sessions);
+    }
+    if (overload_idle_cpu && atof(overload_idle_cpu) >= 0) {
+        globals->overload_idle_cpu = (float)atof(overload_idle_cpu);
+    }
+    if (overload_analysis_time && atoi(overload_analysis_time) > 0) {
+        globals->overload_analysis_time = atoi(overload_analysis_time);
+    }
+    globals->nn_backend = switch_core_strdup(globals->pool, nn_backend ? nn_backend : DEFAULT_NN_BACKEND);
+    if (!zstr(nn_model)) {
+        globals->nn_model = switch_core_strdup(globals->pool, nn_model);
+    }
+    if (nn_threads && atoi(nn_threads) > 0) {
+        globals->nn_threads = atoi(nn_threads);
+    }
+    if (nn_batch && atoi(nn_batch) > 0) {
+        globals->nn_batch = atoi(nn_batch);
+    }
+    if (nn_max_wait_ms && atoi(nn_max_wait_ms) >= 0) {
+        globals->nn_max_wait_ms = atoi(nn_max_wait_ms);
+    }
+    if (nn_queue_size && atoi(nn_queue_size) > 0) {
+        globals->nn_queue_size = atoi(nn_queue_size);
+    }
 
     switch_xml_free(xml);
     return SWITCH_STATUS_SUCCESS;
 }
 
+// Parse the <profiles> section of voice_detector.conf into frozen parameter sets and swap them in.
+// Runs at load and on reloadxml; sessions already running keep the copy they started with.
+static switch_status_t voice_detector_load_profiles(void)
+{
+    switch_xml_t cfg, xml, profiles, profile, param;
+    switch_memory_pool_t *pool = NULL, *old_pool;
+    switch_hash_t *hash = NULL, *old_hash;
+    int count = 0;
+
+    if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    switch_core_hash_init(&hash);
+
+    if ((xml = switch_xml_open_cfg(getenv("SWITCH_CONF_DIR") ? getenv("SWITCH_CONF_DIR") : SWITCH_GLOBAL_dirs.conf_dir, "voice_detector.conf", &cfg))) {
+        if ((profiles = switch_xml_child(cfg, "profiles"))) {
+            for (profile = switch_xml_child(profiles, "profile"); profile; profile = profile->next) {
+                const char *name = switch_xml_attr_soft(profile, "name");
+                voice_detector_profile_t *entry;
+
+                if (zstr(name)) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Skipping voice_detector profile without a name\n");
+                    continue;
+                }
+                if (switch_core_hash_find(hash, name)) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Duplicate voice_detector profile '%s', keeping the first\n", name);
+                    continue;
+                }
+
+                entry = switch_core_alloc(pool, sizeof(*entry));
+                switch_copy_string(entry->name, name, sizeof(entry->name));
+                voice_detector_runtime_params_defaults(&entry->params);
+
+                for (param = switch_xml_child(profile, "param"); param; param = param->next) {
+                    const char *var = switch_xml_attr_soft(param, "name");
+                    const char *val = switch_xml_attr_soft(param, "value");
+
+                    if (voice_detector_set_param(&entry->params, var, val) != SWITCH_STATUS_SUCCESS) {
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Profile '%s': ignoring invalid param %s=%s\n", name, var, val);
+                    }
+                }
+
+                switch_core_hash_insert(hash, entry->name, entry);
+                count++;
+            }
+        }
+        switch_xml_free(xml);
+    }
+
+    switch_thread_rwlock_wrlock(globals->profiles_lock);
+    old_hash = globals->profiles;
+    old_pool = globals->profiles_pool;
+    globals->profiles = hash;
+    globals->profiles_pool = pool;
+    globals->profile_count = count;
+    switch_thread_rwlock_unlock(globals->profiles_lock);
+
+    if (old_hash) {
+        switch_core_hash_destroy(&old_hash);
+    }
+    if (old_pool) {
+        switch_core_destroy_memory_pool(&old_pool);
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Loaded %d voice_detector profile(s)\n", count);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void voice_detector_destroy_profiles(void)
+{
+    switch_thread_rwlock_wrlock(globals->profiles_lock);
+    if (globals->profiles) {
+        switch_core_hash_destroy(&globals->profiles);
+    }
+    if (globals->profiles_pool) {
+        switch_core_destroy_memory_pool(&globals->profiles_pool);
+    }
+    globals->profile_count = 0;
+    switch_thread_rwlock_unlock(globals->profiles_lock);
+}
+
 // Generate recording filename
-static switch_status_t voice_detector_get_recording_filename(voice_detector_session_t *session_data, char **filename)
+static switch_status_t voice_detector_get_recording_filename(voice_detector_session_t *session_data, char *filename, switch_size_t len)
 {
     switch_time_t now = switch_micro_time_now();
     char timestamp[64];
@@ -319,13 +883,23 @@ static switch_status_t voice_detector_get_recording_filename(voice_detector_sess
     // Format timestamp
     switch_snprintf(timestamp, sizeof(timestamp), "%ld", now / 1000000);
     
-    // Create filename
-    *filename = switch_mprintf("%s/%s_%s_%s.%s", 
-                              session_data->runtime_params.recording_path,
-                              session_data->runtime_params.recording_prefix,
-                              session_data->uuid,
-                              timestamp,
-                              extension);
+    // Create filename, per-utterance files are numbered since several can start within a second
+    if (session_data->runtime_params.record_mode == VOICE_DETECTOR_RECORD_MODE_SEGMENTS) {
+        switch_snprintf(filename, len, "%s/%s_%s_%s_%03d.%s", 
+                                  session_data->runtime_params.recording_path,
+                                  session_data->runtime_params.recording_prefix,
+                                  session_data->uuid,
+                                  timestamp,
+                                  session_data->segment_index,
+                                  extension);
+    } else {
+        switch_snprintf(filename, len, "%s/%s_%s_%s.%s", 
+                                  session_data->runtime_params.recording_path,
+                                  session_data->runtime_params.recording_prefix,
+                                  session_data->uuid,
+                                  timestamp,
+                                  extension);
+    }
     
     return SWITCH_STATUS_SUCCESS;
 }
@@ -334,51 +908,57 @@ static switch_status_t voice_detector_get_recording_filename(voice_detector_sess
 static switch_status_t voice_detector_start_recording(voice_detector_session_t *session_data)
 {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
-    char *filename = NULL;
-    switch_record_flag_t flags = SWITCH_RECORD_FLAG_RECORD;
+    char *filename = session_data->recording_file;
     
     if (!session_data->runtime_params.auto_record || session_data->is_recording) {
         return SWITCH_STATUS_SUCCESS;
     }
     
     // Generate filename
-    status = voice_detector_get_recording_filename(session_data, &filename);
-    if (status != SWITCH_STATUS_SUCCESS || !filename) {
+    status = voice_detector_get_recording_filename(session_data, filename, sizeof(session_data->recording_file));
+    if (status != SWITCH_STATUS_SUCCESS || !*filename) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to generate recording filename\n");
         return SWITCH_STATUS_FALSE;
     }
     
-    // Set recording flags based on format
-    switch (session_data->runtime_params.recording_format) {
-        case 1: // MP3
-            flags |= SWITCH_RECORD_FLAG_MP3;
-            break;
-        case 2: // OGG
-            flags |= SWITCH_RECORD_FLAG_OGG;
-            break;
-        default: // WAV
-            flags |= SWITCH_RECORD_FLAG_WAV;
-            break;
+    // Start recording, the file format follows the extension chosen for recording_format.
+    // A writer thread opens and writes the file; the module feeds it frames so the pre-roll
+    // can go in ahead of live audio and disk latency stays off the media thread.
+    voice_detector_recording_t *recording = calloc(1, sizeof(*recording));
+    if (!recording) {
+        return SWITCH_STATUS_MEMERR;
     }
-    
-    // Start recording
-    status = switch_core_session_record_start(session_data->session, &session_data->record_session, filename, flags, NULL);
-    if (status != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start recording: %s\n", filename);
-        switch_safe_free(filename);
-        return status;
+    switch_copy_string(recording->path, filename, sizeof(recording->path));
+    recording->rate = session_data->stream_rate;
+    recording->writer = voice_detector_hash_uuid(session_data->uuid) % globals->writer_threads;
+    // Compressed formats are captured raw and encoded by the pool, which also reports the stop
+    if (globals->encoder_queue && session_data->runtime_params.recording_format) {
+        recording->encode = 1;
+        switch_snprintf(recording->raw_path, sizeof(recording->raw_path), "%s%s", filename, VOICE_DETECTOR_ENCODER_RAW_SUFFIX);
+        switch_copy_string(recording->uuid, session_data->uuid, sizeof(recording->uuid));
+        switch_copy_string(recording->leg, voice_detector_direction_legs[session_data->record_write_stream], sizeof(recording->leg));
+        recording->sink = session_data->runtime_params.sink;
+    }
+
+    if (!voice_detector_writer_push(recording, VOICE_DETECTOR_WRITER_OP_OPEN, NULL, 0)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start recording, writer queue full: %s\n", filename);
+        free(recording);
+        return SWITCH_STATUS_FALSE;
     }
     
     // Store recording info
-    session_data->recording_file = filename;
+    session_data->recording = recording;
     session_data->is_recording = 1;
+    session_data->recording_paused = 0;
     session_data->recording_start_time = switch_micro_time_now();
     session_data->recording_duration = 0;
+    session_data->recorded_samples = 0;
+    session_data->segment_index++;
     
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started recording: %s\n", filename);
     
     // Send API call for recording start
-    voice_detector_api_call(session_data->uuid, 2, 0, session_data->runtime_params.leg); // 2 = recording started
+    voice_detector_emit(session_data, voice_detector_direction_legs[session_data->record_write_stream], VOICE_DETECTOR_EVENT_RECORDING_START, 0);
     
     return SWITCH_STATUS_SUCCESS;
 }
@@ -386,282 +966,2908 @@ static switch_status_t voice_detector_start_recording(voice_detector_session_t *
 // Stop recording
 static switch_status_t voice_detector_stop_recording(voice_detector_session_t *session_data)
 {
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    int encode;
     
-    if (!session_data->is_recording || !session_data->record_session) {
+    if (!session_data->is_recording) {
         return SWITCH_STATUS_SUCCESS;
     }
     
-    // Calculate recording duration
-    switch_time_t now = switch_micro_time_now();
-    session_data->recording_duration = (now - session_data->recording_start_time) / 1000000; // Convert to seconds
+    // Recording duration is the audio written, in speech mode that excludes the pauses
+    session_data->recording_duration = session_data->recorded_samples / session_data->stream_rate; // Convert to seconds
+    encode = session_data->recording->encode;
+    session_data->recording->duration = session_data->recording_duration;
     
-    // Stop recording
-    status = switch_core_session_record_stop(session_data->record_session);
-    if (status != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to stop recording\n");
-        return status;
-    }
+    // Stop recording, the writer flushes and closes the file after the queued audio. The close
+    // never fails: a full queue puts it on the writer's closing list instead.
+    voice_detector_writer_push(session_data->recording, VOICE_DETECTOR_WRITER_OP_CLOSE, NULL, 0);
+    session_data->recording = NULL;
     
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Stopped recording: %s (duration: %lds)\n", 
                       session_data->recording_file, session_data->recording_duration);
     
-    // Send API call for recording stop
-    voice_detector_api_call(session_data->uuid, 3, session_data->recording_duration, session_data->runtime_params.leg); // 3 = recording stopped
+    // Send API call for recording stop, deferred recordings report it once the encoder is done
+    if (!encode) {
+        voice_detector_emit(session_data, voice_detector_direction_legs[session_data->record_write_stream], VOICE_DETECTOR_EVENT_RECORDING_STOP, session_data->recording_duration);
+    }
     
     // Clean up recording session
-    session_data->record_session = NULL;
     session_data->is_recording = 0;
+    session_data->recording_paused = 0;
     
     return SWITCH_STATUS_SUCCESS;
 }
 
-// Media bug callback function
-static switch_status_t voice_detector_callback(switch_media_bug_t *bug, void *user_data, switch_frame_t *frame)
+// Hand samples to the recording's writer thread
+static void voice_detector_record_write(voice_detector_session_t *session_data, const int16_t *samples, uint32_t count)
 {
-    voice_detector_session_t *session_data = (voice_detector_session_t *)user_data;
-    switch_core_session_t *session = session_data->session;
-    switch_time_t now = switch_micro_time_now();
-    int16_t *audio_data = (int16_t *)frame->data;
-    int samples = frame->samples;
-    float energy = 0.0f;
-    int i;
+    if (voice_detector_writer_push(session_data->recording, VOICE_DETECTOR_WRITER_OP_WRITE, samples, count)) {
+        session_data->recorded_samples += count;
+    }
+}
 
-    if (!session_data || !session || !audio_data || samples <= 0) {
-        return SWITCH_STATUS_SUCCESS;
+// Voice confirmed: start a recording or resume the speech-only file, and open the ASR stream gate.
+// Whichever sink starts here is led by the pre-roll.
+static void voice_detector_segment_start(voice_detector_session_t *session_data)
+{
+    switch_bool_t to_recording = SWITCH_FALSE;
+    switch_bool_t to_stream = SWITCH_FALSE;
+
+    if (!session_data->is_recording) {
+        to_recording = voice_detector_start_recording(session_data) == SWITCH_STATUS_SUCCESS && session_data->is_recording;
+    } else if (session_data->recording_paused) {
+        session_data->recording_paused = 0;
+        to_recording = SWITCH_TRUE;
     }
 
-    // Calculate audio energy (normalized)
-    for (i = 0; i < samples; i++) {
-        energy += (float)(audio_data[i] * audio_data[i]);
-    }
-    energy = sqrt(energy / samples) / 32768.0f; // Normalize to 0-1 range
-
-    session_data->total_frames++;
-
-    // Advanced voice detection logic with runtime parameters
-    // API Call Sequence:
-    // 1. First voice frame detected -> API call for voice start (immediate)
-    // 2. Consecutive hits reached -> Start recording -> API call for recording start
-    // 3. Silence threshold reached -> Stop recording -> API call for recording stop
-    // 4. Voice end confirmed -> API call for voice end
-    if (energy > session_data->runtime_params.energy_threshold) {
-        if (!session_data->voice_detected) {
-            // Voice start detection - call API immediately on first voice frame
-            session_data->consecutive_hits++;
-            
-            // Call API immediately when first voice frame is detected
-            if ((now - session_data->last_api_call_time) > (globals->debounce_ms * 1000)) {
-                voice_detector_api_call(session_data->uuid, 1, (int)(energy * 1000), session_data->runtime_params.leg); // Voice started
-                session_data->last_api_call_time = now;
-            }
-            
-            // Start recording and set voice detected after consecutive hits validation
-            if (session_data->consecutive_hits >= session_data->runtime_params.hits) {
-                session_data->voice_detected = 1;
-                session_data->last_voice_time = now;
-                session_data->silence_frames = 0;
-                session_data->word_start_time = now;
-                session_data->current_word_length = 0;
-                
-                // Start recording when voice is confirmed (after consecutive hits)
-                voice_detector_start_recording(session_data);
-            }
-        } else {
-            // Voice is continuing
-            session_data->consecutive_hits = 0;
-            session_data->current_word_length += (globals->frame_size * 1000 / globals->sample_rate);
-            
-            // Check if word length exceeds maximum
-            if (session_data->current_word_length > session_data->runtime_params.maximum_word_length) {
-                // Word too long, might be noise - reset
-                session_data->voice_detected = 0;
-                session_data->consecutive_hits = 0;
-                voice_detector_stop_recording(session_data);
-            }
-        }
-    } else {
-        if (session_data->voice_detected) {
-            session_data->silence_frames++;
-            session_data->consecutive_hits = 0;
-            
-            // Check if silence duration exceeds threshold
-            int silence_duration = session_data->silence_frames * (globals->frame_size * 1000 / globals->sample_rate);
-            
-            if (silence_duration > session_data->runtime_params.max_silence) {
-                // Long silence - stop recording and voice detection
-                session_data->voice_detected = 0;
-                voice_detector_stop_recording(session_data);
-                
-                // Trigger API call for voice end
-                if ((now - session_data->last_api_call_time) > (globals->debounce_ms * 1000)) {
-                    voice_detector_api_call(session_data->uuid, 0, (int)(energy * 1000), session_data->runtime_params.leg);
-                    session_data->last_api_call_time = now;
-                }
-            } else if (silence_duration > session_data->runtime_params.between_words_silence) {
-                // Short silence between words - check word length
-                if (session_data->current_word_length >= session_data->runtime_params.min_word_length) {
-                    // Valid word detected
-                    session_data->word_end_time = now;
-                    int word_duration = (session_data->word_end_time - session_data->word_start_time) / 1000000;
-                    
-                    // Send word detection event
-                    voice_detector_api_call(session_data->uuid, 4, word_duration, session_data->runtime_params.leg); // 4 = word detected
-                    
-                    // Reset for next word
-                    session_data->word_start_time = now;
-                    session_data->current_word_length = 0;
-                }
-            }
-        }
+    if (session_data->stream && !session_data->stream_gate_open) {
+        session_data->stream_gate_open = 1;
+        to_stream = SWITCH_TRUE;
     }
 
-    return SWITCH_STATUS_SUCCESS;
+    voice_detector_flush_preroll(session_data, to_recording, to_stream);
 }
 
-// API call function
-static switch_status_t voice_detector_api_call(const char *uuid, int voice_detected, int energy_level, const char *leg)
+// Speech over. After the hangover the ASR gate closes, as do per-utterance files and the
+// speech-only file (paused until the channel goes away). max_silence and over-long words
+// (hangover false) also end continuous recordings.
+static void voice_detector_segment_end(voice_detector_session_t *session_data, switch_bool_t hangover)
 {
-    switch_curl_slist_t *headers = NULL;
-    switch_curl_slist_t *cur;
-    switch_memory_pool_t *pool;
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
-    char *url = NULL;
-    char *post_data = NULL;
-    switch_json_t *json = NULL;
-    switch_curl_handle_t *curl = NULL;
-
-    if (!globals->api_url) {
-        return SWITCH_STATUS_SUCCESS; // No API URL configured
+    if (session_data->stream_gate_open) {
+        session_data->stream_gate_open = 0;
+        voice_detector_stream_push(session_data->stream, VOICE_DETECTOR_STREAM_OP_FLUSH, NULL, 0);
     }
 
-    // Create memory pool for this request
-    switch_core_new_memory_pool(&pool);
-
-    // Create JSON payload
-    json = switch_json_create_object(pool);
-    switch_json_add_string(json, "uuid", uuid);
-    switch_json_add_string(json, "leg", leg ? leg : "a");  // Include leg information
-    switch_json_add_int(json, "voice_detected", voice_detected);
-    switch_json_add_int(json, "energy_level", energy_level);
-    switch_json_add_int(json, "timestamp", (int)switch_micro_time_now() / 1000000);
-    
-    // Add recording information for recording events
-    if (voice_detected == 2) { // Recording started
-        switch_json_add_string(json, "event_type", "recording_started");
-    } else if (voice_detected == 3) { // Recording stopped
-        switch_json_add_string(json, "event_type", "recording_stopped");
-        switch_json_add_int(json, "recording_duration", energy_level); // energy_level contains duration in this case
-    } else if (voice_detected == 1) { // Voice start
-        switch_json_add_string(json, "event_type", "voice_started");
-    } else if (voice_detected == 0) { // Voice end
-        switch_json_add_string(json, "event_type", "voice_ended");
-    } else if (voice_detected == 4) { // Word detected
-        switch_json_add_string(json, "event_type", "word_detected");
-        switch_json_add_int(json, "word_duration", energy_level); // energy_level contains word duration in this case
-    }
-
-    post_data = switch_json_print(json, pool);
-
-    // Set up headers
-    headers = switch_curl_slist_append(headers, "Content-Type: application/json");
-    if (globals->api_key) {
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", globals->api_key);
-        headers = switch_curl_slist_append(headers, auth_header);
+    if (!session_data->is_recording || session_data->recording_paused) {
+        return;
     }
-
-    // Initialize CURL
-    curl = switch_curl_easy_init();
-    if (!curl) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to initialize CURL\n");
-        status = SWITCH_STATUS_FALSE;
-        goto cleanup;
+    if (hangover && session_data->runtime_params.record_mode == VOICE_DETECTOR_RECORD_MODE_CONTINUOUS) {
+        return;
     }
 
-    // Set CURL options
-    switch_curl_easy_setopt(curl, CURLOPT_URL, globals->api_url);
-    switch_curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
-    switch_curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    switch_curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    switch_curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-
-    // Perform request
-    CURLcode res = switch_curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "CURL request failed: %s\n", switch_curl_easy_strerror(res));
-        status = SWITCH_STATUS_FALSE;
+    if (session_data->runtime_params.record_mode != VOICE_DETECTOR_RECORD_MODE_SPEECH) {
+        voice_detector_stop_recording(session_data);
     } else {
-        long http_code = 0;
-        switch_curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "API call successful: HTTP %ld\n", http_code);
+        session_data->recording_paused = 1;
     }
+}
 
-cleanup:
-    if (curl) {
-        switch_curl_easy_cleanup(curl);
-    }
-    if (headers) {
-        switch_curl_slist_free_all(headers);
+// True when a sink is waiting for speech to resume within an ongoing voice period
+static switch_bool_t voice_detector_segment_idle(voice_detector_session_t *session_data)
+{
+    if (session_data->stream && !session_data->stream_gate_open) {
+        return SWITCH_TRUE;
     }
-    switch_core_destroy_memory_pool(&pool);
 
-    return status;
+    return session_data->runtime_params.auto_record &&
+           session_data->runtime_params.record_mode != VOICE_DETECTOR_RECORD_MODE_CONTINUOUS &&
+           (!session_data->is_recording || session_data->recording_paused);
 }
 
-// Session cleanup function
-static switch_status_t voice_detector_session_cleanup(voice_detector_session_t *session_data)
+// Write the last preroll_samples of buffered audio into the sinks that just started
+static void voice_detector_flush_preroll(voice_detector_session_t *session_data, switch_bool_t to_recording, switch_bool_t to_stream)
 {
-    if (!session_data) {
-        return SWITCH_STATUS_SUCCESS;
-    }
+    int16_t chunk[VOICE_DETECTOR_PREROLL_FLUSH_CHUNK];
+    uint32_t count;
 
-    // Stop recording if active
-    if (session_data->is_recording) {
-        voice_detector_stop_recording(session_data);
+    if (!session_data->preroll_samples || (!to_recording && !to_stream)) {
+        return;
     }
 
-    // Remove media bug if exists
-    if (session_data->bug) {
-        switch_core_media_bug_remove(session_data->bug, SWITCH_TRUE);
-        session_data->bug = NULL;
+    voice_detector_ring_keep_latest(&session_data->preroll, session_data->preroll_samples);
+    while ((count = voice_detector_ring_read(&session_data->preroll, chunk, VOICE_DETECTOR_PREROLL_FLUSH_CHUNK)) > 0) {
+        if (to_recording) {
+            voice_detector_record_write(session_data, chunk, count);
+        }
+        if (to_stream) {
+            voice_detector_stream_push(session_data->stream, VOICE_DETECTOR_STREAM_OP_AUDIO, chunk, count);
+        }
     }
+}
 
-    // Free recording file name
-    if (session_data->recording_file) {
-        switch_safe_free(session_data->recording_file);
+// The recorded direction goes to the open sinks, and always into the pre-roll ring so a
+// sink that starts later can lead with the audio before it
+static void voice_detector_route_audio(voice_detector_session_t *session_data, const int16_t *audio_data, int samples, switch_bool_t write_stream)
+{
+    if (write_stream != session_data->record_write_stream) {
+        return;
     }
 
-    // Free session data
-    if (session_data->pool) {
-        switch_core_destroy_memory_pool(&session_data->pool);
+    if (session_data->is_recording && !session_data->recording_paused) {
+        voice_detector_record_write(session_data, audio_data, (uint32_t)samples);
+    }
+    if (session_data->stream_gate_open) {
+        voice_detector_stream_push(session_data->stream, VOICE_DETECTOR_STREAM_OP_AUDIO, audio_data, (uint32_t)samples);
+    }
+    if (session_data->preroll_samples) {
+        voice_detector_ring_write(&session_data->preroll, audio_data, (uint32_t)samples);
     }
-
-    return SWITCH_STATUS_SUCCESS;
 }
 
-// Application function
-static switch_status_t voice_detector_app_function(switch_core_session_t *session, const char *data)
+// Drive the sinks from the events one direction's core returned for a frame. Voice events are
+// tagged with that direction's leg, segments only drive the sinks of the recorded direction.
+static void voice_detector_handle_events(voice_detector_session_t *session_data, switch_bool_t write_stream,
+                                         const voice_detector_core_event_t *events, int count)
 {
-    switch_channel_t *channel = switch_core_session_get_channel(session);
-    const char *uuid = switch_channel_get_uuid(channel);
-    voice_detector_session_t *session_data = NULL;
-    voice_detector_runtime_params_t runtime_params;
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    const char *leg = voice_detector_direction_legs[write_stream];
+    int double_talk;
+    int i;
+
+    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_FRAMES, 1);
+
+    for (i = 0; i < count; i++) {
+        if (write_stream != session_data->record_write_stream && events[i].type != VOICE_DETECTOR_CORE_VOICE_START &&
+            events[i].type != VOICE_DETECTOR_CORE_VOICE_END && events[i].type != VOICE_DETECTOR_CORE_WORD &&
+            events[i].type != VOICE_DETECTOR_CORE_BEEP && events[i].type != VOICE_DETECTOR_CORE_AMD) {
+            // Segments and the end of the analysis follow the recorded direction only
+            if (events[i].type == VOICE_DETECTOR_CORE_SEGMENT_START && !events[i].value) {
+                voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_VOICE_STARTS, 1);
+            } else if (events[i].type == VOICE_DETECTOR_CORE_FALSE_START) {
+                voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_FALSE_STARTS, 1);
+            }
+            continue;
+        }
+
+        switch (events[i].type) {
+        case VOICE_DETECTOR_CORE_VOICE_START:
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_VOICE_START, events[i].value);
+            break;
+        case VOICE_DETECTOR_CORE_SEGMENT_START:
+            // A resume only matters to a sink that is waiting for speech
+            if (!events[i].value) {
+                voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_VOICE_STARTS, 1);
+            }
+            if (!events[i].value || voice_detector_segment_idle(session_data)) {
+                voice_detector_segment_start(session_data);
+            }
+            break;
+        case VOICE_DETECTOR_CORE_SEGMENT_END:
+            voice_detector_segment_end(session_data, SWITCH_TRUE);
+            break;
+        case VOICE_DETECTOR_CORE_FALSE_START:
+            voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_FALSE_STARTS, 1);
+            voice_detector_segment_end(session_data, SWITCH_FALSE);
+            break;
+        case VOICE_DETECTOR_CORE_SILENCE_TIMEOUT:
+            voice_detector_segment_end(session_data, SWITCH_FALSE);
+            break;
+        case VOICE_DETECTOR_CORE_VOICE_END:
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_VOICE_END, events[i].value);
+            break;
+        case VOICE_DETECTOR_CORE_WORD:
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_WORD_DETECTED, events[i].value);
+            break;
+        case VOICE_DETECTOR_CORE_BEEP:
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_BEEP, events[i].value);
+            break;
+        case VOICE_DETECTOR_CORE_AMD:
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_AMD, events[i].value);
+            break;
+        case VOICE_DETECTOR_CORE_FINISHED:
+            // Final event, the media bug callback sees the flag and detaches
+            voice_detector_emit(session_data, leg, VOICE_DETECTOR_EVENT_ANALYSIS_COMPLETE, events[i].value);
+            __atomic_store_n(&session_data->finished, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    // Double-talk: both parties in a confirmed voice period, reported on entry (1) and exit (0)
+    if (session_data->monitored[VOICE_DETECTOR_DIRECTION_READ] && session_data->monitored[VOICE_DETECTOR_DIRECTION_WRITE]) {
+        double_talk = session_data->core[VOICE_DETECTOR_DIRECTION_READ].voice_detected &&
+                      session_data->core[VOICE_DETECTOR_DIRECTION_WRITE].voice_detected;
+        if (double_talk != session_data->double_talk) {
+            session_data->double_talk = double_talk;
+            voice_detector_emit(session_data, "both", VOICE_DETECTOR_EVENT_DOUBLE_TALK, double_talk);
+        }
+    }
+}
+
+// Pick the directions that can be analysed from their G.711 payload, returns the native tap flags.
+// Only narrowband PCMU/PCMA streams analysed at their own rate qualify.
+static switch_media_bug_flag_t voice_detector_g711_setup(voice_detector_session_t *session_data)
+{
+    switch_media_bug_flag_t flags = 0;
+    int direction;
+
+    if (!session_data->runtime_params.native_g711 || session_data->stream_rate != 8000) {
+        return 0;
+    }
+
+    for (direction = 0; direction < VOICE_DETECTOR_DIRECTIONS; direction++) {
+        switch_codec_implementation_t impl = { 0 };
+        switch_status_t status;
+
+        if (!session_data->monitored[direction] || session_data->core[direction].decimator) {
+            continue;
+        }
+        if (direction == VOICE_DETECTOR_DIRECTION_WRITE) {
+            status = switch_core_session_get_write_impl(session_data->session, &impl);
+        } else {
+            status = switch_core_session_get_read_impl(session_data->session, &impl);
+        }
+        if (status != SWITCH_STATUS_SUCCESS || impl.actual_samples_per_second != 8000 ||
+            !(session_data->g711[direction] = voice_detector_g711_table(impl.iananame))) {
+            continue;
+        }
+        flags |= direction == VOICE_DETECTOR_DIRECTION_WRITE ? SMBF_TAP_NATIVE_WRITE : SMBF_TAP_NATIVE_READ;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Session %s leg %s: detecting on native %s payload\n",
+                          session_data->uuid, voice_detector_direction_legs[direction], impl.iananame);
+    }
+
+    return flags;
+}
+
+// Run G.711 payload whose energy is known through the direction's core. The spectral and tone
+// stages need the waveform and get it from the linear table, energy alone never decodes.
+static int voice_detector_g711_process(voice_detector_session_t *session_data, const uint8_t *payload, int count, switch_bool_t write_stream,
+                                       uint64_t energy_sum, voice_detector_core_event_t *events)
+{
+    voice_detector_core_t *core = &session_data->core[write_stream];
+    int16_t pcm[VOICE_DETECTOR_BATCH_FRAME_SAMPLES];
+
+    if (!core->spectral && !core->tone && !session_data->nn[write_stream]) {
+        return voice_detector_core_process_energy(core, NULL, count, energy_sum, events);
+    }
+
+    if (count > VOICE_DETECTOR_BATCH_FRAME_SAMPLES) {
+        count = VOICE_DETECTOR_BATCH_FRAME_SAMPLES;
+        energy_sum = voice_detector_g711_sum_squares(session_data->g711[write_stream], payload, count);
+    }
+    voice_detector_g711_decode(session_data->g711[write_stream], payload, (size_t)count, pcm);
+    count = voice_detector_core_process_energy(core, pcm, count, energy_sum, events);
+    voice_detector_nn_feed(session_data, write_stream, pcm);
+
+    return count;
+}
+
+// Native tap frame, inline mode: energy from the squared-magnitude table, one byte per sample
+static void voice_detector_g711_frame(voice_detector_session_t *session_data, const switch_frame_t *frame, switch_bool_t write_stream)
+{
+    const uint8_t *payload = (const uint8_t *)frame->data;
+    int samples = (int)frame->datalen;
+    voice_detector_core_event_t events[VOICE_DETECTOR_CORE_MAX_EVENTS];
+    int count;
+
+    if (!session_data->monitored[write_stream]) {
+        return;
+    }
+
+    if (frame->flags & SFF_CNG) {
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_SILENT_FRAMES, 1);
+        count = voice_detector_core_process_silence(&session_data->core[write_stream], samples, events);
+        voice_detector_nn_feed(session_data, write_stream, NULL);
+    } else {
+        count = voice_detector_g711_process(session_data, payload, samples, write_stream,
+                                            voice_detector_g711_sum_squares(session_data->g711[write_stream], payload, (size_t)samples), events);
+    }
+    voice_detector_handle_events(session_data, write_stream, events, count);
+}
+
+// Media bug callback function
+static switch_status_t voice_detector_callback(switch_media_bug_t *bug, void *user_data, switch_frame_t *frame, switch_bool_t write_stream)
+{
+    voice_detector_session_t *session_data = (voice_detector_session_t *)user_data;
+    int16_t *audio_data = (int16_t *)frame->data;
+    int samples = frame->samples;
+    voice_detector_core_event_t events[VOICE_DETECTOR_CORE_MAX_EVENTS];
+    int count;
+
+    if (!session_data || !session_data->session || !audio_data || samples <= 0 || !session_data->monitored[write_stream]) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    voice_detector_route_audio(session_data, audio_data, samples, write_stream);
+    if (session_data->g711[write_stream]) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    // Detection runs in the direction's core, the events it returns drive the sinks. Comfort noise
+    // and DTX frames the codec layer flagged, and digital silence, skip the analysis altogether.
+    if ((frame->flags & SFF_CNG) || voice_detector_energy_is_zero(audio_data, samples)) {
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_SILENT_FRAMES, 1);
+        count = voice_detector_core_process_silence(&session_data->core[write_stream], samples, events);
+        voice_detector_nn_feed(session_data, write_stream, NULL);
+    } else {
+        count = voice_detector_core_process_frame(&session_data->core[write_stream], audio_data, samples, events);
+        voice_detector_nn_feed(session_data, write_stream, audio_data);
+    }
+    voice_detector_handle_events(session_data, write_stream, events, count);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// One direction's mono frame, analysed inline or copied to the session's processing worker
+static void voice_detector_bug_frame(switch_media_bug_t *bug, voice_detector_session_t *session_data, switch_frame_t *frame, switch_bool_t write_stream)
+{
+    if (session_data->processor) {
+        voice_detector_processor_push(session_data, VOICE_DETECTOR_BATCH_OP_FRAME, frame->data, frame->samples, write_stream,
+                                      (frame->flags & SFF_CNG) != 0);
+    } else {
+        uint64_t started = voice_detector_metrics_now_ns();
+
+        voice_detector_callback(bug, session_data, frame, write_stream);
+        voice_detector_metrics_observe(globals->metrics, VOICE_DETECTOR_HISTOGRAM_CALLBACK_NS, voice_detector_metrics_now_ns() - started);
+    }
+}
+
+// Media bug callback: pulls frames from the bug and cleans up when the bug closes.
+// In batched mode frames are only copied to the session's processing worker.
+static switch_bool_t voice_detector_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
+{
+    voice_detector_session_t *session_data = (voice_detector_session_t *)user_data;
+
+    switch (type) {
+    case SWITCH_ABC_TYPE_INIT:
+        break;
+    case SWITCH_ABC_TYPE_READ:
+    case SWITCH_ABC_TYPE_WRITE: {
+        // The READ/WRITE type only says which media path fired, not whose audio the bug returns.
+        // A single leg gets that leg's audio; leg=both reads stereo, read stream left, write stream right.
+        uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+        int16_t split[VOICE_DETECTOR_DIRECTIONS][SWITCH_RECOMMENDED_BUFFER_SIZE / (2 * sizeof(int16_t))];
+        switch_frame_t frame = { 0 };
+        switch_frame_t mono;
+        int direction, samples, i;
+
+        frame.data = data;
+        frame.buflen = sizeof(data);
+        while (!__atomic_load_n(&session_data->finished, __ATOMIC_ACQUIRE) &&
+               switch_core_media_bug_read(bug, &frame, SWITCH_FALSE) == SWITCH_STATUS_SUCCESS && frame.datalen) {
+            if (!session_data->split_legs) {
+                voice_detector_bug_frame(bug, session_data, &frame, session_data->record_write_stream);
+                continue;
+            }
+
+            samples = (int)(frame.datalen / (2 * sizeof(int16_t)));
+            for (i = 0; i < samples; i++) {
+                split[VOICE_DETECTOR_DIRECTION_READ][i] = ((int16_t *)data)[2 * i];
+                split[VOICE_DETECTOR_DIRECTION_WRITE][i] = ((int16_t *)data)[2 * i + 1];
+            }
+            for (direction = 0; direction < VOICE_DETECTOR_DIRECTIONS; direction++) {
+                mono = frame;
+                mono.data = split[direction];
+                mono.datalen = (uint32_t)(samples * sizeof(int16_t));
+                mono.samples = (uint32_t)samples;
+                mono.channels = 1;
+                voice_detector_bug_frame(bug, session_data, &mono, direction);
+            }
+        }
+
+        // Analysis over: returning false removes the bug, CLOSE then cleans up as on hangup
+        if (__atomic_load_n(&session_data->finished, __ATOMIC_ACQUIRE)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Voice detection finished for session %s\n", session_data->uuid);
+            return SWITCH_FALSE;
+        }
+        break;
+    }
+    case SWITCH_ABC_TYPE_TAP_NATIVE_READ:
+    case SWITCH_ABC_TYPE_TAP_NATIVE_WRITE: {
+        // Encoded G.711 before the decoder, detection only, the sinks keep the decoded stream
+        switch_bool_t write_stream = type == SWITCH_ABC_TYPE_TAP_NATIVE_WRITE;
+        switch_frame_t *frame = write_stream ? switch_core_media_bug_get_native_write_frame(bug) : switch_core_media_bug_get_native_read_frame(bug);
+
+        if (!frame || !frame->data || !frame->datalen || !session_data->g711[write_stream] ||
+            __atomic_load_n(&session_data->finished, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (session_data->processor) {
+            voice_detector_processor_push(session_data, VOICE_DETECTOR_BATCH_OP_G711, frame->data, (int)frame->datalen, write_stream,
+                                          (frame->flags & SFF_CNG) != 0);
+        } else {
+            uint64_t started = voice_detector_metrics_now_ns();
+
+            voice_detector_g711_frame(session_data, frame, write_stream);
+            voice_detector_metrics_observe(globals->metrics, VOICE_DETECTOR_HISTOGRAM_CALLBACK_NS, voice_detector_metrics_now_ns() - started);
+        }
+        break;
+    }
+    case SWITCH_ABC_TYPE_CLOSE:
+        if (session_data->processor) {
+            // The worker cleans up after the frames still queued for this session
+            voice_detector_processor_close(session_data);
+        } else {
+            voice_detector_session_cleanup(session_data);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return SWITCH_TRUE;
+}
+
+// Claim the module's CUSTOM subclasses
+static void voice_detector_subclasses_reserve(void)
+{
+    int type;
+
+    for (type = 0; type < VOICE_DETECTOR_EVENT_TYPES; type++) {
+        switch_event_reserve_subclass(voice_detector_event_subclasses[type]);
+    }
+    switch_event_reserve_subclass(VOICE_DETECTOR_EVENT_TRANSCRIPT);
+}
+
+static void voice_detector_subclasses_free(void)
+{
+    int type;
+
+    for (type = 0; type < VOICE_DETECTOR_EVENT_TYPES; type++) {
+        switch_event_free_subclass(voice_detector_event_subclasses[type]);
+    }
+    switch_event_free_subclass(VOICE_DETECTOR_EVENT_TRANSCRIPT);
+}
+
+// Route a detection event to the session's sinks, leg is the direction it was detected on
+static void voice_detector_emit(voice_detector_session_t *session_data, const char *leg, int type, int value)
+{
+    if (session_data->runtime_params.sink & VOICE_DETECTOR_SINK_EVENT) {
+        voice_detector_fire_event(session_data, leg, type, value);
+    }
+    if (session_data->runtime_params.sink & VOICE_DETECTOR_SINK_HTTP) {
+        voice_detector_api_call(session_data->uuid, type, value, leg,
+                                type == VOICE_DETECTOR_EVENT_RECORDING_START || type == VOICE_DETECTOR_EVENT_RECORDING_STOP ? session_data->recording_file : NULL, 1);
+    }
+}
+
+// Build the per-type event templates once per session, so firing only adds the changing headers
+static void voice_detector_event_templates_create(voice_detector_session_t *session_data)
+{
+    int type;
+
+    if (!(session_data->runtime_params.sink & VOICE_DETECTOR_SINK_EVENT)) {
+        return;
+    }
+
+    for (type = 0; type < VOICE_DETECTOR_EVENT_TYPES; type++) {
+        switch_event_t *event;
+
+        if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, voice_detector_event_subclasses[type]) != SWITCH_STATUS_SUCCESS) {
+            continue;
+        }
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", session_data->uuid);
+        session_data->event_templates[type] = event;
+    }
+}
+
+static void voice_detector_event_templates_destroy(voice_detector_session_t *session_data)
+{
+    int type;
+
+    for (type = 0; type < VOICE_DETECTOR_EVENT_TYPES; type++) {
+        if (session_data->event_templates[type]) {
+            switch_event_destroy(&session_data->event_templates[type]);
+        }
+    }
+}
+
+// Event sink: fire a CUSTOM voice_detector::* event on the core event bus, no HTTP involved
+static void voice_detector_fire_event(voice_detector_session_t *session_data, const char *leg, int type, int value)
+{
+    switch_event_t *event;
+
+    if (type < 0 || type >= VOICE_DETECTOR_EVENT_TYPES || !session_data->event_templates[type] ||
+        switch_event_dup(&event, session_data->event_templates[type]) != SWITCH_STATUS_SUCCESS) {
+        return;
+    }
+
+    // The leg varies per event with leg=both
+    switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Voice-Detector-Leg", leg);
+
+    switch (type) {
+    case VOICE_DETECTOR_EVENT_VOICE_START:
+    case VOICE_DETECTOR_EVENT_VOICE_END:
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Energy-Level", "%d", value);
+        break;
+    case VOICE_DETECTOR_EVENT_WORD_DETECTED:
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Word-Duration", "%d", value);
+        break;
+    case VOICE_DETECTOR_EVENT_RECORDING_STOP:
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Recording-Duration", "%d", value);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Recording-Encoded", "true");
+        // Fall through
+    case VOICE_DETECTOR_EVENT_RECORDING_START:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Recording-File", session_data->recording_file);
+        break;
+    case VOICE_DETECTOR_EVENT_DOUBLE_TALK:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Double-Talk", value ? "true" : "false");
+        break;
+    case VOICE_DETECTOR_EVENT_AMD:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "AMD-Result", voice_detector_amd_results[value]);
+        break;
+    case VOICE_DETECTOR_EVENT_BEEP:
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Beep-Frequency", "%d", value);
+        break;
+    case VOICE_DETECTOR_EVENT_ANALYSIS_COMPLETE:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Analysis-Reason", voice_detector_finished_reasons[value]);
+        break;
+    default:
+        break;
+    }
+
+    switch_event_fire(&event);
+}
+
+// API call function: queue the event for a dispatcher thread, never blocks
+static switch_status_t voice_detector_api_call(const char *uuid, int voice_detected, int energy_level, const char *leg, const char *recording_file,
+                                               int recording_encoded)
+{
+    voice_detector_event_t event;
+    voice_detector_dispatcher_t *dispatcher;
+    switch_size_t dropped;
+
+    if (!globals->api_url || !globals->dispatchers) {
+        return SWITCH_STATUS_SUCCESS; // No API URL configured
+    }
+
+    switch_copy_string(event.uuid, uuid, sizeof(event.uuid));
+    switch_copy_string(event.leg, leg ? leg : "a", sizeof(event.leg));
+    switch_copy_string(event.recording_file, recording_file ? recording_file : "", sizeof(event.recording_file));
+    event.recording_encoded = recording_encoded;
+    event.voice_detected = voice_detected;
+    event.energy_level = energy_level;
+    event.timestamp = switch_micro_time_now();
+
+    // Route by UUID so events of one call stay ordered on a single dispatcher
+    dispatcher = &globals->dispatchers[voice_detector_hash_uuid(uuid) % globals->dispatcher_threads];
+    if (!voice_detector_queue_push(dispatcher->queue, &event)) {
+        dropped = __atomic_add_fetch(&globals->events_dropped, 1, __ATOMIC_RELAXED);
+        if (dropped == 1 || dropped % 1000 == 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Event queue full, dropped %ld events so far\n", (long)dropped);
+        }
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Discard the webhook response body
+static size_t voice_detector_curl_discard(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    return size * nmemb;
+}
+
+// Share handle locking, one mutex per shared data kind
+static void voice_detector_curl_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    switch_mutex_lock(globals->curl_share_locks[data]);
+}
+
+static void voice_detector_curl_share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+    switch_mutex_unlock(globals->curl_share_locks[data]);
+}
+
+// Build the webhook headers once, they are reused by every request
+static void voice_detector_build_http_headers(void)
+{
+    if (globals->http_headers) {
+        switch_curl_slist_free_all(globals->http_headers);
+        globals->http_headers = NULL;
+    }
+
+    globals->http_headers = switch_curl_slist_append(globals->http_headers, "Content-Type: application/json");
+    if (globals->api_key) {
+        char auth_header[256];
+        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", globals->api_key);
+        globals->http_headers = switch_curl_slist_append(globals->http_headers, auth_header);
+    }
+}
+
+// Create the DNS/TLS session/connection cache shared by all dispatchers
+static void voice_detector_curl_share_create(void)
+{
+    int i;
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        switch_mutex_init(&globals->curl_share_locks[i], SWITCH_MUTEX_NESTED, globals->pool);
+    }
+
+    if (!(globals->curl_share = curl_share_init())) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Failed to create CURL share handle, connections will not be shared\n");
+        return;
+    }
+
+    curl_share_setopt(globals->curl_share, CURLSHOPT_LOCKFUNC, voice_detector_curl_share_lock);
+    curl_share_setopt(globals->curl_share, CURLSHOPT_UNLOCKFUNC, voice_detector_curl_share_unlock);
+    curl_share_setopt(globals->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(globals->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(globals->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+// Create a dispatcher's persistent easy handle, kept open for keep-alive reuse
+static switch_curl_handle_t *voice_detector_curl_handle_create(void)
+{
+    switch_curl_handle_t *curl = switch_curl_easy_init();
+
+    if (!curl) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to initialize CURL\n");
+        return NULL;
+    }
+
+    switch_curl_easy_setopt(curl, CURLOPT_URL, globals->api_url);
+    switch_curl_easy_setopt(curl, CURLOPT_HTTPHEADER, globals->http_headers);
+    switch_curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+    switch_curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    switch_curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    switch_curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, voice_detector_curl_discard);
+    if (globals->curl_share) {
+        switch_curl_easy_setopt(curl, CURLOPT_SHARE, globals->curl_share);
+    }
+
+    return curl;
+}
+
+// Append a JSON string literal, only the string fields need escaping
+static switch_size_t voice_detector_json_string(char *buf, switch_size_t pos, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p;
+
+    buf[pos++] = '"';
+    for (p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            buf[pos++] = '\\';
+            buf[pos++] = *p;
+        } else if (*p < 0x20) {
+            buf[pos++] = '\\';
+            buf[pos++] = 'u';
+            buf[pos++] = '0';
+            buf[pos++] = '0';
+            buf[pos++] = hex[*p >> 4];
+            buf[pos++] = hex[*p & 0xf];
+        } else {
+            buf[pos++] = *p;
+        }
+    }
+    buf[pos++] = '"';
+
+    return pos;
+}
+
+// Write one event object at buf + pos from the fixed schema, returns the new position.
+// The buffer must have VOICE_DETECTOR_EVENT_JSON_MAX bytes left.
+static switch_size_t voice_detector_event_serialize(char *buf, switch_size_t pos, const voice_detector_event_t *event)
+{
+    const char *event_type = NULL;
+    const char *extra_name = NULL;
+    const char *extra_string = NULL;
+    int extra_number = 0;
+
+    switch (event->voice_detected) {
+    case 0:
+        event_type = "voice_ended";
+        break;
+    case 1:
+        event_type = "voice_started";
+        break;
+    case 2:
+        event_type = "recording_started";
+        break;
+    case 3:
+        event_type = "recording_stopped";
+        extra_name = "recording_duration";  // energy_level contains duration in this case
+        extra_number = event->energy_level;
+        break;
+    case 4:
+        event_type = "word_detected";
+        extra_name = "word_duration";  // energy_level contains word duration in this case
+        extra_number = event->energy_level;
+        break;
+    case VOICE_DETECTOR_EVENT_DOUBLE_TALK:
+        event_type = event->energy_level ? "double_talk_started" : "double_talk_ended";
+        break;
+    case VOICE_DETECTOR_EVENT_AMD:
+        event_type = "amd";
+        extra_name = "amd_result";
+        extra_string = event->energy_level >= 0 && event->energy_level < VOICE_DETECTOR_AMD_RESULTS ? voice_detector_amd_results[event->energy_level] : "";
+        break;
+    case VOICE_DETECTOR_EVENT_BEEP:
+        event_type = "beep";
+        extra_name = "beep_frequency";
+        extra_number = event->energy_level;
+        break;
+    case VOICE_DETECTOR_EVENT_ANALYSIS_COMPLETE:
+        event_type = "analysis_complete";
+        extra_name = "reason";
+        extra_string = event->energy_level >= 0 && event->energy_level < VOICE_DETECTOR_FINISHED_REASONS ?
+                       voice_detector_finished_reasons[event->energy_level] : "";
+        break;
+    }
+
+    memcpy(buf + pos, "{\"uuid\":", 8);
+    pos = voice_detector_json_string(buf, pos + 8, event->uuid);
+    memcpy(buf + pos, ",\"leg\":", 7);
+    pos = voice_detector_json_string(buf, pos + 7, event->leg);
+    // Milliseconds since the epoch, 64-bit
+    pos += sprintf(buf + pos, ",\"voice_detected\":%d,\"energy_level\":%d,\"timestamp\":%lld",
+                   event->voice_detected, event->energy_level, (long long)(event->timestamp / 1000));
+
+    if (event_type) {
+        pos += sprintf(buf + pos, ",\"event_type\":\"%s\"", event_type);
+    }
+    if (extra_string) {
+        pos += sprintf(buf + pos, ",\"%s\":\"%s\"", extra_name, extra_string);
+    } else if (extra_name) {
+        pos += sprintf(buf + pos, ",\"%s\":%d", extra_name, extra_number);
+    }
+    if (event->voice_detected == 2 || event->voice_detected == 3) {
+        memcpy(buf + pos, ",\"recording_file\":", 18);
+        pos = voice_detector_json_string(buf, pos + 18, event->recording_file);
+    }
+    if (event->voice_detected == 3) {
+        pos += sprintf(buf + pos, ",\"recording_encoded\":%s", event->recording_encoded ? "true" : "false");
+    }
+    buf[pos++] = '}';
+
+    return pos;
+}
+
+static switch_status_t voice_detector_http_post(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count)
+{
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    char *post_data = dispatcher->json;
+    switch_size_t len = 0;
+    int i;
+
+    if (!dispatcher->curl && !(dispatcher->curl = voice_detector_curl_handle_create())) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    // Serialize into the dispatcher buffer, sized for a full batch
+    if (globals->batch_max_events > 1) {
+        post_data[len++] = '[';
+        for (i = 0; i < count; i++) {
+            if (i) {
+                post_data[len++] = ',';
+            }
+            len = voice_detector_event_serialize(post_data, len, &events[i]);
+        }
+        post_data[len++] = ']';
+    } else {
+        len = voice_detector_event_serialize(post_data, len, &events[0]);
+    }
+    post_data[len] = '\0';
+
+    // Perform request on the cached handle, the connection stays open between events
+    switch_curl_easy_setopt(dispatcher->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    switch_curl_easy_setopt(dispatcher->curl, CURLOPT_POSTFIELDS, post_data);
+    uint64_t started = voice_detector_metrics_now_ns();
+    CURLcode res = switch_curl_easy_perform(dispatcher->curl);
+    voice_detector_metrics_observe(globals->metrics, VOICE_DETECTOR_HISTOGRAM_WEBHOOK_US, (voice_detector_metrics_now_ns() - started) / 1000);
+    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_POSTS, 1);
+    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_EVENTS, count);
+    if (res != CURLE_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "CURL request failed: %s (%d events)\n", switch_curl_easy_strerror(res), count);
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_FAILURES, 1);
+        status = SWITCH_STATUS_FALSE;
+    } else {
+        long http_code = 0;
+        switch_curl_easy_getinfo(dispatcher->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code >= 400) {
+            voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_FAILURES, 1);
+        }
+        // Server errors are worth replaying from the spool, a rejected payload is not
+        if (http_code >= 500) {
+            status = SWITCH_STATUS_FALSE;
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "API call successful: HTTP %ld (%d events)\n", http_code, count);
+    }
+
+    return status;
+}
+
+// FNV-1a hash of a UUID string
+static uint32_t voice_detector_hash_uuid(const char *uuid)
+{
+    uint32_t hash = 2166136261u;
+
+    while (uuid && *uuid) {
+        hash ^= (uint8_t)*uuid++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Create a bounded MPMC queue (Vyukov), capacity is rounded up to a power of two
+static voice_detector_queue_t *voice_detector_queue_create(switch_memory_pool_t *pool, switch_size_t capacity, switch_size_t elem_size)
+{
+    voice_detector_queue_t *queue;
+    switch_size_t size = 2;
+    switch_size_t i;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue = switch_core_alloc(pool, sizeof(*queue));
+    queue->elem_size = elem_size;
+    queue->cell_size = (sizeof(switch_size_t) + elem_size + 15) & ~((switch_size_t)15);
+    queue->mask = size - 1;
+    queue->cells = switch_core_alloc(pool, queue->cell_size * size);
+
+    for (i = 0; i < size; i++) {
+        *(switch_size_t *)(queue->cells + i * queue->cell_size) = i;
+    }
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+
+    return queue;
+}
+
+// Push one element, returns SWITCH_FALSE when the queue is full
+static switch_bool_t voice_detector_queue_push(voice_detector_queue_t *queue, const void *elem)
+{
+    switch_size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    switch_size_t *seq;
+    intptr_t diff;
+
+    for (;;) {
+        seq = (switch_size_t *)(queue->cells + (pos & queue->mask) * queue->cell_size);
+        diff = (intptr_t)__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, SWITCH_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return SWITCH_FALSE;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(seq + 1, elem, queue->elem_size);
+    __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+
+    return SWITCH_TRUE;
+}
+
+// Pop one element, returns SWITCH_FALSE when the queue is empty
+static switch_bool_t voice_detector_queue_pop(voice_detector_queue_t *queue, void *elem)
+{
+    switch_size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    switch_size_t *seq;
+    intptr_t diff;
+
+    for (;;) {
+        seq = (switch_size_t *)(queue->cells + (pos & queue->mask) * queue->cell_size);
+        diff = (intptr_t)__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, SWITCH_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return SWITCH_FALSE;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(elem, seq + 1, queue->elem_size);
+    __atomic_store_n(seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+
+    return SWITCH_TRUE;
+}
+
+// Approximate number of queued elements
+static switch_size_t voice_detector_queue_depth(voice_detector_queue_t *queue)
+{
+    return __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED) - __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+}
+
+// Queue a recording operation for its writer, never waiting on the media thread. Audio is dropped
+// when the writer falls behind and leaves room for opens and closes. A close that still does not
+// fit goes on the writer's closing list, so a file is never left open.
+static switch_bool_t voice_detector_writer_push(voice_detector_recording_t *recording, int op, const int16_t *samples, uint32_t count)
+{
+    voice_detector_writer_t *writer = &globals->writers[recording->writer];
+    voice_detector_writer_item_t item;
+
+    item.recording = recording;
+    item.op = op;
+
+    if (op != VOICE_DETECTOR_WRITER_OP_WRITE) {
+        item.count = 0;
+        if (voice_detector_queue_push(writer->queue, &item)) {
+            return SWITCH_TRUE;
+        }
+        if (op != VOICE_DETECTOR_WRITER_OP_CLOSE) {
+            return SWITCH_FALSE;
+        }
+
+        // Closed once the writer has dequeued everything queued for the recording so far
+        recording->close_after = __atomic_load_n(&writer->queue->enqueue_pos, __ATOMIC_ACQUIRE);
+        recording->next_close = __atomic_load_n(&writer->closing, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&writer->closing, &recording->next_close, recording, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+        return SWITCH_TRUE;
+    }
+
+    while (count) {
+        item.count = count < VOICE_DETECTOR_WRITER_CHUNK_SAMPLES ? count : VOICE_DETECTOR_WRITER_CHUNK_SAMPLES;
+        memcpy(item.samples, samples, sizeof(int16_t) * item.count);
+
+        if (voice_detector_queue_depth(writer->queue) + VOICE_DETECTOR_WRITER_RESERVE > writer->queue->mask + 1 ||
+            !voice_detector_queue_push(writer->queue, &item)) {
+            switch_size_t dropped = __atomic_add_fetch(&globals->recording_chunks_dropped, 1, __ATOMIC_RELAXED);
+            if (dropped == 1 || dropped % 1000 == 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Recording writer %d queue full, %lu audio chunks dropped\n",
+                                  writer->index, (unsigned long)dropped);
+            }
+            return SWITCH_FALSE;
+        }
+
+        samples += item.count;
+        count -= item.count;
+    }
+
+    return SWITCH_TRUE;
+}
+
+// Copy a frame, or native G.711 payload, to the session's processing worker, dropped when its queue is full
+static void voice_detector_processor_push(voice_detector_session_t *session_data, int op, const void *data, int count, switch_bool_t write_stream,
+                                          int silent)
+{
+    voice_detector_processor_t *processor = session_data->processor;
+    voice_detector_batch_item_t item;
+    const char *samples = (const char *)data;
+    size_t sample_size = op == VOICE_DETECTOR_BATCH_OP_G711 ? 1 : sizeof(int16_t);
+
+    item.session = session_data;
+    item.op = op;
+    item.write_stream = write_stream;
+    item.silent = silent;
+
+    while (count > 0) {
+        item.count = count < VOICE_DETECTOR_BATCH_FRAME_SAMPLES ? (uint32_t)count : VOICE_DETECTOR_BATCH_FRAME_SAMPLES;
+        memcpy(item.samples, samples, sample_size * item.count);
+
+        // Keep room for the close, which must never be lost
+        if (voice_detector_queue_depth(processor->queue) + VOICE_DETECTOR_BATCH_RESERVE > processor->queue->mask + 1 ||
+            !voice_detector_queue_push(processor->queue, &item)) {
+            switch_size_t dropped = __atomic_add_fetch(&globals->frames_dropped, 1, __ATOMIC_RELAXED);
+            if (dropped == 1 || dropped % 1000 == 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Processing worker %d queue full, %lu frames dropped\n",
+                                  processor->index, (unsigned long)dropped);
+            }
+            return;
+        }
+
+        samples += sample_size * item.count;
+        count -= (int)item.count;
+    }
+}
+
+// Hand the session to its worker for cleanup, queued behind its remaining frames
+static void voice_detector_processor_close(voice_detector_session_t *session_data)
+{
+    voice_detector_processor_t *processor = session_data->processor;
+    voice_detector_batch_item_t item;
+
+    item.session = session_data;
+    item.op = VOICE_DETECTOR_BATCH_OP_CLOSE;
+    item.write_stream = 0;
+    item.count = 0;
+
+    if (voice_detector_queue_push(processor->queue, &item)) {
+        return;
+    }
+
+    // Reserve exhausted: never wait on the media thread. The session goes on the closing list and
+    // the worker cleans it up once it has dequeued every frame that was queued before this point.
+    session_data->close_after = __atomic_load_n(&processor->queue->enqueue_pos, __ATOMIC_ACQUIRE);
+    session_data->next_close = __atomic_load_n(&processor->closing, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&processor->closing, &session_data->next_close, session_data, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Clean up the closing list entries the worker got past, all = at exit, nothing is queued any more
+static void voice_detector_processor_reap(voice_detector_processor_t *processor, int all)
+{
+    voice_detector_session_t *session_data, *next, *pending = NULL;
+    switch_size_t done;
+
+    if (!__atomic_load_n(&processor->closing, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    session_data = __atomic_exchange_n(&processor->closing, NULL, __ATOMIC_ACQ_REL);
+    done = __atomic_load_n(&processor->queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    for (; session_data; session_data = next) {
+        next = session_data->next_close;
+        if (all || done >= session_data->close_after) {
+            voice_detector_session_cleanup(session_data);
+        } else {
+            session_data->next_close = pending;
+            pending = session_data;
+        }
+    }
+
+    // Not reached yet, back on the list for the next pass
+    for (; pending; pending = next) {
+        next = pending->next_close;
+        pending->next_close = __atomic_load_n(&processor->closing, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&processor->closing, &pending->next_close, pending, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// Processing worker: pulls frames of many sessions in one batch. Energies are computed first in
+// one pass over the batch (a struct-of-arrays of frame, length and energy), then each frame runs
+// through its session's state machine in queue order, so per-session order is kept.
+static void *SWITCH_THREAD_FUNC voice_detector_processor_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_processor_t *processor = (voice_detector_processor_t *)obj;
+    voice_detector_core_event_t events[VOICE_DETECTOR_CORE_MAX_EVENTS];
+    voice_detector_batch_item_t *item;
+    voice_detector_session_t *session_data;
+    voice_detector_core_t *core;
+    uint64_t started, elapsed;
+    int count, n, i;
+
+    if (globals->processing_affinity) {
+        switch_core_thread_set_cpu_affinity(processor->index % switch_core_cpu_count());
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Processing worker %d started\n", processor->index);
+
+    for (;;) {
+        for (n = 0; n < globals->processing_batch && voice_detector_queue_pop(processor->queue, &processor->batch[n]); n++) {
+        }
+
+        if (!n) {
+            if (!globals->processors_running) {
+                break;
+            }
+            voice_detector_processor_reap(processor, 0);
+            switch_yield(VOICE_DETECTOR_BATCH_IDLE_US);
+            continue;
+        }
+
+        started = voice_detector_metrics_now_ns();
+
+        // Pass 1: silence flags and frame energies, only sessions without a decimator analyse the frame as queued
+        for (i = 0; i < n; i++) {
+            item = &processor->batch[i];
+            if (item->op == VOICE_DETECTOR_BATCH_OP_CLOSE || item->session->core[item->write_stream].finished) {
+                continue;
+            }
+            if (item->op == VOICE_DETECTOR_BATCH_OP_G711) {
+                if (!item->silent) {
+                    processor->energies[i] = voice_detector_g711_sum_squares(item->session->g711[item->write_stream], (const uint8_t *)item->samples,
+                                                                             item->count);
+                }
+                continue;
+            }
+            if (item->session->g711[item->write_stream]) {
+                continue;
+            }
+            if (!item->silent && voice_detector_energy_is_zero(item->samples, item->count)) {
+                item->silent = 1;
+            }
+            if (!item->silent && !item->session->core[item->write_stream].decimator) {
+                processor->energies[i] = voice_detector_energy_sum_squares(item->samples, item->count);
+            }
+        }
+
+        // Pass 2: sinks and state machines
+        for (i = 0; i < n; i++) {
+            item = &processor->batch[i];
+            session_data = item->session;
+
+            if (item->op == VOICE_DETECTOR_BATCH_OP_CLOSE) {
+                voice_detector_session_cleanup(session_data);
+                continue;
+            }
+
+            if (!session_data->monitored[item->write_stream]) {
+                continue;
+            }
+
+            core = &session_data->core[item->write_stream];
+            if (item->op == VOICE_DETECTOR_BATCH_OP_G711) {
+                if (item->silent) {
+                    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_SILENT_FRAMES, 1);
+                    count = voice_detector_core_process_silence(core, (int)item->count, events);
+                    voice_detector_nn_feed(session_data, item->write_stream, NULL);
+                } else {
+                    count = voice_detector_g711_process(session_data, (const uint8_t *)item->samples, (int)item->count, item->write_stream,
+                                                        processor->energies[i], events);
+                }
+                voice_detector_handle_events(session_data, item->write_stream, events, count);
+                continue;
+            }
+
+            voice_detector_route_audio(session_data, item->samples, (int)item->count, item->write_stream);
+            if (session_data->g711[item->write_stream]) {
+                continue;
+            }
+            if (item->silent) {
+                voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_SILENT_FRAMES, 1);
+                count = voice_detector_core_process_silence(core, (int)item->count, events);
+            } else if (core->decimator) {
+                count = voice_detector_core_process_frame(core, item->samples, (int)item->count, events);
+            } else {
+                count = voice_detector_core_process_energy(core, item->samples, (int)item->count, processor->energies[i], events);
+            }
+            voice_detector_nn_feed(session_data, item->write_stream, item->silent ? NULL : item->samples);
+            voice_detector_handle_events(session_data, item->write_stream, events, count);
+        }
+
+        elapsed = (voice_detector_metrics_now_ns() - started) / (uint64_t)n;
+        for (i = 0; i < n; i++) {
+            voice_detector_metrics_observe(globals->metrics, VOICE_DETECTOR_HISTOGRAM_CALLBACK_NS, elapsed);
+        }
+
+        voice_detector_processor_reap(processor, 0);
+    }
+
+    voice_detector_processor_reap(processor, 1);
+
+    return NULL;
+}
+
+// Neural VAD channel for one direction at the analysis rate, NULL falls back to the energy gate
+static voice_detector_nn_channel_t *voice_detector_nn_channel_create(voice_detector_session_t *session_data, int rate)
+{
+    voice_detector_nn_worker_t *worker;
+    voice_detector_nn_channel_t *channel;
+    int window;
+
+    if (!globals->nn_workers) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "vad_mode=nn needs nn-model, session %s uses the energy detector\n",
+                          session_data->uuid);
+        return NULL;
+    }
+
+    // Both directions of a session go to the same worker, like its frames go to one processor
+    worker = &globals->nn_workers[voice_detector_hash_uuid(session_data->uuid) % globals->nn_threads];
+    if (!(window = voice_detector_nn_window(worker->model, rate))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "The %s model cannot run at %dHz (set analysis_rate=8000 or 16000), "
+                          "session %s uses the energy detector\n", globals->nn_backend, rate, session_data->uuid);
+        return NULL;
+    }
+    if (!(channel = voice_detector_arena_alloc(session_data, sizeof(voice_detector_nn_channel_t)))) {
+        return NULL;
+    }
+
+    channel->worker = worker;
+    channel->rate = rate;
+    channel->window = window;
+    channel->threshold = (int)(session_data->runtime_params.nn_threshold * 1000);
+    channel->release = (int)((session_data->runtime_params.nn_threshold - VOICE_DETECTOR_NN_HYSTERESIS) * 1000);
+
+    return channel;
+}
+
+// Append the frame the core just analysed to the direction's window, hand full windows to the
+// worker, and take the latest probability as the voicing of the next frame. The result lags by
+// at most one window plus the batching wait, about two 20 ms frames. pcm NULL = silence.
+static void voice_detector_nn_feed(voice_detector_session_t *session_data, int direction, const int16_t *pcm)
+{
+    voice_detector_nn_channel_t *channel = session_data->nn[direction];
+    voice_detector_core_t *core = &session_data->core[direction];
+    int samples, n, prob;
+
+    if (!channel || core->finished) {
+        return;
+    }
+
+    samples = core->last_frame_samples;
+    if (pcm && core->decimator) {
+        pcm = core->analysis_buffer;
+    }
+
+    while (samples > 0) {
+        n = channel->window - channel->fill < samples ? channel->window - channel->fill : samples;
+        if (pcm) {
+            memcpy(channel->samples + channel->fill, pcm, sizeof(int16_t) * n);
+            pcm += n;
+        } else {
+            memset(channel->samples + channel->fill, 0, sizeof(int16_t) * n);
+        }
+        channel->fill += n;
+        samples -= n;
+
+        if (channel->fill == channel->window) {
+            voice_detector_nn_submit(channel);
+            channel->fill = 0;
+        }
+    }
+
+    prob = __atomic_load_n(&channel->prob, __ATOMIC_ACQUIRE);
+    if (prob >= channel->threshold) {
+        channel->voiced = 1;
+    } else if (prob < channel->release) {
+        channel->voiced = 0;
+    }
+    core->external_voiced = channel->voiced;
+}
+
+// Queue a full window. A window still in flight means the worker is behind: this one is skipped
+// rather than queued, so latency stays bounded and the recurrent state is never used twice.
+static void voice_detector_nn_submit(voice_detector_nn_channel_t *channel)
+{
+    int i;
+
+    if (__atomic_load_n(&channel->inflight, __ATOMIC_ACQUIRE) || !__atomic_load_n(&globals->nn_running, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&globals->nn_windows_skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    for (i = 0; i < channel->window; i++) {
+        channel->input[i] = channel->samples[i] / 32768.0f;
+    }
+
+    __atomic_store_n(&channel->inflight, 1, __ATOMIC_RELEASE);
+    if (!voice_detector_queue_push(channel->worker->queue, &channel)) {
+        __atomic_store_n(&channel->inflight, 0, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&globals->nn_windows_skipped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Score a gathered batch. Windows of one rate form one tensor, usually there is a single rate.
+// Probabilities and state go back to the channels, their sessions pick them up on the next frame.
+static void voice_detector_nn_run(voice_detector_nn_worker_t *worker, int count)
+{
+    int state_size = voice_detector_nn_state_size(worker->model);
+    voice_detector_nn_channel_t *channel;
+    uint64_t started;
+    int i, j, n, rate, window, failed;
+
+    for (i = 0; i < count; i++) {
+        if (!worker->batch[i]) {
+            continue;
+        }
+        rate = worker->batch[i]->rate;
+        window = worker->batch[i]->window;
+
+        for (j = i, n = 0; j < count; j++) {
+            if (!(channel = worker->batch[j]) || channel->rate != rate) {
+                continue;
+            }
+            memcpy(worker->input + (size_t)n * window, channel->input, sizeof(float) * window);
+            memcpy(worker->state + (size_t)n * state_size, channel->state, sizeof(float) * state_size);
+            worker->members[n++] = channel;
+            worker->batch[j] = NULL;
+        }
+
+        started = voice_detector_metrics_now_ns();
+        failed = voice_detector_nn_infer(worker->model, rate, n, worker->input, worker->state, worker->probs);
+        voice_detector_metrics_observe(globals->metrics, VOICE_DETECTOR_HISTOGRAM_NN_BATCH_US, (voice_detector_metrics_now_ns() - started) / 1000);
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_NN_BATCHES, 1);
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_NN_WINDOWS, n);
+        if (failed) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Neural VAD worker %d: inference failed for %d windows\n", worker->index, n);
+        }
+
+        for (j = 0; j < n; j++) {
+            channel = worker->members[j];
+            if (!failed) {
+                memcpy(channel->state, worker->state + (size_t)j * state_size, sizeof(float) * state_size);
+                __atomic_store_n(&channel->prob, (int)(worker->probs[j] * 1000 + 0.5f), __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(&channel->inflight, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// Inference worker: waits at most nn-max-wait-ms after the first window for the batch to fill
+static void *SWITCH_THREAD_FUNC voice_detector_nn_worker_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_nn_worker_t *worker = (voice_detector_nn_worker_t *)obj;
+    voice_detector_nn_channel_t *channel;
+    switch_time_t deadline, now;
+    int count;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Neural VAD worker %d started\n", worker->index);
+
+    for (;;) {
+        if (!voice_detector_queue_pop(worker->queue, &worker->batch[0])) {
+            if (!globals->nn_running) {
+                break;
+            }
+            switch_yield(VOICE_DETECTOR_NN_IDLE_US);
+            continue;
+        }
+        count = 1;
+
+        deadline = switch_micro_time_now() + (switch_time_t)globals->nn_max_wait_ms * 1000;
+        while (count < globals->nn_batch) {
+            if (voice_detector_queue_pop(worker->queue, &worker->batch[count])) {
+                count++;
+                continue;
+            }
+            now = switch_micro_time_now();
+            if (!globals->nn_running || now >= deadline) {
+                break;
+            }
+            switch_yield(deadline - now < 500 ? (int)(deadline - now) : 500);
+        }
+
+        voice_detector_nn_run(worker, count);
+    }
+
+    // Nothing is scored any more, release what is still queued so its sessions can be cleaned up
+    while (voice_detector_queue_pop(worker->queue, &channel)) {
+        __atomic_store_n(&channel->inflight, 0, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+// Load one model per worker and start them, nothing to do without nn-model
+static switch_status_t voice_detector_nn_workers_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    char error[256] = "";
+    int i;
+
+    if (!globals->nn_model) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    globals->nn_workers = switch_core_alloc(globals->pool, sizeof(voice_detector_nn_worker_t) * globals->nn_threads);
+    globals->nn_running = 1;
+
+    for (i = 0; i < globals->nn_threads; i++) {
+        voice_detector_nn_worker_t *worker = &globals->nn_workers[i];
+
+        if (!(worker->model = voice_detector_nn_load(globals->nn_backend, globals->nn_model, globals->nn_batch, error, sizeof(error)))) {
+            // The module still loads, vad_mode=nn sessions fall back to the energy detector
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot load %s model %s: %s\n", globals->nn_backend, globals->nn_model, error);
+            voice_detector_nn_workers_stop();
+            return SWITCH_STATUS_SUCCESS;
+        }
+        worker->index = i;
+        worker->queue = voice_detector_queue_create(globals->pool, globals->nn_queue_size, sizeof(voice_detector_nn_channel_t *));
+        worker->batch = switch_core_alloc(globals->pool, sizeof(voice_detector_nn_channel_t *) * globals->nn_batch);
+        worker->members = switch_core_alloc(globals->pool, sizeof(voice_detector_nn_channel_t *) * globals->nn_batch);
+        worker->input = switch_core_alloc(globals->pool, sizeof(float) * VOICE_DETECTOR_NN_MAX_WINDOW * globals->nn_batch);
+        worker->state = switch_core_alloc(globals->pool, sizeof(float) * VOICE_DETECTOR_NN_MAX_STATE * globals->nn_batch);
+        worker->probs = switch_core_alloc(globals->pool, sizeof(float) * globals->nn_batch);
+
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&worker->thread, thd_attr, voice_detector_nn_worker_thread, worker, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start neural VAD worker %d\n", i);
+            worker->thread = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d neural VAD workers (%s backend, batch: %d windows / %dms)\n",
+                      globals->nn_threads, globals->nn_backend, globals->nn_batch, globals->nn_max_wait_ms);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void voice_detector_nn_workers_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->nn_running = 0;
+
+    if (!globals->nn_workers) {
+        return;
+    }
+
+    for (i = 0; i < globals->nn_threads; i++) {
+        if (globals->nn_workers[i].thread) {
+            switch_thread_join(&st, globals->nn_workers[i].thread);
+            globals->nn_workers[i].thread = NULL;
+        }
+        voice_detector_nn_destroy(globals->nn_workers[i].model);
+        globals->nn_workers[i].model = NULL;
+    }
+    globals->nn_workers = NULL;
+}
+
+// Start the processing workers, batched mode only
+static switch_status_t voice_detector_processors_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    int i;
+
+    if (!globals->processing_threads) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    globals->processors = switch_core_alloc(globals->pool, sizeof(voice_detector_processor_t) * globals->processing_threads);
+    globals->processors_running = 1;
+
+    for (i = 0; i < globals->processing_threads; i++) {
+        voice_detector_processor_t *processor = &globals->processors[i];
+
+        processor->index = i;
+        processor->queue = voice_detector_queue_create(globals->pool, globals->processing_queue_size, sizeof(voice_detector_batch_item_t));
+        processor->batch = switch_core_alloc(globals->pool, sizeof(voice_detector_batch_item_t) * globals->processing_batch);
+        processor->energies = switch_core_alloc(globals->pool, sizeof(uint64_t) * globals->processing_batch);
+
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&processor->thread, thd_attr, voice_detector_processor_thread, processor, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start processing worker %d\n", i);
+            processor->thread = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d processing workers (queue size: %d, batch: %d%s)\n",
+                      globals->processing_threads, globals->processing_queue_size, globals->processing_batch,
+                      globals->processing_affinity ? ", pinned" : "");
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Stop the processing workers once their queues are drained
+static void voice_detector_processors_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->processors_running = 0;
+
+    if (!globals->processors) {
+        return;
+    }
+
+    for (i = 0; i < globals->processing_threads; i++) {
+        if (globals->processors[i].thread) {
+            switch_thread_join(&st, globals->processors[i].thread);
+            globals->processors[i].thread = NULL;
+        }
+    }
+}
+
+// Write the gathered samples to the file in one call
+static void voice_detector_writer_flush(voice_detector_recording_t *recording)
+{
+    switch_size_t len = recording->buffered;
+
+    if (recording->is_open && len && recording->raw) {
+        if (fwrite(recording->buffer, sizeof(int16_t), len, recording->raw) != len) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Recording write failed: %s\n", recording->raw_path);
+        } else {
+            voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_RECORDING_BYTES, len * sizeof(int16_t));
+        }
+    } else if (recording->is_open && len) {
+        if (switch_core_file_write(&recording->fh, recording->buffer, &len) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Recording write failed: %s\n", recording->path);
+        } else {
+            voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_RECORDING_BYTES, len * sizeof(int16_t));
+        }
+    }
+    recording->buffered = 0;
+}
+
+// Writer thread: owns recording files, gathers queued audio into large writes
+static void *SWITCH_THREAD_FUNC voice_detector_writer_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_writer_t *writer = (voice_detector_writer_t *)obj;
+    voice_detector_writer_item_t item;
+    voice_detector_recording_t *recording;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Recording writer %d started\n", writer->index);
+
+    for (;;) {
+        if (!voice_detector_queue_pop(writer->queue, &item)) {
+            if (!globals->writers_running) {
+                break;
+            }
+            voice_detector_writer_reap(writer, 0);
+            switch_yield(VOICE_DETECTOR_WRITER_IDLE_US);
+            continue;
+        }
+        recording = item.recording;
+
+        switch (item.op) {
+        case VOICE_DETECTOR_WRITER_OP_OPEN:
+            recording->buffer = malloc(sizeof(int16_t) * VOICE_DETECTOR_WRITER_BUFFER_SAMPLES);
+            if (!recording->buffer) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to open recording: %s\n", recording->path);
+            } else if (recording->encode) {
+                // Raw capture through a large stdio buffer, no codec on this thread
+                if ((recording->raw = fopen(recording->raw_path, "wb"))) {
+                    if ((recording->raw_buffer = malloc(VOICE_DETECTOR_ENCODER_RAW_BUFFER))) {
+                        setvbuf(recording->raw, recording->raw_buffer, _IOFBF, VOICE_DETECTOR_ENCODER_RAW_BUFFER);
+                    }
+                    recording->is_open = 1;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to open raw capture: %s\n", recording->raw_path);
+                }
+            } else if (switch_core_file_open(&recording->fh, recording->path, 1, recording->rate,
+                                             SWITCH_FILE_FLAG_WRITE | SWITCH_FILE_DATA_SHORT, NULL) == SWITCH_STATUS_SUCCESS) {
+                recording->is_open = 1;
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to open recording: %s\n", recording->path);
+            }
+            break;
+        case VOICE_DETECTOR_WRITER_OP_WRITE:
+            if (!recording->is_open) {
+                break;
+            }
+            if (recording->buffered + item.count > VOICE_DETECTOR_WRITER_BUFFER_SAMPLES) {
+                voice_detector_writer_flush(recording);
+            }
+            memcpy(recording->buffer + recording->buffered, item.samples, sizeof(int16_t) * item.count);
+            recording->buffered += item.count;
+            break;
+        case VOICE_DETECTOR_WRITER_OP_CLOSE:
+            voice_detector_writer_close(recording);
+            break;
+        default:
+            break;
+        }
+
+        voice_detector_writer_reap(writer, 0);
+    }
+
+    voice_detector_writer_reap(writer, 1);
+
+    return NULL;
+}
+
+// Flush and close a recording on its writer thread, compressed formats go on to the encoders
+static void voice_detector_writer_close(voice_detector_recording_t *recording)
+{
+    voice_detector_writer_flush(recording);
+    switch_safe_free(recording->buffer);
+    if (recording->encode) {
+        if (recording->raw) {
+            fclose(recording->raw);
+            recording->raw = NULL;
+        }
+        switch_safe_free(recording->raw_buffer);
+        // A full encoder queue slows this writer down instead of losing the recording
+        if (!voice_detector_queue_push(globals->encoder_queue, &recording)) {
+            voice_detector_encode(recording);
+        }
+        return;
+    }
+    if (recording->is_open) {
+        switch_core_file_close(&recording->fh);
+    }
+    free(recording);
+}
+
+// Close the closing list entries the writer got past, all = at exit, nothing is queued any more
+static void voice_detector_writer_reap(voice_detector_writer_t *writer, int all)
+{
+    voice_detector_recording_t *recording, *next, *pending = NULL;
+    switch_size_t done;
+
+    if (!__atomic_load_n(&writer->closing, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    recording = __atomic_exchange_n(&writer->closing, NULL, __ATOMIC_ACQ_REL);
+    done = __atomic_load_n(&writer->queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    for (; recording; recording = next) {
+        next = recording->next_close;
+        if (all || done >= recording->close_after) {
+            voice_detector_writer_close(recording);
+        } else {
+            recording->next_close = pending;
+            pending = recording;
+        }
+    }
+
+    // Not reached yet, back on the list for the next pass
+    for (; pending; pending = next) {
+        next = pending->next_close;
+        pending->next_close = __atomic_load_n(&writer->closing, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&writer->closing, &pending->next_close, pending, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// Start the recording writer pool
+static switch_status_t voice_detector_writers_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    int i;
+
+    globals->writers = switch_core_alloc(globals->pool, sizeof(voice_detector_writer_t) * globals->writer_threads);
+    globals->writers_running = 1;
+
+    for (i = 0; i < globals->writer_threads; i++) {
+        voice_detector_writer_t *writer = &globals->writers[i];
+
+        writer->index = i;
+        writer->queue = voice_detector_queue_create(globals->pool, globals->writer_queue_size, sizeof(voice_detector_writer_item_t));
+
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&writer->thread, thd_attr, voice_detector_writer_thread, writer, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start recording writer %d\n", i);
+            writer->thread = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d recording writers (queue size: %d)\n",
+                      globals->writer_threads, globals->writer_queue_size);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Encode a closed raw capture into its target file, then report the stop the session left to us.
+// Frees the recording.
+static void voice_detector_encode(voice_detector_recording_t *recording)
+{
+    int16_t *samples = malloc(sizeof(int16_t) * VOICE_DETECTOR_ENCODER_CHUNK_SAMPLES);
+    switch_size_t len;
+    FILE *raw = NULL;
+    int encoded = 0;
+
+    if (recording->is_open && (raw = fopen(recording->raw_path, "rb")) && samples &&
+        switch_core_file_open(&recording->fh, recording->path, 1, recording->rate,
+                              SWITCH_FILE_FLAG_WRITE | SWITCH_FILE_DATA_SHORT, NULL) == SWITCH_STATUS_SUCCESS) {
+        encoded = 1;
+        while ((len = fread(samples, sizeof(int16_t), VOICE_DETECTOR_ENCODER_CHUNK_SAMPLES, raw)) > 0) {
+            if (switch_core_file_write(&recording->fh, samples, &len) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Recording encode failed: %s\n", recording->path);
+                encoded = 0;
+                break;
+            }
+        }
+        switch_core_file_close(&recording->fh);
+        // A half-written file is not the recording, the raw capture below is
+        if (!encoded) {
+            remove(recording->path);
+        }
+    } else if (recording->is_open) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to encode recording: %s\n", recording->path);
+    }
+
+    if (raw) {
+        fclose(raw);
+    }
+    // The raw capture is kept when encoding failed, so the audio can still be recovered
+    if (encoded) {
+        remove(recording->raw_path);
+    }
+    switch_safe_free(samples);
+
+    // No file to report: the capture never opened, or its raw file is gone
+    if (!raw) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Recording of %s lost, no stop event sent: %s\n", recording->uuid, recording->raw_path);
+        free(recording);
+        return;
+    }
+
+    if (recording->sink & VOICE_DETECTOR_SINK_EVENT) {
+        switch_event_t *event;
+
+        if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, VOICE_DETECTOR_EVENT_SUBCLASS_RECORDING_STOP) == SWITCH_STATUS_SUCCESS) {
+            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", recording->uuid);
+            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Voice-Detector-Leg", recording->leg);
+            switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Recording-Duration", "%d", (int)recording->duration);
+            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Recording-File", encoded ? recording->path : recording->raw_path);
+            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Recording-Encoded", encoded ? "true" : "false");
+            switch_event_fire(&event);
+        }
+    }
+    if (recording->sink & VOICE_DETECTOR_SINK_HTTP) {
+        voice_detector_api_call(recording->uuid, VOICE_DETECTOR_EVENT_RECORDING_STOP, (int)recording->duration, recording->leg,
+                                encoded ? recording->path : recording->raw_path, encoded);
+    }
+
+    free(recording);
+}
+
+// Encoder thread: any thread takes the next closed recording, encodes are independent
+static void *SWITCH_THREAD_FUNC voice_detector_encoder_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_recording_t *recording;
+
+    for (;;) {
+        if (!voice_detector_queue_pop(globals->encoder_queue, &recording)) {
+            if (!globals->encoders_running) {
+                break;
+            }
+            switch_yield(VOICE_DETECTOR_ENCODER_IDLE_US);
+            continue;
+        }
+        voice_detector_encode(recording);
+    }
+
+    return NULL;
+}
+
+// Start the encoder pool ahead of the writers that feed it, MP3/OGG offload only
+static switch_status_t voice_detector_encoders_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    int i;
+
+    if (!globals->encoder_threads) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    globals->encoder_queue = voice_detector_queue_create(globals->pool, globals->encoder_queue_size, sizeof(voice_detector_recording_t *));
+    globals->encoders = switch_core_alloc(globals->pool, sizeof(switch_thread_t *) * globals->encoder_threads);
+    globals->encoders_running = 1;
+
+    for (i = 0; i < globals->encoder_threads; i++) {
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&globals->encoders[i], thd_attr, voice_detector_encoder_thread, NULL, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start recording encoder %d\n", i);
+            globals->encoders[i] = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d recording encoders (queue size: %d)\n",
+                      globals->encoder_threads, globals->encoder_queue_size);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Stop the encoder pool once every queued recording is encoded, after the writers have stopped
+static void voice_detector_encoders_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->encoders_running = 0;
+
+    if (!globals->encoders) {
+        return;
+    }
+
+    for (i = 0; i < globals->encoder_threads; i++) {
+        if (globals->encoders[i]) {
+            switch_thread_join(&st, globals->encoders[i]);
+            globals->encoders[i] = NULL;
+        }
+    }
+}
+
+// Stop the recording writer pool, queued audio is written and files closed first
+static void voice_detector_writers_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->writers_running = 0;
+
+    if (!globals->writers) {
+        return;
+    }
+
+    for (i = 0; i < globals->writer_threads; i++) {
+        if (globals->writers[i].thread) {
+            switch_thread_join(&st, globals->writers[i].thread);
+            globals->writers[i].thread = NULL;
+        }
+    }
+}
+
+// Ask libcurl once whether it was built with WebSocket support, curl_ws_* fail at run time otherwise
+static void voice_detector_stream_support(void)
+{
+#ifdef VOICE_DETECTOR_WITH_WEBSOCKET
+    curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+    const char *const *protocol;
+
+    for (protocol = info ? info->protocols : NULL; protocol && *protocol; protocol++) {
+        if (!strcasecmp(*protocol, "ws")) {
+            globals->stream_ws = 1;
+        } else if (!strcasecmp(*protocol, "wss")) {
+            globals->stream_wss = 1;
+        }
+    }
+    if (!globals->stream_ws) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "libcurl %s has no WebSocket support, stream_url is disabled\n",
+                          info ? info->version : "(unknown)");
+    }
+#else
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Built against libcurl without the WebSocket API, stream_url is disabled\n");
+#endif
+}
+
+// Whether url can be streamed to, wss:// also needs a TLS-enabled libcurl
+static int voice_detector_stream_supported(const char *url)
+{
+    return !strncasecmp(url, "wss://", 6) ? globals->stream_wss : globals->stream_ws;
+}
+
+// Create the session's ASR stream, the network thread connects it for the rest of the call
+static void voice_detector_stream_open(voice_detector_session_t *session_data)
+{
+    voice_detector_stream_t *stream;
+
+    if (!*session_data->runtime_params.stream_url || session_data->stream) {
+        return;
+    }
+
+    if (!(stream = calloc(1, sizeof(*stream)))) {
+        return;
+    }
+    switch_copy_string(stream->url, session_data->runtime_params.stream_url, sizeof(stream->url));
+    switch_copy_string(stream->uuid, session_data->uuid, sizeof(stream->uuid));
+    switch_copy_string(stream->leg, session_data->runtime_params.leg, sizeof(stream->leg));
+    stream->rate = session_data->stream_rate;
+    stream->streamer = voice_detector_hash_uuid(session_data->uuid) % globals->stream_threads;
+
+    if (!voice_detector_stream_push(stream, VOICE_DETECTOR_STREAM_OP_OPEN, NULL, 0)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to open ASR stream for %s, network queue full\n", session_data->uuid);
+        free(stream);
+        return;
+    }
+
+    session_data->stream = stream;
+    session_data->stream_gate_open = 0;
+}
+
+// Hand the stream back to its network thread for teardown, pending audio is sent first
+static void voice_detector_stream_close(voice_detector_session_t *session_data)
+{
+    if (!session_data->stream) {
+        return;
+    }
+
+    // Never fails: a full queue puts the stream on its network thread's closing list instead
+    voice_detector_stream_push(session_data->stream, VOICE_DETECTOR_STREAM_OP_CLOSE, NULL, 0);
+    session_data->stream = NULL;
+    session_data->stream_gate_open = 0;
+}
+
+// Queue a stream operation for its network thread, same policy as the recording writers: never
+// waits, audio is dropped first and a close that does not fit goes on the closing list.
+static switch_bool_t voice_detector_stream_push(voice_detector_stream_t *stream, int op, const int16_t *samples, uint32_t count)
+{
+    voice_detector_streamer_t *streamer = &globals->streamers[stream->streamer];
+    voice_detector_stream_item_t item;
+
+    item.stream = stream;
+    item.op = op;
+
+    if (op != VOICE_DETECTOR_STREAM_OP_AUDIO) {
+        item.count = 0;
+        if (voice_detector_queue_push(streamer->queue, &item)) {
+            return SWITCH_TRUE;
+        }
+        if (op != VOICE_DETECTOR_STREAM_OP_CLOSE) {
+            return SWITCH_FALSE;
+        }
+
+        // Torn down once the thread has dequeued everything queued for the stream so far
+        stream->close_after = __atomic_load_n(&streamer->queue->enqueue_pos, __ATOMIC_ACQUIRE);
+        stream->next_close = __atomic_load_n(&streamer->closing, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&streamer->closing, &stream->next_close, stream, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+        return SWITCH_TRUE;
+    }
+
+    while (count) {
+        item.count = count < VOICE_DETECTOR_WRITER_CHUNK_SAMPLES ? count : VOICE_DETECTOR_WRITER_CHUNK_SAMPLES;
+        memcpy(item.samples, samples, sizeof(int16_t) * item.count);
+
+        if (voice_detector_queue_depth(streamer->queue) + VOICE_DETECTOR_WRITER_RESERVE > streamer->queue->mask + 1 ||
+            !voice_detector_queue_push(streamer->queue, &item)) {
+            switch_size_t dropped = __atomic_add_fetch(&globals->stream_chunks_dropped, 1, __ATOMIC_RELAXED);
+            if (dropped == 1 || dropped % 1000 == 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "ASR network thread %d queue full, %lu audio chunks dropped\n",
+                                  streamer->index, (unsigned long)dropped);
+            }
+            return SWITCH_FALSE;
+        }
+
+        samples += item.count;
+        count -= item.count;
+    }
+
+    return SWITCH_TRUE;
+}
+
+// WebSocket handshake, blocking on the network thread for at most the connect timeout
+static void voice_detector_stream_connect(voice_detector_stream_t *stream)
+{
+    CURLcode res;
+
+    if (!(stream->curl = switch_curl_easy_init())) {
+        stream->retry_at = switch_micro_time_now() + VOICE_DETECTOR_STREAM_RETRY_US;
+        return;
+    }
+
+    switch_curl_easy_setopt(stream->curl, CURLOPT_URL, stream->url);
+    switch_curl_easy_setopt(stream->curl, CURLOPT_CONNECT_ONLY, 2L);  // WebSocket upgrade, then hand the socket to curl_ws_*
+    switch_curl_easy_setopt(stream->curl, CURLOPT_CONNECTTIMEOUT_MS, (long)VOICE_DETECTOR_STREAM_CONNECT_TIMEOUT_MS);
+    switch_curl_easy_setopt(stream->curl, CURLOPT_NOSIGNAL, 1L);
+
+    if ((res = switch_curl_easy_perform(stream->curl)) != CURLE_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "ASR stream connect to %s failed for %s: %s\n",
+                          stream->url, stream->uuid, switch_curl_easy_strerror(res));
+        switch_curl_easy_cleanup(stream->curl);
+        stream->curl = NULL;
+        stream->retry_at = switch_micro_time_now() + VOICE_DETECTOR_STREAM_RETRY_US;
+        return;
+    }
+
+    stream->connected = 1;
+    stream->received = 0;
+    stream->recv_overflow = 0;
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "ASR stream connected to %s for %s\n", stream->url, stream->uuid);
+}
+
+static void voice_detector_stream_disconnect(voice_detector_stream_t *stream)
+{
+    if (stream->curl) {
+#ifdef VOICE_DETECTOR_WITH_WEBSOCKET
+        size_t sent;
+
+        if (stream->connected) {
+            curl_ws_send(stream->curl, "", 0, &sent, 0, CURLWS_CLOSE);
+        }
+#endif
+        switch_curl_easy_cleanup(stream->curl);
+        stream->curl = NULL;
+    }
+    stream->connected = 0;
+}
+
+#ifdef VOICE_DETECTOR_WITH_WEBSOCKET
+// Send the buffered 16 kHz audio as one binary message
+static void voice_detector_stream_send(voice_detector_stream_t *stream)
+{
+    const char *data = (const char *)stream->send_buffer;
+    size_t len = sizeof(int16_t) * stream->buffered;
+    size_t offset = 0, sent;
+    int tries = 0;
+    CURLcode res;
+
+    stream->buffered = 0;
+
+    if (!stream->connected && switch_micro_time_now() >= stream->retry_at) {
+        voice_detector_stream_connect(stream);
+    }
+    if (!stream->connected || !len) {
+        return;
+    }
+
+    // One frame of len bytes, announced by the first call. A partial send continues the same
+    // frame from where it stopped, so the server never gets a short frame followed by a new one.
+    while (offset < len) {
+        sent = 0;
+        res = curl_ws_send(stream->curl, data + offset, len - offset, &sent, offset ? 0 : (curl_off_t)len, CURLWS_BINARY | CURLWS_OFFSET);
+        offset += sent;
+        if (res != CURLE_OK && res != CURLE_AGAIN) {
+            break;
+        }
+        if (offset < len) {
+            if (++tries >= 50) {
+                res = CURLE_AGAIN;
+                break;
+            }
+            switch_yield(1000);
+        }
+    }
+    if (offset == len) {
+        return;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "ASR stream send failed for %s: %s\n", stream->uuid, switch_curl_easy_strerror(res));
+    // Part of the frame is on the wire: no close frame behind it, dropping the connection drops the frame
+    if (offset) {
+        stream->connected = 0;
+    }
+    voice_detector_stream_disconnect(stream);
+    stream->retry_at = switch_micro_time_now() + VOICE_DETECTOR_STREAM_RETRY_US;
+}
+#else
+// Without the WebSocket API stream_open is never reached, nothing is buffered for long
+static void voice_detector_stream_send(voice_detector_stream_t *stream)
+{
+    stream->buffered = 0;
+}
+#endif
+
+// Resample to the server rate and send once a full message is buffered
+static void voice_detector_stream_audio(voice_detector_stream_t *stream, const int16_t *samples, uint32_t count)
+{
+    const int16_t *out = samples;
+    uint32_t out_count = count;
+
+    if (stream->rate != VOICE_DETECTOR_STREAM_RATE) {
+        if (!stream->resampler &&
+            switch_resample_create(&stream->resampler, stream->rate, VOICE_DETECTOR_STREAM_RATE,
+                                   VOICE_DETECTOR_WRITER_CHUNK_SAMPLES * 2, SWITCH_RESAMPLE_QUALITY, 1) != SWITCH_STATUS_SUCCESS) {
+            stream->resampler = NULL;
+            return;
+        }
+        switch_resample_process(stream->resampler, (int16_t *)samples, count);
+        out = stream->resampler->to;
+        out_count = stream->resampler->to_len;
+    }
+
+    if (out_count > VOICE_DETECTOR_STREAM_BUFFER_SAMPLES - stream->buffered) {
+        out_count = VOICE_DETECTOR_STREAM_BUFFER_SAMPLES - stream->buffered;
+    }
+    memcpy(stream->send_buffer + stream->buffered, out, sizeof(int16_t) * out_count);
+    stream->buffered += out_count;
+
+    if (stream->buffered >= VOICE_DETECTOR_STREAM_SEND_SAMPLES) {
+        voice_detector_stream_send(stream);
+    }
+}
+
+// Raise a transcript from the server as a CUSTOM voice_detector::transcript event
+static void voice_detector_stream_result(voice_detector_stream_t *stream, const char *message)
+{
+    cJSON *json = cJSON_Parse(message);
+    const char *text = NULL;
+    switch_bool_t final = SWITCH_FALSE;
+    switch_event_t *event;
+    cJSON *item;
+
+    if (!json) {
+        return;
+    }
+
+    if ((item = cJSON_GetObjectItem(json, "text")) && item->valuestring) {
+        text = item->valuestring;
+        final = SWITCH_TRUE;
+    } else if ((item = cJSON_GetObjectItem(json, "partial")) && item->valuestring) {
+        text = item->valuestring;
+    }
+
+    if (!zstr(text) && switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, VOICE_DETECTOR_EVENT_TRANSCRIPT) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", stream->uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Voice-Detector-Leg", stream->leg);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Transcript-Final", final ? "true" : "false");
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Transcript", text);
+        switch_event_fire(&event);
+    }
+
+    cJSON_Delete(json);
+}
+
+// Drain whatever the server has sent, never blocks
+static void voice_detector_stream_receive(voice_detector_stream_t *stream)
+{
+#ifdef VOICE_DETECTOR_WITH_WEBSOCKET
+    const struct curl_ws_frame *meta;
+    size_t nread;
+    CURLcode res;
+
+    while (stream->connected) {
+        nread = 0;
+        res = curl_ws_recv(stream->curl, stream->recv_buffer + stream->received,
+                           sizeof(stream->recv_buffer) - 1 - stream->received, &nread, &meta);
+        if (res == CURLE_AGAIN) {
+            return;
+        }
+        if (res != CURLE_OK || (meta && (meta->flags & CURLWS_CLOSE))) {
+            voice_detector_stream_disconnect(stream);
+            stream->retry_at = switch_micro_time_now() + VOICE_DETECTOR_STREAM_RETRY_US;
+            return;
+        }
+        if (!meta || !(meta->flags & CURLWS_TEXT)) {
+            continue;
+        }
+
+        stream->received += nread;
+        if (meta->bytesleft > 0 || (meta->flags & CURLWS_CONT)) {
+            // Message continues, drop it if it cannot fit
+            if (stream->received >= sizeof(stream->recv_buffer) - 1) {
+                stream->recv_overflow = 1;
+                stream->received = 0;
+            }
+            continue;
+        }
+
+        if (!stream->recv_overflow) {
+            stream->recv_buffer[stream->received] = '\0';
+            voice_detector_stream_result(stream, stream->recv_buffer);
+        }
+        stream->received = 0;
+        stream->recv_overflow = 0;
+    }
+#else
+    (void)stream;
+#endif
+}
+
+// Network thread: applies queued stream operations and polls its open streams for transcripts
+static void *SWITCH_THREAD_FUNC voice_detector_streamer_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_streamer_t *streamer = (voice_detector_streamer_t *)obj;
+    voice_detector_stream_item_t item;
+    voice_detector_stream_t *stream;
+    int handled;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "ASR network thread %d started\n", streamer->index);
+
+    for (;;) {
+        for (handled = 0; handled < 256 && voice_detector_queue_pop(streamer->queue, &item); handled++) {
+            stream = item.stream;
+
+            switch (item.op) {
+            case VOICE_DETECTOR_STREAM_OP_OPEN:
+                stream->next = streamer->streams;
+                streamer->streams = stream;
+                voice_detector_stream_connect(stream);
+                break;
+            case VOICE_DETECTOR_STREAM_OP_AUDIO:
+                voice_detector_stream_audio(stream, item.samples, item.count);
+                break;
+            case VOICE_DETECTOR_STREAM_OP_FLUSH:
+                voice_detector_stream_send(stream);
+                break;
+            case VOICE_DETECTOR_STREAM_OP_CLOSE:
+                voice_detector_stream_teardown(streamer, stream);
+                break;
+            default:
+                break;
+            }
+        }
+
+        voice_detector_streamer_reap(streamer, 0);
+
+        for (stream = streamer->streams; stream; stream = stream->next) {
+            voice_detector_stream_receive(stream);
+        }
+
+        if (!handled) {
+            if (!globals->streamers_running) {
+                break;
+            }
+            switch_yield(VOICE_DETECTOR_STREAM_IDLE_US);
+        }
+    }
+
+    // Sessions still open at shutdown lose their streams here
+    voice_detector_streamer_reap(streamer, 1);
+    while ((stream = streamer->streams)) {
+        streamer->streams = stream->next;
+        voice_detector_stream_disconnect(stream);
+        if (stream->resampler) {
+            switch_resample_destroy(&stream->resampler);
+        }
+        free(stream);
+    }
+
+    return NULL;
+}
+
+// Send what is pending, close the WebSocket and free a stream its session let go of
+static void voice_detector_stream_teardown(voice_detector_streamer_t *streamer, voice_detector_stream_t *stream)
+{
+    voice_detector_stream_t **link;
+
+    voice_detector_stream_send(stream);
+    voice_detector_stream_receive(stream);
+    voice_detector_stream_disconnect(stream);
+    for (link = &streamer->streams; *link; link = &(*link)->next) {
+        if (*link == stream) {
+            *link = stream->next;
+            break;
+        }
+    }
+    if (stream->resampler) {
+        switch_resample_destroy(&stream->resampler);
+    }
+    free(stream);
+}
+
+// Tear down the closing list entries the thread got past, all = at exit, nothing is queued any more
+static void voice_detector_streamer_reap(voice_detector_streamer_t *streamer, int all)
+{
+    voice_detector_stream_t *stream, *next, *pending = NULL;
+    switch_size_t done;
+
+    if (!__atomic_load_n(&streamer->closing, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    stream = __atomic_exchange_n(&streamer->closing, NULL, __ATOMIC_ACQ_REL);
+    done = __atomic_load_n(&streamer->queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    for (; stream; stream = next) {
+        next = stream->next_close;
+        if (all || done >= stream->close_after) {
+            voice_detector_stream_teardown(streamer, stream);
+        } else {
+            stream->next_close = pending;
+            pending = stream;
+        }
+    }
+
+    // Not reached yet, back on the list for the next pass
+    for (; pending; pending = next) {
+        next = pending->next_close;
+        pending->next_close = __atomic_load_n(&streamer->closing, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&streamer->closing, &pending->next_close, pending, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// Start the ASR network threads
+static switch_status_t voice_detector_streamers_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    int i;
+
+    globals->streamers = switch_core_alloc(globals->pool, sizeof(voice_detector_streamer_t) * globals->stream_threads);
+    globals->streamers_running = 1;
+
+    for (i = 0; i < globals->stream_threads; i++) {
+        voice_detector_streamer_t *streamer = &globals->streamers[i];
+
+        streamer->index = i;
+        streamer->queue = voice_detector_queue_create(globals->pool, globals->stream_queue_size, sizeof(voice_detector_stream_item_t));
+
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&streamer->thread, thd_attr, voice_detector_streamer_thread, streamer, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start ASR network thread %d\n", i);
+            streamer->thread = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d ASR network threads (queue size: %d)\n",
+                      globals->stream_threads, globals->stream_queue_size);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Stop the ASR network threads once their queues are drained
+static void voice_detector_streamers_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->streamers_running = 0;
+
+    if (!globals->streamers) {
+        return;
+    }
+
+    for (i = 0; i < globals->stream_threads; i++) {
+        if (globals->streamers[i].thread) {
+            switch_thread_join(&st, globals->streamers[i].thread);
+            globals->streamers[i].thread = NULL;
+        }
+    }
+}
+
+// Dispatcher thread: drain the queue and deliver events over HTTP
+static void *SWITCH_THREAD_FUNC voice_detector_dispatcher_thread(switch_thread_t *thread, void *obj)
+{
+    voice_detector_dispatcher_t *dispatcher = (voice_detector_dispatcher_t *)obj;
+    voice_detector_event_t *batch = dispatcher->batch;
+    switch_time_t deadline, now;
+    int discarded = 0;
+    int count;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Webhook dispatcher %d started\n", dispatcher->index);
+
+    for (;;) {
+        if (globals->running) {
+            voice_detector_dispatcher_replay(dispatcher);
+        }
+
+        if (!voice_detector_queue_pop(dispatcher->queue, &batch[0])) {
+            if (!globals->running) {
+                break;
+            }
+            switch_yield(VOICE_DETECTOR_DISPATCHER_IDLE_US);
+            continue;
+        }
+        count = 1;
+
+        // Batch mode: gather more events until the batch is full or the oldest one has waited long enough
+        if (globals->batch_max_events > 1) {
+            deadline = batch[0].timestamp + (switch_time_t)globals->batch_max_latency_ms * 1000;
+            while (count < globals->batch_max_events) {
+                if (voice_detector_queue_pop(dispatcher->queue, &batch[count])) {
+                    count++;
+                    continue;
+                }
+                now = switch_micro_time_now();
+                if (!globals->running || now >= deadline) {
+                    break;
+                }
+                switch_yield(deadline - now < 1000 ? (int)(deadline - now) : 1000);
+            }
+        }
+
+        if (globals->running) {
+            voice_detector_dispatcher_deliver(dispatcher, batch, count);
+        } else if (dispatcher->spool.header) {
+            // Shutting down, keep what is left for the next load instead of waiting on the endpoint
+            voice_detector_dispatcher_spool(dispatcher, batch, count);
+        } else if (discarded || voice_detector_http_post(dispatcher, batch, count) != SWITCH_STATUS_SUCCESS) {
+            // Shutting down with an unreachable endpoint, do not wait on every remaining event
+            discarded += count;
+        }
+    }
+
+    if (discarded) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Webhook dispatcher %d discarded %d events on shutdown\n", dispatcher->index, discarded);
+    }
+    if (voice_detector_spool_depth(&dispatcher->spool)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Webhook dispatcher %d left %u events in its spool for the next load\n",
+                          dispatcher->index, voice_detector_spool_depth(&dispatcher->spool));
+    }
+
+    if (dispatcher->curl) {
+        switch_curl_easy_cleanup(dispatcher->curl);
+        dispatcher->curl = NULL;
+    }
+
+    return NULL;
+}
+
+// What a full spool may give up: word and double-talk churn only. Voice, recording, AMD, beep and
+// analysis events are never evicted, only refused once nothing else is left.
+static int voice_detector_event_priority(const voice_detector_event_t *event)
+{
+    switch (event->voice_detected) {
+    case VOICE_DETECTOR_EVENT_WORD_DETECTED:
+    case VOICE_DETECTOR_EVENT_DOUBLE_TALK:
+        return 0;
+    default:
+        return VOICE_DETECTOR_SPOOL_KEEP_PRIORITY;
+    }
+}
+
+static int voice_detector_event_evictable(const void *record, void *arg)
+{
+    return voice_detector_event_priority((const voice_detector_event_t *)record) <= *(int *)arg;
+}
+
+// Journal events the endpoint did not take yet, called by the dispatcher thread only. A full
+// spool makes room by evicting its oldest low-value events, a chunk at a time so the compaction
+// is not paid per event.
+static void voice_detector_dispatcher_spool(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count)
+{
+    uint32_t stored = voice_detector_spool_append(&dispatcher->spool, events, count);
+    uint32_t evicted = 0, removed, chunk;
+    int priority;
+
+    for (priority = 0; stored < (uint32_t)count && priority < VOICE_DETECTOR_SPOOL_KEEP_PRIORITY; priority++) {
+        chunk = dispatcher->spool.capacity / VOICE_DETECTOR_SPOOL_EVICT_DIV;
+        if (chunk < count - stored) {
+            chunk = count - stored;
+        }
+        if ((removed = voice_detector_spool_evict(&dispatcher->spool, voice_detector_event_evictable, &priority, chunk))) {
+            evicted += removed;
+            stored += voice_detector_spool_append(&dispatcher->spool, events + stored, count - stored);
+        }
+    }
+
+    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOLED, stored);
+    voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_DROPPED, evicted + (count - stored));
+
+    // Logged once per level until the spool drains: 1 = evicting old events, 2 = refusing new ones
+    priority = stored < (uint32_t)count ? 2 : evicted ? 1 : 0;
+    if (priority > dispatcher->spool_full) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Webhook spool of dispatcher %d is full (%d events), dropping %s\n",
+                          dispatcher->index, globals->spool_max_events, priority == 2 ? "new events" : "the oldest word and double-talk events");
+        dispatcher->spool_full = priority;
+    }
+    voice_detector_spool_sync(&dispatcher->spool);
+}
+
+// Exponential backoff between replay attempts while the endpoint keeps failing
+static void voice_detector_dispatcher_backoff(voice_detector_dispatcher_t *dispatcher)
+{
+    if (!dispatcher->backoff_ms) {
+        dispatcher->backoff_ms = globals->spool_retry_min_ms;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Webhook endpoint failing, dispatcher %d spools events\n", dispatcher->index);
+    } else if ((dispatcher->backoff_ms *= 2) > globals->spool_retry_max_ms) {
+        dispatcher->backoff_ms = globals->spool_retry_max_ms;
+    }
+    dispatcher->retry_at = switch_micro_time_now() + (switch_time_t)dispatcher->backoff_ms * 1000;
+}
+
+// Post a fresh batch, or spool it. Once anything is spooled newer events go behind it, which
+// keeps the order per UUID since a UUID always routes to the same dispatcher. A queue filling
+// up faster than the endpoint answers spills too, the media threads must never see it full.
+static void voice_detector_dispatcher_deliver(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count)
+{
+    if (!dispatcher->spool.header) {
+        voice_detector_http_post(dispatcher, events, count);
+        return;
+    }
+
+    if (voice_detector_spool_depth(&dispatcher->spool) || voice_detector_queue_depth(dispatcher->queue) > (dispatcher->queue->mask + 1) / 2) {
+        voice_detector_dispatcher_spool(dispatcher, events, count);
+    } else if (voice_detector_http_post(dispatcher, events, count) != SWITCH_STATUS_SUCCESS) {
+        voice_detector_dispatcher_spool(dispatcher, events, count);
+        voice_detector_dispatcher_backoff(dispatcher);
+    }
+}
+
+// Whether a record read back from the spool is an event this module could have written. A
+// crash during compaction can leave one damaged, its type and value index the name tables.
+static int voice_detector_event_valid(voice_detector_event_t *event)
+{
+    // The serializer relies on terminated strings
+    event->uuid[sizeof(event->uuid) - 1] = '\0';
+    event->leg[sizeof(event->leg) - 1] = '\0';
+    event->recording_file[sizeof(event->recording_file) - 1] = '\0';
+
+    if (event->voice_detected < 0 || event->voice_detected >= VOICE_DETECTOR_EVENT_TYPES || event->energy_level < 0) {
+        return 0;
+    }
+    switch (event->voice_detected) {
+    case VOICE_DETECTOR_EVENT_AMD:
+        return event->energy_level < VOICE_DETECTOR_AMD_RESULTS;
+    case VOICE_DETECTOR_EVENT_ANALYSIS_COMPLETE:
+        return event->energy_level < VOICE_DETECTOR_FINISHED_REASONS;
+    case VOICE_DETECTOR_EVENT_DOUBLE_TALK:
+        return event->energy_level <= 1;
+    default:
+        return 1;
+    }
+}
+
+// Send the oldest spooled batch once the backoff has passed, records are only consumed once delivered
+static void voice_detector_dispatcher_replay(voice_detector_dispatcher_t *dispatcher)
+{
+    uint32_t count, valid, i;
+
+    if (!voice_detector_spool_depth(&dispatcher->spool) || switch_micro_time_now() < dispatcher->retry_at) {
+        return;
+    }
+    // Drain a backed up queue into the spool first
+    if (voice_detector_queue_depth(dispatcher->queue) > (dispatcher->queue->mask + 1) / 2) {
+        return;
+    }
+
+    count = voice_detector_spool_peek(&dispatcher->spool, dispatcher->batch, globals->batch_max_events);
+    // Damaged records are discarded with the batch they were read in, the rest keep their order
+    for (i = 0, valid = 0; i < count; i++) {
+        if (!voice_detector_event_valid(&dispatcher->batch[i])) {
+            continue;
+        }
+        if (valid != i) {
+            dispatcher->batch[valid] = dispatcher->batch[i];
+        }
+        valid++;
+    }
+    if (valid < count) {
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_INVALID, count - valid);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Webhook spool of dispatcher %d: discarded %u damaged records\n",
+                          dispatcher->index, count - valid);
+    }
+    if (valid && voice_detector_http_post(dispatcher, dispatcher->batch, valid) != SWITCH_STATUS_SUCCESS) {
+        voice_detector_dispatcher_backoff(dispatcher);
+        return;
+    }
+
+    voice_detector_spool_consume(&dispatcher->spool, count);
+    dispatcher->spool_full = 0;
+    if (dispatcher->backoff_ms) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Webhook endpoint recovered, dispatcher %d replays %u spooled events\n",
+                          dispatcher->index, voice_detector_spool_depth(&dispatcher->spool));
+        dispatcher->backoff_ms = 0;
+    }
+    if (!voice_detector_spool_depth(&dispatcher->spool)) {
+        voice_detector_spool_sync(&dispatcher->spool);
+    }
+}
+
+// Start the webhook dispatcher pool
+static switch_status_t voice_detector_dispatchers_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    int i;
+
+    globals->dispatchers = switch_core_alloc(globals->pool, sizeof(voice_detector_dispatcher_t) * globals->dispatcher_threads);
+    globals->running = 1;
+
+    voice_detector_curl_share_create();
+
+    for (i = 0; i < globals->dispatcher_threads; i++) {
+        voice_detector_dispatcher_t *dispatcher = &globals->dispatchers[i];
+
+        dispatcher->index = i;
+        dispatcher->queue = voice_detector_queue_create(globals->pool, globals->event_queue_size, sizeof(voice_detector_event_t));
+        dispatcher->batch = switch_core_alloc(globals->pool, sizeof(voice_detector_event_t) * globals->batch_max_events);
+        dispatcher->json = switch_core_alloc(globals->pool, VOICE_DETECTOR_EVENT_JSON_MAX * globals->batch_max_events + 3);
+
+        if (globals->spool_max_events > 0) {
+            char *path = switch_core_sprintf(globals->pool, "%s%svoice_detector_spool_%d.dat", globals->spool_dir, SWITCH_PATH_SEPARATOR, i);
+            int pending;
+
+            switch_dir_make_recursive(globals->spool_dir, SWITCH_DEFAULT_DIR_PERMS, globals->pool);
+            pending = voice_detector_spool_open(&dispatcher->spool, path, sizeof(voice_detector_event_t), globals->spool_max_events);
+            if (pending < 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Cannot map webhook spool %s, dispatcher %d runs without one\n", path, i);
+            } else if (pending > 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Webhook dispatcher %d replays %d spooled events from %s\n", i, pending, path);
+            }
+        }
+
+        switch_threadattr_create(&thd_attr, globals->pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&dispatcher->thread, thd_attr, voice_detector_dispatcher_thread, dispatcher, globals->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to start webhook dispatcher %d\n", i);
+            dispatcher->thread = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Started %d webhook dispatchers (queue size: %d, batch: %d events / %dms)\n",
+                      globals->dispatcher_threads, globals->event_queue_size, globals->batch_max_events, globals->batch_max_latency_ms);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Stop the webhook dispatcher pool, queued events are flushed first
+static void voice_detector_dispatchers_stop(void)
+{
+    switch_status_t st;
+    int i;
+
+    globals->running = 0;
+
+    if (!globals->dispatchers) {
+        return;
+    }
+
+    for (i = 0; i < globals->dispatcher_threads; i++) {
+        if (globals->dispatchers[i].thread) {
+            switch_thread_join(&st, globals->dispatchers[i].thread);
+            globals->dispatchers[i].thread = NULL;
+        }
+        voice_detector_spool_close(&globals->dispatchers[i].spool);
+    }
+
+    if (globals->curl_share) {
+        curl_share_cleanup(globals->curl_share);
+        globals->curl_share = NULL;
+    }
+}
+
+// Registry shard owning a UUID
+static voice_detector_registry_shard_t *voice_detector_registry_shard(const char *uuid)
+{
+    return &globals->registry[voice_detector_hash_uuid(uuid) % VOICE_DETECTOR_REGISTRY_SHARDS];
+}
+
+// Create the session registry shards
+static void voice_detector_registry_init(switch_memory_pool_t *pool)
+{
+    int i;
+
+    for (i = 0; i < VOICE_DETECTOR_REGISTRY_SHARDS; i++) {
+        switch_mutex_init(&globals->registry[i].mutex, SWITCH_MUTEX_NESTED, pool);
+        switch_core_hash_init(&globals->registry[i].sessions);
+    }
+}
 
-    if (!uuid) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No UUID found for channel\n");
-        return SWITCH_STATUS_FALSE;
+static void voice_detector_registry_destroy(void)
+{
+    int i;
+
+    for (i = 0; i < VOICE_DETECTOR_REGISTRY_SHARDS; i++) {
+        if (globals->registry[i].sessions) {
+            switch_core_hash_destroy(&globals->registry[i].sessions);
+        }
     }
+}
 
-    // Check if already monitoring this session
-    switch_mutex_lock(globals->mutex);
-    if (switch_core_hash_find(globals->sessions, uuid)) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Voice detection already active for session %s\n", uuid);
-        switch_mutex_unlock(globals->mutex);
+static switch_bool_t voice_detector_registry_contains(const char *uuid)
+{
+    voice_detector_registry_shard_t *shard = voice_detector_registry_shard(uuid);
+    switch_bool_t found;
+
+    switch_mutex_lock(shard->mutex);
+    found = switch_core_hash_find(shard->sessions, uuid) ? SWITCH_TRUE : SWITCH_FALSE;
+    switch_mutex_unlock(shard->mutex);
+
+    return found;
+}
+
+// Insert a session, fails if its UUID is already registered
+static switch_bool_t voice_detector_registry_insert(voice_detector_session_t *session_data)
+{
+    voice_detector_registry_shard_t *shard = voice_detector_registry_shard(session_data->uuid);
+    switch_bool_t inserted = SWITCH_FALSE;
+
+    switch_mutex_lock(shard->mutex);
+    if (!switch_core_hash_find(shard->sessions, session_data->uuid)) {
+        switch_core_hash_insert(shard->sessions, session_data->uuid, session_data);
+        inserted = SWITCH_TRUE;
+    }
+    switch_mutex_unlock(shard->mutex);
+
+    return inserted;
+}
+
+// Remove a session, only if the registered entry is this session
+static void voice_detector_registry_remove(voice_detector_session_t *session_data)
+{
+    voice_detector_registry_shard_t *shard;
+
+    if (!*session_data->uuid) {
+        return;
+    }
+
+    shard = voice_detector_registry_shard(session_data->uuid);
+    switch_mutex_lock(shard->mutex);
+    if (switch_core_hash_find(shard->sessions, session_data->uuid) == session_data) {
+        switch_core_hash_delete(shard->sessions, session_data->uuid);
+    }
+    switch_mutex_unlock(shard->mutex);
+}
+
+// Copy the status of every session in a shard into a growable buffer, returns the count
+static int voice_detector_registry_snapshot(voice_detector_registry_shard_t *shard, voice_detector_status_t **snapshot, int *snapshot_size)
+{
+    switch_hash_index_t *hi;
+    void *val;
+    int count = 0;
+
+    switch_mutex_lock(shard->mutex);
+    for (hi = switch_core_hash_first(shard->sessions); hi; hi = switch_core_hash_next(&hi)) {
+        voice_detector_session_t *session_data;
+        voice_detector_status_t *status;
+        int direction;
+
+        switch_core_hash_this(hi, NULL, NULL, &val);
+        if (!(session_data = (voice_detector_session_t *)val)) {
+            continue;
+        }
+
+        if (count == *snapshot_size) {
+            int size = *snapshot_size ? *snapshot_size * 2 : 64;
+            voice_detector_status_t *grown = realloc(*snapshot, sizeof(voice_detector_status_t) * size);
+            if (!grown) {
+                // Keep iterating so the hash iterator runs to completion and is released
+                continue;
+            }
+            *snapshot = grown;
+            *snapshot_size = size;
+        }
+
+        status = &(*snapshot)[count++];
+        switch_copy_string(status->uuid, session_data->uuid, sizeof(status->uuid));
+        switch_copy_string(status->leg, session_data->runtime_params.leg, sizeof(status->leg));
+        status->stream_rate = session_data->stream_rate;
+        status->sample_rate = session_data->core[session_data->record_write_stream].config.sample_rate;
+        status->voice_detected = 0;
+        status->is_recording = session_data->is_recording;
+        status->total_frames = 0;
+        status->voice_starts = 0;
+        status->false_starts = 0;
+        // Unmonitored directions stay zeroed, so summing both covers every leg setting
+        for (direction = 0; direction < VOICE_DETECTOR_DIRECTIONS; direction++) {
+            voice_detector_core_t *core = &session_data->core[direction];
+
+            status->voice_detected |= core->voice_detected;
+            status->total_frames += (int)__atomic_load_n(&core->total_frames, __ATOMIC_RELAXED);
+            status->voice_starts += __atomic_load_n(&core->voice_starts, __ATOMIC_RELAXED);
+            status->false_starts += __atomic_load_n(&core->false_starts, __ATOMIC_RELAXED);
+        }
+        status->energy_threshold = session_data->runtime_params.energy_threshold;
+        status->max_silence = session_data->runtime_params.max_silence;
+    }
+    switch_mutex_unlock(shard->mutex);
+
+    return count;
+}
+
+// Take a session from the slab, refilling it a chunk at a time from the module pool.
+// Returned sessions are zeroed and hold no arena block until their parameters are applied.
+static voice_detector_session_t *voice_detector_session_alloc(void)
+{
+    voice_detector_session_t *session_data;
+
+    switch_mutex_lock(globals->slab.mutex);
+    if (!globals->slab.free_list) {
+        voice_detector_session_t *chunk = switch_core_alloc(globals->pool, sizeof(voice_detector_session_t) * VOICE_DETECTOR_SLAB_CHUNK);
+        int i;
+
+        if (!chunk) {
+            switch_mutex_unlock(globals->slab.mutex);
+            return NULL;
+        }
+        for (i = 0; i < VOICE_DETECTOR_SLAB_CHUNK; i++) {
+            chunk[i].next_free = globals->slab.free_list;
+            globals->slab.free_list = &chunk[i];
+        }
+        globals->slab.allocated += VOICE_DETECTOR_SLAB_CHUNK;
+    }
+    session_data = globals->slab.free_list;
+    globals->slab.free_list = session_data->next_free;
+    globals->slab.in_use++;
+    switch_mutex_unlock(globals->slab.mutex);
+
+    memset(session_data, 0, sizeof(*session_data));
+    session_data->arena_class = -1;
+
+    return session_data;
+}
+
+// Return a session to the slab, its arena block goes back to its size class
+static void voice_detector_session_release(voice_detector_session_t *session_data)
+{
+    switch_mutex_lock(globals->slab.mutex);
+    if (session_data->arena) {
+        *(char **)session_data->arena = globals->slab.arena_free[session_data->arena_class];
+        globals->slab.arena_free[session_data->arena_class] = session_data->arena;
+        session_data->arena = NULL;
+    }
+    session_data->next_free = globals->slab.free_list;
+    globals->slab.free_list = session_data;
+    globals->slab.in_use--;
+    switch_mutex_unlock(globals->slab.mutex);
+}
+
+// Arena bytes the optional state enabled by params takes, mirroring the allocations made when
+// they are applied. Each allocation is counted with its worst-case alignment padding.
+static switch_size_t voice_detector_arena_need(voice_detector_session_t *session_data, const voice_detector_runtime_params_t *params)
+{
+    switch_size_t need = 0, direction_need = 0;
+    int directions = 0;
+
+    if ((params->auto_record || *params->stream_url) && params->preroll_ms > 0) {
+        uint32_t capacity = voice_detector_ring_ceil_pow2((uint32_t)((int64_t)params->preroll_ms * session_data->stream_rate / 1000));
+
+        if (capacity > VOICE_DETECTOR_PREROLL_MAX_SAMPLES) {
+            capacity = VOICE_DETECTOR_PREROLL_MAX_SAMPLES;
+        }
+        need += VOICE_DETECTOR_ARENA_SLOT(sizeof(int16_t) * capacity);
+    }
+
+    if (params->analysis_rate > 0 && params->analysis_rate < session_data->stream_rate) {
+        direction_need += VOICE_DETECTOR_ARENA_SLOT(sizeof(voice_detector_decimator_t)) +
+                          VOICE_DETECTOR_ARENA_SLOT(sizeof(int16_t) * (VOICE_DETECTOR_DECIMATOR_MAX_INPUT / 2 + 1));
+    }
+    if (params->vad_mode == VOICE_DETECTOR_VAD_MODE_SPECTRAL) {
+        direction_need += VOICE_DETECTOR_ARENA_SLOT(sizeof(voice_detector_spectral_t));
+    }
+    if (params->amd) {
+        direction_need += VOICE_DETECTOR_ARENA_SLOT(sizeof(voice_detector_tone_t));
+    }
+    if (params->vad_mode == VOICE_DETECTOR_VAD_MODE_NN && globals->nn_workers) {
+        direction_need += VOICE_DETECTOR_ARENA_SLOT(sizeof(voice_detector_nn_channel_t));
+    }
+
+    directions = (strcasecmp(params->leg, "b") != 0) + (strcasecmp(params->leg, "a") != 0);
+
+    return need + directions * direction_need;
+}
+
+// Attach a block of the smallest size class holding size bytes, refilling the class from the
+// module pool. A session that needs nothing gets no block; on failure the arena stays empty and
+// the optional stages are skipped by arena_alloc.
+static void voice_detector_arena_reserve(voice_detector_session_t *session_data, switch_size_t size)
+{
+    int class = 0;
+    char *block;
+
+    if (!size) {
+        return;
+    }
+    while (class < VOICE_DETECTOR_ARENA_CLASSES && ((switch_size_t)VOICE_DETECTOR_ARENA_CLASS_MIN << class) < size) {
+        class++;
+    }
+    if (class == VOICE_DETECTOR_ARENA_CLASSES) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Session %s needs a %lu byte arena, above the largest class\n",
+                          session_data->uuid, (unsigned long)size);
+        return;
+    }
+
+    switch_mutex_lock(globals->slab.mutex);
+    if ((block = globals->slab.arena_free[class])) {
+        globals->slab.arena_free[class] = *(char **)block;
+    } else if ((block = switch_core_alloc(globals->pool, ((switch_size_t)VOICE_DETECTOR_ARENA_CLASS_MIN << class) + VOICE_DETECTOR_ARENA_ALIGN))) {
+        // Pool memory is only pointer-aligned, the arena hands out ARENA_ALIGN-aligned slots
+        block = (char *)(((uintptr_t)block + VOICE_DETECTOR_ARENA_ALIGN - 1) & ~(uintptr_t)(VOICE_DETECTOR_ARENA_ALIGN - 1));
+        globals->slab.arena_allocated[class]++;
+    }
+    switch_mutex_unlock(globals->slab.mutex);
+
+    if (!block) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to allocate the session arena for %s\n", session_data->uuid);
+        return;
+    }
+    session_data->arena = block;
+    session_data->arena_class = class;
+    session_data->arena_size = (switch_size_t)VOICE_DETECTOR_ARENA_CLASS_MIN << class;
+    session_data->arena_used = 0;
+}
+
+// Bump-allocate zeroed memory from the session arena, NULL when it is exhausted
+static void *voice_detector_arena_alloc(voice_detector_session_t *session_data, switch_size_t size)
+{
+    switch_size_t offset = (session_data->arena_used + VOICE_DETECTOR_ARENA_ALIGN - 1) & ~(switch_size_t)(VOICE_DETECTOR_ARENA_ALIGN - 1);
+    void *ptr;
+
+    if (!session_data->arena || offset + size > session_data->arena_size) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Session arena exhausted for %s\n", session_data->uuid);
+        return NULL;
+    }
+
+    ptr = session_data->arena + offset;
+    session_data->arena_used = offset + size;
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+// Session cleanup function
+static switch_status_t voice_detector_session_cleanup(voice_detector_session_t *session_data)
+{
+    int direction;
+
+    if (!session_data) {
         return SWITCH_STATUS_SUCCESS;
     }
-    switch_mutex_unlock(globals->mutex);
+
+    // Stop recording if active
+    if (session_data->is_recording) {
+        voice_detector_stop_recording(session_data);
+    }
+
+    // Release the ASR stream, its network thread sends what is left and disconnects
+    voice_detector_stream_close(session_data);
+
+    voice_detector_event_templates_destroy(session_data);
+
+    // A window in flight still points into the arena, wait until the worker let go of it. The
+    // worker finishes a batch it started even while stopping; a window queued after its exit
+    // drain is released here, nothing else would pop it.
+    for (direction = 0; direction < VOICE_DETECTOR_DIRECTIONS; direction++) {
+        voice_detector_nn_channel_t *channel = session_data->nn[direction], *queued;
+
+        while (channel && __atomic_load_n(&channel->inflight, __ATOMIC_ACQUIRE)) {
+            if (!__atomic_load_n(&globals->nn_running, __ATOMIC_ACQUIRE)) {
+                while (voice_detector_queue_pop(channel->worker->queue, &queued)) {
+                    __atomic_store_n(&queued->inflight, 0, __ATOMIC_RELEASE);
+                }
+            }
+            switch_yield(1000);
+        }
+    }
+
+    // The media bug is not removed here: cleanup runs from its CLOSE callback, or before it was attached
+    session_data->bug = NULL;
+
+    // Drop from the registry so status and lookups no longer see it
+    voice_detector_registry_remove(session_data);
+
+    // Return the session and its arena to the slab
+    voice_detector_session_release(session_data);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Application function
+static switch_status_t voice_detector_app_function(switch_core_session_t *session, const char *data)
+{
+    voice_detector_runtime_params_t runtime_params;
+    switch_status_t status;
 
     // Parse runtime parameters
     status = voice_detector_parse_runtime_params(data, &runtime_params);
@@ -670,32 +3876,81 @@ static switch_status_t voice_detector_app_function(switch_core_session_t *sessio
         return status;
     }
 
+    // Running the app twice on a channel is harmless, the first start keeps going
+    status = voice_detector_start_session(session, &runtime_params);
+
+    return status == SWITCH_STATUS_INUSE ? SWITCH_STATUS_SUCCESS : status;
+}
+
+// Session budget and core idle CPU, checked once per session start
+static switch_bool_t voice_detector_overloaded(void)
+{
+    if (globals->overload_sessions && __atomic_load_n(&globals->slab.in_use, __ATOMIC_RELAXED) >= globals->overload_sessions) {
+        return SWITCH_TRUE;
+    }
+
+    return globals->overload_idle_cpu > 0 && switch_core_idle_cpu() < globals->overload_idle_cpu;
+}
+
+// Cheap configuration for sessions started under overload: energy VAD at 8 kHz and a short
+// analysis window. Running sessions keep their settings, so load is shed without degrading them.
+static void voice_detector_degrade_params(voice_detector_runtime_params_t *params)
+{
+    params->vad_mode = VOICE_DETECTOR_VAD_MODE_ENERGY;
+    if (!params->analysis_rate || params->analysis_rate > DEFAULT_SAMPLE_RATE) {
+        params->analysis_rate = DEFAULT_SAMPLE_RATE;
+    }
+    if (!params->total_analysis_time || params->total_analysis_time > globals->overload_analysis_time) {
+        params->total_analysis_time = globals->overload_analysis_time;
+    }
+}
+
+// Attach a detector to a session with parsed parameters, shared by the app and the start API
+static switch_status_t voice_detector_start_session(switch_core_session_t *session, const voice_detector_runtime_params_t *params)
+{
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    const char *uuid = switch_channel_get_uuid(channel);
+    voice_detector_session_t *session_data = NULL;
+    voice_detector_runtime_params_t degraded;
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+    if (!uuid) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No UUID found for channel\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    // Check if already monitoring this session, callers tell this apart from a started one
+    if (voice_detector_registry_contains(uuid)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Voice detection already active for session %s\n", uuid);
+        return SWITCH_STATUS_INUSE;
+    }
+
+    if (voice_detector_overloaded()) {
+        memcpy(&degraded, params, sizeof(degraded));
+        voice_detector_degrade_params(&degraded);
+        params = &degraded;
+        voice_detector_metrics_add(globals->metrics, VOICE_DETECTOR_METRIC_DEGRADED_SESSIONS, 1);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Overloaded, starting session %s with energy VAD and a %dms window\n",
+                          uuid, params->total_analysis_time);
+    }
+
     // Create session data
-    switch_core_new_memory_pool(&session_data->pool);
+    if (!(session_data = voice_detector_session_alloc())) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to allocate session data for %s\n", uuid);
+        return SWITCH_STATUS_MEMERR;
+    }
     session_data->session = session;
-    session_data->uuid = switch_core_strdup(session_data->pool, uuid);
-    session_data->voice_detected = 0;
-    session_data->silence_frames = 0;
-    session_data->total_frames = 0;
-    session_data->last_voice_time = 0;
-    session_data->last_api_call_time = 0;
-    session_data->record_session = NULL;
-    session_data->recording_file = NULL;
+    switch_copy_string(session_data->uuid, uuid, sizeof(session_data->uuid));
     session_data->is_recording = 0;
     session_data->recording_start_time = 0;
     session_data->recording_duration = 0;
-    session_data->consecutive_hits = 0;
-    session_data->word_start_time = 0;
-    session_data->word_end_time = 0;
-    session_data->current_word_length = 0;
-    session_data->between_words_silence_frames = 0;
-    session_data->max_silence_frames = 0;
-
-    // Apply runtime parameters
-    voice_detector_apply_runtime_params(session_data, &runtime_params);
-
-    // Create media bug based on leg selection
-    switch_media_bug_flag_t flags = SMBF_READ_STREAM | SMBF_NO_PAUSE;
+
+    // Apply runtime parameters, timing follows the codec of the monitored stream
+    voice_detector_init_timing(session_data, !strcasecmp(params->leg, "b"));
+    voice_detector_apply_runtime_params(session_data, params);
+
+    // Create media bug based on leg selection, each direction has its own detector
+    switch_media_bug_flag_t flags = SMBF_NO_PAUSE;
     
     if (!strcasecmp(session_data->runtime_params.leg, "a")) {
         // Monitor leg A (read stream)
@@ -704,111 +3959,423 @@ static switch_status_t voice_detector_app_function(switch_core_session_t *sessio
         // Monitor leg B (write stream)
         flags |= SMBF_WRITE_STREAM;
     } else if (!strcasecmp(session_data->runtime_params.leg, "both")) {
-        // Monitor both legs
-        flags |= SMBF_READ_STREAM | SMBF_WRITE_STREAM;
+        // Monitor both legs, unmixed: each frame carries the read stream left and the write stream right
+        flags |= SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO;
+        session_data->split_legs = 1;
     } else {
         // Default to leg A if invalid value
         flags |= SMBF_READ_STREAM;
-        session_data->runtime_params.leg = "a";
+        switch_copy_string(session_data->runtime_params.leg, "a", sizeof(session_data->runtime_params.leg));
+        session_data->monitored[VOICE_DETECTOR_DIRECTION_WRITE] = 0;
     }
     
-    status = switch_core_media_bug_add(session, "voice_detector", NULL, voice_detector_callback, session_data, 0, flags, &session_data->bug);
+    flags |= voice_detector_g711_setup(session_data);
+
+    // Register before attaching the bug, so a concurrent start on the same UUID loses cleanly
+    if (!voice_detector_registry_insert(session_data)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Voice detection already active for session %s\n", uuid);
+        voice_detector_session_cleanup(session_data);
+        return SWITCH_STATUS_INUSE;
+    }
+
+    // ASR streaming connects on the network thread, the call never waits on it
+    voice_detector_stream_open(session_data);
+    voice_detector_event_templates_create(session_data);
+
+    // Batched mode: a session always goes to the same worker, so its frames stay in order
+    if (globals->processors) {
+        session_data->processor = &globals->processors[voice_detector_hash_uuid(session_data->uuid) % globals->processing_threads];
+    }
+
+    status = switch_core_media_bug_add(session, "voice_detector", NULL, voice_detector_bug_callback, session_data, 0, flags, &session_data->bug);
     if (status != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to create media bug for session %s\n", uuid);
         voice_detector_session_cleanup(session_data);
         return status;
     }
 
-    // Add to sessions hash
-    switch_mutex_lock(globals->mutex);
-    switch_core_hash_insert(globals->sessions, uuid, session_data);
-    switch_mutex_unlock(globals->mutex);
-
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Voice detection started for session %s on leg %s (auto-recording: %s, energy_threshold: %.3f, max_silence: %dms)\n", 
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Voice detection started for session %s on leg %s (vad_mode: %s, auto-recording: %s, energy_threshold: %.3f, max_silence: %dms)\n", 
                       uuid, 
                       session_data->runtime_params.leg,
+                      session_data->nn[session_data->record_write_stream] ? "nn" :
+                      session_data->core[session_data->record_write_stream].spectral ? "spectral" : "energy",
                       session_data->runtime_params.auto_record ? "enabled" : "disabled",
                       session_data->runtime_params.energy_threshold,
                       session_data->runtime_params.max_silence);
     return SWITCH_STATUS_SUCCESS;
 }
 
+// Detach the detector from a session. The bug's CLOSE callback does the cleanup.
+static switch_status_t voice_detector_stop_session(switch_core_session_t *session, const char *uuid)
+{
+    voice_detector_registry_shard_t *shard = voice_detector_registry_shard(uuid);
+    voice_detector_session_t *session_data;
+    switch_media_bug_t *bug = NULL;
+
+    switch_mutex_lock(shard->mutex);
+    if ((session_data = switch_core_hash_find(shard->sessions, uuid))) {
+        bug = session_data->bug;
+    }
+    switch_mutex_unlock(shard->mutex);
+
+    // Removal only succeeds for a bug still attached to this session, so a racing hangup is harmless
+    if (!bug || switch_core_media_bug_remove(session, &bug) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_NOTFOUND;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Voice detection stopped for session %s\n", uuid);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Start or stop detection on a comma-separated UUID list, one result line per UUID.
+// Start parameters are parsed once for the whole batch.
+static void voice_detector_api_bulk(switch_stream_handle_t *stream, switch_bool_t start, char *uuids, const char *data)
+{
+    voice_detector_runtime_params_t runtime_params;
+    int total = 0, done = 0;
+    char *uuid, *next;
+
+    if (start && voice_detector_parse_runtime_params(data, &runtime_params) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR invalid parameters or unknown profile\n");
+        return;
+    }
+
+    for (uuid = uuids; uuid; uuid = next) {
+        switch_core_session_t *session;
+        switch_status_t status;
+
+        if ((next = strchr(uuid, ','))) {
+            *next++ = '\0';
+        }
+        if (!*uuid) {
+            continue;
+        }
+        total++;
+
+        if (!(session = switch_core_session_locate(uuid))) {
+            stream->write_function(stream, "-ERR %s no such channel\n", uuid);
+            continue;
+        }
+
+        if (start) {
+            if ((status = voice_detector_start_session(session, &runtime_params)) == SWITCH_STATUS_INUSE) {
+                stream->write_function(stream, "-ERR %s already active\n", uuid);
+            } else if (status != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR %s failed to start\n", uuid);
+            }
+        } else if ((status = voice_detector_stop_session(session, uuid)) != SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "-ERR %s not active\n", uuid);
+        }
+        switch_core_session_rwunlock(session);
+
+        if (status == SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "+OK %s\n", uuid);
+            done++;
+        }
+    }
+
+    stream->write_function(stream, "%s %d of %d\n", start ? "Started" : "Stopped", done, total);
+}
+
 // API function
-static switch_status_t voice_detector_api_function(switch_core_session_t *session, const char *data, switch_io_data_stream_t *stream, switch_input_callback_t *write_callback)
+static switch_status_t voice_detector_api_function(switch_core_session_t *session, const char *data, switch_stream_handle_t *stream, switch_input_callback_t *write_callback)
 {
-    switch_channel_t *channel = switch_core_session_get_channel(session);
     char *mycmd = NULL;
-    char *argv[10] = { 0 };
+    char *argv[3] = { 0 };
     int argc = 0;
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
 
-    if (!data) {
-        stream->write_function(stream, "Usage: voice_detector <start|stop|status> [uuid]\n");
+    if (zstr(data)) {
+        stream->write_function(stream, "Usage: voice_detector %s\n", VOICE_DETECTOR_SYNTAX);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    mycmd = switch_core_strdup(session->pool, data);
+    // Called from ESL there is no session, the copy is freed on every path below.
+    // The third field keeps the start parameters unsplit.
+    mycmd = strdup(data);
     argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
 
     if (argc < 1) {
-        stream->write_function(stream, "Usage: voice_detector <start|stop|status> [uuid]\n");
-        return SWITCH_STATUS_SUCCESS;
-    }
-
-    if (!strcasecmp(argv[0], "start")) {
-        if (argc < 2) {
-            stream->write_function(stream, "Usage: voice_detector start <uuid>\n");
-            return SWITCH_STATUS_SUCCESS;
-        }
-        // Start voice detection on specific UUID
-        // Implementation would involve finding the session and starting detection
-        stream->write_function(stream, "Starting voice detection on %s\n", argv[1]);
-    } else if (!strcasecmp(argv[0], "stop")) {
+        stream->write_function(stream, "Usage: voice_detector %s\n", VOICE_DETECTOR_SYNTAX);
+    } else if (!strcasecmp(argv[0], "start") || !strcasecmp(argv[0], "stop")) {
         if (argc < 2) {
-            stream->write_function(stream, "Usage: voice_detector stop <uuid>\n");
-            return SWITCH_STATUS_SUCCESS;
+            stream->write_function(stream, "Usage: voice_detector %s <uuid[,uuid...]>%s\n", argv[0], strcasecmp(argv[0], "start") ? "" : " [params]");
+        } else {
+            voice_detector_api_bulk(stream, !strcasecmp(argv[0], "start"), argv[1], argc > 2 ? argv[2] : NULL);
         }
-        // Stop voice detection on specific UUID
-        stream->write_function(stream, "Starting voice detection on %s\n", argv[1]);
     } else if (!strcasecmp(argv[0], "status")) {
-        // Show status of all monitored sessions
-        switch_hash_index_t *hi;
-        void *val;
-        voice_detector_session_t *session_data;
+        // Show status of all monitored sessions. Each shard is copied under its own lock and
+        // formatted afterwards, so slow output never holds up session start/stop.
+        voice_detector_status_t *snapshot = NULL;
+        int snapshot_size = 0;
         int count = 0;
+        int shard, i, n;
 
-        switch_mutex_lock(globals->mutex);
-        for (hi = switch_core_hash_first(globals->sessions); hi; hi = switch_core_hash_next(&hi)) {
-            switch_core_hash_this(hi, NULL, NULL, &val);
-            session_data = (voice_detector_session_t *)val;
-            if (session_data) {
-                stream->write_function(stream, "Session: %s, Leg: %s, Voice: %s, Recording: %s, Frames: %d, Energy: %.3f, Max Silence: %dms\n", 
-                    session_data->uuid, 
-                    session_data->runtime_params.leg,
-                    session_data->voice_detected ? "YES" : "NO",
-                    session_data->is_recording ? "YES" : "NO",
-                    session_data->total_frames,
-                    session_data->runtime_params.energy_threshold,
-                    session_data->runtime_params.max_silence);
-                count++;
+        for (shard = 0; shard < VOICE_DETECTOR_REGISTRY_SHARDS; shard++) {
+            n = voice_detector_registry_snapshot(&globals->registry[shard], &snapshot, &snapshot_size);
+            for (i = 0; i < n; i++) {
+                stream->write_function(stream, "Session: %s, Leg: %s, Rate: %dHz, Analysis: %dHz, Voice: %s, Recording: %s, Frames: %d, Energy: %.3f, Max Silence: %dms\n", 
+                    snapshot[i].uuid, 
+                    snapshot[i].leg,
+                    snapshot[i].stream_rate,
+                    snapshot[i].sample_rate,
+                    snapshot[i].voice_detected ? "YES" : "NO",
+                    snapshot[i].is_recording ? "YES" : "NO",
+                    snapshot[i].total_frames,
+                    snapshot[i].energy_threshold,
+                    snapshot[i].max_silence);
             }
+            count += n;
         }
-        switch_mutex_unlock(globals->mutex);
+        switch_safe_free(snapshot);
 
         stream->write_function(stream, "Total monitored sessions: %d\n", count);
+        switch_mutex_lock(globals->slab.mutex);
+        stream->write_function(stream, "Session slab: %d allocated, %d in use\n", globals->slab.allocated, globals->slab.in_use);
+        stream->write_function(stream, "Session arenas:");
+        for (i = 0; i < VOICE_DETECTOR_ARENA_CLASSES; i++) {
+            stream->write_function(stream, " %dK=%d", (VOICE_DETECTOR_ARENA_CLASS_MIN << i) / 1024, globals->slab.arena_allocated[i]);
+        }
+        stream->write_function(stream, "\n");
+        switch_mutex_unlock(globals->slab.mutex);
+        stream->write_function(stream, "Profiles: %d\n", globals->profile_count);
         stream->write_function(stream, "Auto-recording: %s\n", globals->auto_record ? "enabled" : "disabled");
         stream->write_function(stream, "Recording path: %s\n", globals->recording_path);
+    } else if (!strcasecmp(argv[0], "metrics")) {
+        voice_detector_metrics_export(stream);
     } else {
         stream->write_function(stream, "Unknown command: %s\n", argv[0]);
-        stream->write_function(stream, "Usage: voice_detector <start|stop|status> [uuid]\n");
+        stream->write_function(stream, "Usage: voice_detector %s\n", VOICE_DETECTOR_SYNTAX);
     }
 
+    switch_safe_free(mycmd);
+
     return SWITCH_STATUS_SUCCESS;
 }
 
+// Write one Prometheus histogram, bounds are scaled from the recorded unit to seconds
+static void voice_detector_metrics_export_histogram(switch_stream_handle_t *stream, const char *name, const char *help,
+                                                    voice_detector_histogram_t histogram, double unit)
+{
+    uint64_t cumulative[VOICE_DETECTOR_METRICS_MAX_BUCKETS + 1];
+    const uint64_t *bounds;
+    uint64_t sum;
+    int size, i;
+
+    size = voice_detector_metrics_bounds(histogram, &bounds);
+    voice_detector_metrics_histogram(globals->metrics, histogram, cumulative, &sum);
+
+    stream->write_function(stream, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (i = 0; i < size; i++) {
+        stream->write_function(stream, "%s_bucket{le=\"%g\"} %llu\n", name, bounds[i] * unit, (unsigned long long)cumulative[i]);
+    }
+    stream->write_function(stream, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative[size]);
+    stream->write_function(stream, "%s_sum %g\n", name, sum * unit);
+    stream->write_function(stream, "%s_count %llu\n", name, (unsigned long long)cumulative[size]);
+}
+
+static void voice_detector_metrics_export_counter(switch_stream_handle_t *stream, const char *name, const char *help, uint64_t value)
+{
+    stream->write_function(stream, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+// Prometheus text exposition. Counters are summed from the stripes and sessions are read
+// shard by shard, nothing here takes globals->mutex or stalls the media threads.
+static void voice_detector_metrics_export(switch_stream_handle_t *stream)
+{
+    voice_detector_status_t *snapshot = NULL;
+    int snapshot_size = 0;
+    uint64_t depth = 0;
+    int shard, i, n;
+
+    voice_detector_metrics_export_counter(stream, "voice_detector_frames_total", "Media frames analysed.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_FRAMES));
+    voice_detector_metrics_export_counter(stream, "voice_detector_silent_frames_total", "Comfort noise, DTX and digital silence frames skipped by the analysis.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_SILENT_FRAMES));
+    voice_detector_metrics_export_counter(stream, "voice_detector_voice_starts_total", "Confirmed voice starts.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_VOICE_STARTS));
+    voice_detector_metrics_export_counter(stream, "voice_detector_false_starts_total", "Voice starts reset by maximum_word_length.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_FALSE_STARTS));
+    voice_detector_metrics_export_counter(stream, "voice_detector_degraded_sessions_total", "Sessions started with the overload configuration.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_DEGRADED_SESSIONS));
+    voice_detector_metrics_export_histogram(stream, "voice_detector_callback_seconds", "Time spent analysing one media frame.",
+                                            VOICE_DETECTOR_HISTOGRAM_CALLBACK_NS, 1e-9);
+
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_requests_total", "Webhook requests sent.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_POSTS));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_events_total", "Events delivered in webhook requests.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_EVENTS));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_failures_total", "Webhook requests that failed or returned HTTP 4xx/5xx.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_FAILURES));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_events_dropped_total", "Events dropped on a full dispatcher queue.",
+                                          __atomic_load_n(&globals->events_dropped, __ATOMIC_RELAXED));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_events_spooled_total", "Events written to a dispatcher spool.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOLED));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_spool_dropped_total", "Events lost on a full dispatcher spool.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_DROPPED));
+    voice_detector_metrics_export_counter(stream, "voice_detector_webhook_spool_invalid_total", "Damaged spool records discarded on replay.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_INVALID));
+    voice_detector_metrics_export_histogram(stream, "voice_detector_webhook_latency_seconds", "Webhook request latency.",
+                                            VOICE_DETECTOR_HISTOGRAM_WEBHOOK_US, 1e-6);
+    for (i = 0; globals->dispatchers && i < globals->dispatcher_threads; i++) {
+        depth += voice_detector_queue_depth(globals->dispatchers[i].queue);
+    }
+    stream->write_function(stream, "# HELP voice_detector_webhook_queue_depth Events waiting for a dispatcher.\n"
+                           "# TYPE voice_detector_webhook_queue_depth gauge\nvoice_detector_webhook_queue_depth %llu\n", (unsigned long long)depth);
+    depth = 0;
+    for (i = 0; globals->dispatchers && i < globals->dispatcher_threads; i++) {
+        depth += voice_detector_spool_depth(&globals->dispatchers[i].spool);
+    }
+    stream->write_function(stream, "# HELP voice_detector_webhook_spool_depth Events waiting in dispatcher spools.\n"
+                           "# TYPE voice_detector_webhook_spool_depth gauge\nvoice_detector_webhook_spool_depth %llu\n", (unsigned long long)depth);
+
+    voice_detector_metrics_export_counter(stream, "voice_detector_recording_bytes_total", "Audio bytes written to recordings.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_RECORDING_BYTES));
+    voice_detector_metrics_export_counter(stream, "voice_detector_recording_chunks_dropped_total", "Recording audio chunks dropped on a full writer queue.",
+                                          __atomic_load_n(&globals->recording_chunks_dropped, __ATOMIC_RELAXED));
+    voice_detector_metrics_export_counter(stream, "voice_detector_stream_chunks_dropped_total", "ASR audio chunks dropped on a full network queue.",
+                                          __atomic_load_n(&globals->stream_chunks_dropped, __ATOMIC_RELAXED));
+    voice_detector_metrics_export_counter(stream, "voice_detector_frames_dropped_total", "Frames dropped on a full processing worker queue.",
+                                          __atomic_load_n(&globals->frames_dropped, __ATOMIC_RELAXED));
+    depth = 0;
+    for (i = 0; globals->processors && i < globals->processing_threads; i++) {
+        depth += voice_detector_queue_depth(globals->processors[i].queue);
+    }
+    stream->write_function(stream, "# HELP voice_detector_processing_queue_depth Frames waiting for a processing worker.\n"
+                           "# TYPE voice_detector_processing_queue_depth gauge\nvoice_detector_processing_queue_depth %llu\n", (unsigned long long)depth);
+
+    voice_detector_metrics_export_counter(stream, "voice_detector_nn_batches_total", "Neural VAD model invocations.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_NN_BATCHES));
+    voice_detector_metrics_export_counter(stream, "voice_detector_nn_windows_total", "Windows scored by the neural VAD.",
+                                          voice_detector_metrics_counter(globals->metrics, VOICE_DETECTOR_METRIC_NN_WINDOWS));
+    voice_detector_metrics_export_counter(stream, "voice_detector_nn_windows_skipped_total", "Windows not scored because the previous one was still in flight.",
+                                          __atomic_load_n(&globals->nn_windows_skipped, __ATOMIC_RELAXED));
+    voice_detector_metrics_export_histogram(stream, "voice_detector_nn_batch_seconds", "Neural VAD inference time per batch.",
+                                            VOICE_DETECTOR_HISTOGRAM_NN_BATCH_US, 1e-6);
+
+    stream->write_function(stream, "# HELP voice_detector_sessions Monitored sessions.\n# TYPE voice_detector_sessions gauge\n"
+                           "voice_detector_sessions %d\n", __atomic_load_n(&globals->slab.in_use, __ATOMIC_RELAXED));
+
+    // Per-session series
+    stream->write_function(stream, "# HELP voice_detector_session_frames_total Media frames analysed per session.\n"
+                           "# TYPE voice_detector_session_frames_total counter\n");
+    stream->write_function(stream, "# HELP voice_detector_session_voice_starts_total Confirmed voice starts per session.\n"
+                           "# TYPE voice_detector_session_voice_starts_total counter\n");
+    stream->write_function(stream, "# HELP voice_detector_session_false_starts_total Voice starts reset by maximum_word_length per session.\n"
+                           "# TYPE voice_detector_session_false_starts_total counter\n");
+    for (shard = 0; shard < VOICE_DETECTOR_REGISTRY_SHARDS; shard++) {
+        n = voice_detector_registry_snapshot(&globals->registry[shard], &snapshot, &snapshot_size);
+        for (i = 0; i < n; i++) {
+            stream->write_function(stream, "voice_detector_session_frames_total{uuid=\"%s\",leg=\"%s\"} %d\n",
+                                   snapshot[i].uuid, snapshot[i].leg, snapshot[i].total_frames);
+            stream->write_function(stream, "voice_detector_session_voice_starts_total{uuid=\"%s\",leg=\"%s\"} %u\n",
+                                   snapshot[i].uuid, snapshot[i].leg, snapshot[i].voice_starts);
+            stream->write_function(stream, "voice_detector_session_false_starts_total{uuid=\"%s\",leg=\"%s\"} %u\n",
+                                   snapshot[i].uuid, snapshot[i].leg, snapshot[i].false_starts);
+        }
+    }
+    switch_safe_free(snapshot);
+}
+
 // Event hook function
-static switch_status_t voice_detector_event_hook(switch_event_t *event, void *user_data)
+static void voice_detector_event_hook(switch_event_t *event)
+{
+    // reloadxml: re-read the profiles, the rest of the configuration needs a module reload
+    if (event->event_id == SWITCH_EVENT_RELOADXML) {
+        voice_detector_load_profiles();
+    }
+}
+
+// Dialplan application entry point
+SWITCH_STANDARD_APP(voice_detector_app)
+{
+    voice_detector_app_function(session, data);
+}
+
+// API command entry point
+SWITCH_STANDARD_API(voice_detector_api)
+{
+    return voice_detector_api_function(session, cmd, stream, NULL);
+}
+
+// Module load function
+SWITCH_MODULE_LOAD_FUNCTION(mod_voice_detector_load)
+{
+    switch_application_interface_t *app_interface;
+    switch_api_interface_t *api_interface;
+
+    *module_interface = switch_loadable_module_create_module_interface(pool, modname);
+
+    globals = switch_core_alloc(pool, sizeof(voice_detector_global_t));
+    globals->pool = pool;
+    globals->metrics = (voice_detector_metrics_t *)(((uintptr_t)switch_core_alloc(pool, sizeof(voice_detector_metrics_t) + 63) + 63) & ~(uintptr_t)63);
+    switch_mutex_init(&globals->mutex, SWITCH_MUTEX_NESTED, pool);
+    voice_detector_registry_init(pool);
+    switch_mutex_init(&globals->slab.mutex, SWITCH_MUTEX_NESTED, pool);
+
+    voice_detector_parse_config(module_interface, pool);
+
+    if (voice_detector_param_hash_init() != SWITCH_STATUS_SUCCESS) {
+        voice_detector_registry_destroy();
+        return SWITCH_STATUS_GENERR;
+    }
+    switch_thread_rwlock_create(&globals->profiles_lock, pool);
+    voice_detector_load_profiles();
+    if (switch_event_bind_removable(modname, SWITCH_EVENT_RELOADXML, NULL, voice_detector_event_hook, NULL, &globals->reload_node) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Couldn't bind reloadxml, profiles will only load with the module\n");
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Using %s frame energy kernel\n", voice_detector_energy_init());
+    voice_detector_spectral_init();
+    voice_detector_decimator_init();
+    voice_detector_g711_init();
+
+    voice_detector_subclasses_reserve();
+    voice_detector_stream_support();
+
+    if (voice_detector_dispatchers_start() != SWITCH_STATUS_SUCCESS || voice_detector_encoders_start() != SWITCH_STATUS_SUCCESS ||
+        voice_detector_writers_start() != SWITCH_STATUS_SUCCESS || voice_detector_streamers_start() != SWITCH_STATUS_SUCCESS ||
+        voice_detector_nn_workers_start() != SWITCH_STATUS_SUCCESS || voice_detector_processors_start() != SWITCH_STATUS_SUCCESS) {
+        voice_detector_processors_stop();
+        voice_detector_nn_workers_stop();
+        voice_detector_streamers_stop();
+        voice_detector_writers_stop();
+        voice_detector_encoders_stop();
+        voice_detector_dispatchers_stop();
+        switch_event_unbind(&globals->reload_node);
+        voice_detector_destroy_profiles();
+        voice_detector_registry_destroy();
+        voice_detector_subclasses_free();
+        return SWITCH_STATUS_GENERR;
+    }
+
+    SWITCH_ADD_APP(app_interface, "voice_detector", "Voice activity detector", "Detect voice activity and send webhook events",
+                   voice_detector_app, "[param=value ...]", SAF_NONE);
+    SWITCH_ADD_API(api_interface, "voice_detector", "Voice detector control", voice_detector_api, VOICE_DETECTOR_SYNTAX);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Voice detector module loaded\n");
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// Module shutdown function
+SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_voice_detector_shutdown)
 {
-    // Handle channel events if needed
+    voice_detector_processors_stop();
+    voice_detector_nn_workers_stop();
+    voice_detector_streamers_stop();
+    voice_detector_writers_stop();
+    voice_detector_encoders_stop();
+    voice_detector_dispatchers_stop();
+    switch_event_unbind(&globals->reload_node);
+    voice_detector_destroy_profiles();
+    voice_detector_registry_destroy();
+    voice_detector_subclasses_free();
+
+    if (globals->http_headers) {
+        switch_curl_slist_free_all(globals->http_headers);
+        globals->http_headers = NULL;
+    }
+
     return SWITCH_STATUS_SUCCESS;
 }
@@ -11,31 +11,400 @@
 #include <switch_curl.h>
 #include <switch_json.h>
 
+#include "voice_detector_energy.h"
+#include "voice_detector_spectral.h"
+#include "voice_detector_decimator.h"
+#include "voice_detector_ring.h"
+#include "voice_detector_metrics.h"
+#include "voice_detector_tone.h"
+#include "voice_detector_core.h"
+#include "voice_detector_spool.h"
+#include "voice_detector_g711.h"
+#include "voice_detector_nn.h"
+
+// ASR streaming needs the libcurl WebSocket API, experimental and off by default before 8.11.
+// Older headers build the module without it; at load the library is asked whether it has ws/wss.
+#if defined(CURLWS_BINARY) && defined(LIBCURL_VERSION_NUM) && LIBCURL_VERSION_NUM >= 0x075600
+#define VOICE_DETECTOR_WITH_WEBSOCKET 1
+#endif
+
 // Module definition macros
 SWITCH_MODULE_LOAD_FUNCTION(mod_voice_detector_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_voice_detector_shutdown);
 SWITCH_MODULE_DEFINITION(mod_voice_detector, mod_voice_detector_load, mod_voice_detector_shutdown, NULL);
 
+// Recording writer: audio per queue item, samples gathered per file write, queue slots kept for open/close
+#define VOICE_DETECTOR_WRITER_CHUNK_SAMPLES 480
+#define VOICE_DETECTOR_WRITER_BUFFER_SAMPLES 32768
+#define VOICE_DETECTOR_WRITER_RESERVE 64
+#define VOICE_DETECTOR_WRITER_IDLE_US 10000
+#define VOICE_DETECTOR_WRITER_OP_OPEN 0
+#define VOICE_DETECTOR_WRITER_OP_WRITE 1
+#define VOICE_DETECTOR_WRITER_OP_CLOSE 2
+
+// Deferred encoding: MP3/OGG recordings are captured as raw PCM next to the target file and
+// encoded by the encoder pool after they close
+#define VOICE_DETECTOR_ENCODER_RAW_SUFFIX ".pcm"
+#define VOICE_DETECTOR_ENCODER_RAW_BUFFER (256 * 1024)  // stdio buffer of the raw capture
+#define VOICE_DETECTOR_ENCODER_CHUNK_SAMPLES 8192
+#define VOICE_DETECTOR_ENCODER_IDLE_US 20000
+
+// ASR streaming: the Vosk /asr endpoint takes 16 kHz mono PCM and answers with JSON text frames
+#define VOICE_DETECTOR_STREAM_RATE 16000
+#define VOICE_DETECTOR_STREAM_SEND_SAMPLES 1600    // 100 ms per WebSocket message
+#define VOICE_DETECTOR_STREAM_BUFFER_SAMPLES 4096  // Send threshold plus one upsampled chunk
+#define VOICE_DETECTOR_STREAM_RECV_BUFFER 4096
+#define VOICE_DETECTOR_STREAM_CONNECT_TIMEOUT_MS 3000
+#define VOICE_DETECTOR_STREAM_RETRY_US 2000000
+#define VOICE_DETECTOR_STREAM_IDLE_US 5000
+#define VOICE_DETECTOR_STREAM_OP_OPEN 0
+#define VOICE_DETECTOR_STREAM_OP_AUDIO 1
+#define VOICE_DETECTOR_STREAM_OP_FLUSH 2
+#define VOICE_DETECTOR_STREAM_OP_CLOSE 3
+#define VOICE_DETECTOR_EVENT_TRANSCRIPT "voice_detector::transcript"
+
+// Batched processing: media bugs copy frames to a worker, frames above this size are split
+#define VOICE_DETECTOR_BATCH_FRAME_SAMPLES 960  // 20 ms at 48 kHz
+#define VOICE_DETECTOR_BATCH_IDLE_US 1000
+#define VOICE_DETECTOR_BATCH_RESERVE 64  // Queue slots frames leave free for session closes
+#define VOICE_DETECTOR_BATCH_OP_FRAME 0
+#define VOICE_DETECTOR_BATCH_OP_CLOSE 1
+#define VOICE_DETECTOR_BATCH_OP_G711 2  // Native tap payload, one byte per sample
+
+// CUSTOM event subclasses fired by the event sink
+#define VOICE_DETECTOR_EVENT_SUBCLASS_VOICE_START "voice_detector::voice_start"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_VOICE_END "voice_detector::voice_end"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_WORD_DETECTED "voice_detector::word_detected"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_RECORDING_START "voice_detector::recording_start"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_RECORDING_STOP "voice_detector::recording_stop"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_DOUBLE_TALK "voice_detector::double_talk"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_AMD "voice_detector::amd"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_BEEP "voice_detector::beep"
+#define VOICE_DETECTOR_EVENT_SUBCLASS_ANALYSIS_COMPLETE "voice_detector::analysis_complete"
+
+// Event type constants
+#define VOICE_DETECTOR_EVENT_VOICE_START 1
+#define VOICE_DETECTOR_EVENT_VOICE_END 0
+#define VOICE_DETECTOR_EVENT_RECORDING_START 2
+#define VOICE_DETECTOR_EVENT_RECORDING_STOP 3
+#define VOICE_DETECTOR_EVENT_WORD_DETECTED 4
+#define VOICE_DETECTOR_EVENT_DOUBLE_TALK 5
+#define VOICE_DETECTOR_EVENT_AMD 6
+#define VOICE_DETECTOR_EVENT_BEEP 7
+#define VOICE_DETECTOR_EVENT_ANALYSIS_COMPLETE 8
+#define VOICE_DETECTOR_EVENT_TYPES 9
+
+// Media bug directions, the read stream is leg a and the write stream leg b
+#define VOICE_DETECTOR_DIRECTION_READ 0
+#define VOICE_DETECTOR_DIRECTION_WRITE 1
+#define VOICE_DETECTOR_DIRECTIONS 2
+
+// Event sinks, combinable
+#define VOICE_DETECTOR_SINK_HTTP 1
+#define VOICE_DETECTOR_SINK_EVENT 2
+#define VOICE_DETECTOR_SINK_BOTH (VOICE_DETECTOR_SINK_HTTP | VOICE_DETECTOR_SINK_EVENT)
+
+// Inline string sizes, runtime parameters and sessions carry no heap pointers
+#define VOICE_DETECTOR_MAX_PATH 256
+#define VOICE_DETECTOR_MAX_PREFIX 128
+#define VOICE_DETECTOR_MAX_RECORDING_FILE 512
+#define VOICE_DETECTOR_MAX_APP_DATA 1024
+#define VOICE_DETECTOR_MAX_URL 512
+
+// Pre-roll ring bound, a power of two (about 1 s at 16 kHz), and the chunk it is flushed in
+#define VOICE_DETECTOR_PREROLL_MAX_SAMPLES 16384
+#define VOICE_DETECTOR_PREROLL_FLUSH_CHUNK 1024
+
+// Per-session arena for optional analysis state. Each session takes a block from the smallest size
+// class that holds what its parameters enable; the largest class fits every feature at once.
+#define VOICE_DETECTOR_ARENA_ALIGN 16
+#define VOICE_DETECTOR_ARENA_CLASS_MIN 4096
+#define VOICE_DETECTOR_ARENA_CLASSES 6
+#define VOICE_DETECTOR_ARENA_SLOT(size) ((switch_size_t)(size) + VOICE_DETECTOR_ARENA_ALIGN)
+#define VOICE_DETECTOR_SESSION_ARENA_MAX \
+    (VOICE_DETECTOR_DIRECTIONS * (sizeof(voice_detector_spectral_t) + sizeof(voice_detector_decimator_t) + \
+                                  sizeof(voice_detector_tone_t) + sizeof(int16_t) * (VOICE_DETECTOR_DECIMATOR_MAX_INPUT / 2 + 1) + \
+                                  sizeof(voice_detector_nn_channel_t) + 5 * VOICE_DETECTOR_ARENA_ALIGN) + \
+     sizeof(int16_t) * VOICE_DETECTOR_PREROLL_MAX_SAMPLES + VOICE_DETECTOR_ARENA_ALIGN)
+
+// Sessions are carved out of the slab this many at a time
+#define VOICE_DETECTOR_SLAB_CHUNK 16
+
 // Runtime parameters structure
 typedef struct {
     int silence_ms;
     float threshold;
     int hits;
-    int timeout;
+    int timeout;                // No voice confirmed within this long ends the analysis, ms, 0 = off
     int interrupt_ms;
     float energy_threshold;
-    int total_analysis_time;
+    int total_analysis_time;    // Analysis window, the bug detaches when it ends, ms, 0 = whole call
     int min_word_length;
     int maximum_word_length;
     int between_words_silence;
     int max_silence;
     int auto_record;
     int recording_format;
-    char *recording_path;
-    char *recording_prefix;
-    char *leg;  // "a", "b", or "both" - which leg to monitor
+    char recording_path[VOICE_DETECTOR_MAX_PATH];      // Empty = module default
+    char recording_prefix[VOICE_DETECTOR_MAX_PREFIX];  // Empty = module default
+    char leg[8];  // "a", "b", or "both" - which leg to monitor
+    int vad_mode;  // VOICE_DETECTOR_VAD_MODE_*
+    float spectral_flatness;    // Max spectral flatness of a voiced frame
+    float spectral_band_ratio;  // Min share of power in the 300-3400 Hz band
+    float spectral_zcr;         // Max zero-crossing rate of a voiced frame
+    int noise_floor;            // Adapt energy_threshold to the channel's noise floor
+    float noise_margin;         // Effective threshold = noise floor x margin (amplitude)
+    float noise_floor_min;      // Lowest effective threshold, normalized like energy_threshold
+    int analysis_rate;          // Decimate wideband streams to this rate before detection, 0 = off
+    int preroll_ms;             // Audio kept from before voice confirmation and written ahead of the recording
+    int record_mode;            // VOICE_DETECTOR_RECORD_MODE_*
+    int hangover_ms;            // Silence kept after speech before a segment or stream burst ends
+    char stream_url[VOICE_DETECTOR_MAX_URL];  // ws:// or wss:// ASR endpoint for voiced audio, empty = off
+    int sink;                   // VOICE_DETECTOR_SINK_* bits: where detection events go
+    int amd;                    // Answering machine detection and beep events
+    int amd_greeting;           // Longest greeting of a person, ms
+    int amd_after_greeting_silence;  // Silence that ends a person's greeting, ms
+    int amd_initial_silence;    // Silence before anything is said that means a machine, ms
+    int amd_max_words;          // Words in a greeting that mean a machine
+    int beep_min_length;        // Steady tone length reported as a beep, ms
+    float beep_ratio;           // Share of the frame energy in the beep's frequency bin
+    int native_g711;            // Detect on PCMU/PCMA payload from the native tap instead of decoded frames
+    float nn_threshold;         // Speech probability that starts a voiced run in vad_mode=nn
 } voice_detector_runtime_params_t;
 
+// Runtime parameter value types
+typedef enum {
+    VOICE_DETECTOR_PARAM_INT,
+    VOICE_DETECTOR_PARAM_FLOAT,
+    VOICE_DETECTOR_PARAM_STRING,
+    VOICE_DETECTOR_PARAM_LEG,
+    VOICE_DETECTOR_PARAM_VAD_MODE,
+    VOICE_DETECTOR_PARAM_RECORD_MODE,
+    VOICE_DETECTOR_PARAM_URL,
+    VOICE_DETECTOR_PARAM_SINK
+} voice_detector_param_type_t;
+
+// Runtime parameter descriptor: where a key=value lands in voice_detector_runtime_params_t
+typedef struct {
+    const char *name;
+    voice_detector_param_type_t type;
+    switch_size_t offset;
+    switch_size_t size;  // Buffer size for string types
+} voice_detector_param_def_t;
+
+// Named parameter set from voice_detector.conf, frozen until the next reloadxml
+typedef struct {
+    char name[64];
+    voice_detector_runtime_params_t params;
+} voice_detector_profile_t;
+
+// Perfect hash over the runtime parameter names, the seed is searched for at load
+#define VOICE_DETECTOR_PARAM_HASH_SIZE 128
+#define VOICE_DETECTOR_PARAM_HASH_MAX_SEED (1 << 20)
+
+// Webhook event, copied by value into a dispatcher queue
+typedef struct {
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char leg[8];
+    int voice_detected;
+    int energy_level;
+    switch_time_t timestamp;
+    char recording_file[VOICE_DETECTOR_MAX_RECORDING_FILE];  // Recording events only, empty otherwise
+    int recording_encoded;  // Recording stop only, 0 = recording_file is the raw capture left by a failed encode
+} voice_detector_event_t;
+
+// Worst case serialized event: fixed fields plus every string byte escaped as \u00XX
+#define VOICE_DETECTOR_EVENT_JSON_MAX (256 + 6 * (SWITCH_UUID_FORMATTED_LENGTH + 8 + VOICE_DETECTOR_MAX_RECORDING_FILE))
+
+// Bounded lock-free MPMC queue of fixed-size elements
+typedef struct {
+    char *cells;
+    switch_size_t cell_size;
+    switch_size_t elem_size;
+    switch_size_t mask;
+    char pad0[64];
+    volatile switch_size_t enqueue_pos;
+    char pad1[64];
+    volatile switch_size_t dequeue_pos;
+    char pad2[64];
+} voice_detector_queue_t;
+
+// Webhook dispatcher thread, each one drains its own queue
+typedef struct {
+    switch_thread_t *thread;
+    voice_detector_queue_t *queue;
+    switch_curl_handle_t *curl;  // Cached handle, keeps the webhook connection alive
+    voice_detector_event_t *batch;  // batch_max_events slots
+    char *json;                     // Request body, VOICE_DETECTOR_EVENT_JSON_MAX per batch slot
+    voice_detector_spool_t spool;   // Failed and backlogged events, header NULL when disabled
+    switch_time_t retry_at;         // Next spool replay attempt
+    int backoff_ms;                 // 0 while the endpoint is healthy
+    int spool_full;                 // Overflow level logged until the spool drains, 0 = none
+    int index;
+} voice_detector_dispatcher_t;
+
+// Recording owned by a writer thread: opened, written and closed off the media path
+typedef struct voice_detector_recording_s {
+    switch_file_handle_t fh;
+    char path[VOICE_DETECTOR_MAX_RECORDING_FILE];
+    int rate;
+    int is_open;
+    int writer;          // Index of the writer thread that owns it, keeps its operations ordered
+    int16_t *buffer;     // Samples gathered for the next large write
+    uint32_t buffered;
+    // Deferred encoding: raw capture, and what the encoder needs to report once the session is gone
+    int encode;
+    FILE *raw;
+    char *raw_buffer;
+    char raw_path[VOICE_DETECTOR_MAX_RECORDING_FILE + sizeof(VOICE_DETECTOR_ENCODER_RAW_SUFFIX)];
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char leg[8];
+    int sink;
+    switch_time_t duration;  // Seconds, set by stop_recording before the close is queued
+    struct voice_detector_recording_s *next_close;  // Writer closing list link
+    switch_size_t close_after;                      // Queue position the writer must pass before the close
+} voice_detector_recording_t;
+
+// Writer queue item, audio is copied by value
+typedef struct {
+    voice_detector_recording_t *recording;
+    int op;              // VOICE_DETECTOR_WRITER_OP_*
+    uint32_t count;
+    int16_t samples[VOICE_DETECTOR_WRITER_CHUNK_SAMPLES];
+} voice_detector_writer_item_t;
+
+// Recording writer thread, each one drains its own queue
+typedef struct {
+    switch_thread_t *thread;
+    voice_detector_queue_t *queue;
+    voice_detector_recording_t *volatile closing;  // Closes that did not fit in the queue, linked by next_close
+    int index;
+} voice_detector_writer_t;
+
+// ASR WebSocket stream, owned by a network thread once opened
+typedef struct voice_detector_stream_s {
+    struct voice_detector_stream_s *next;  // Network thread's list of open streams
+    switch_curl_handle_t *curl;
+    char url[VOICE_DETECTOR_MAX_URL];
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char leg[8];
+    int rate;                // Rate of the audio handed in, resampled to VOICE_DETECTOR_STREAM_RATE
+    int streamer;            // Index of the network thread that owns it
+    int connected;
+    switch_time_t retry_at;  // Earliest reconnect after a failure
+    switch_audio_resampler_t *resampler;
+    int16_t send_buffer[VOICE_DETECTOR_STREAM_BUFFER_SAMPLES];
+    uint32_t buffered;
+    char recv_buffer[VOICE_DETECTOR_STREAM_RECV_BUFFER];
+    switch_size_t received;
+    int recv_overflow;
+    struct voice_detector_stream_s *next_close;  // Network thread closing list link
+    switch_size_t close_after;                   // Queue position the thread must pass before the teardown
+} voice_detector_stream_t;
+
+// Network thread queue item, audio is copied by value
+typedef struct {
+    voice_detector_stream_t *stream;
+    int op;                  // VOICE_DETECTOR_STREAM_OP_*
+    uint32_t count;
+    int16_t samples[VOICE_DETECTOR_WRITER_CHUNK_SAMPLES];
+} voice_detector_stream_item_t;
+
+// ASR network thread, drives every stream assigned to it
+typedef struct {
+    switch_thread_t *thread;
+    voice_detector_queue_t *queue;
+    voice_detector_stream_t *streams;
+    voice_detector_stream_t *volatile closing;  // Closes that did not fit in the queue, linked by next_close
+    int index;
+} voice_detector_streamer_t;
+
+// Frame copied from a media bug to a processing worker, or the session's close
+typedef struct {
+    struct voice_detector_session_s *session;
+    int op;
+    int write_stream;
+    int silent;  // Comfort noise frame, analysed as silence
+    uint32_t count;
+    int16_t samples[VOICE_DETECTOR_BATCH_FRAME_SAMPLES];  // Payload bytes for VOICE_DETECTOR_BATCH_OP_G711
+} voice_detector_batch_item_t;
+
+// Processing worker, runs detection for every session routed to it
+typedef struct {
+    switch_thread_t *thread;
+    voice_detector_queue_t *queue;
+    voice_detector_batch_item_t *batch;  // processing_batch items
+    uint64_t *energies;                  // Frame energy per batch slot
+    struct voice_detector_session_s *volatile closing;  // Closes that did not fit in the queue, linked by next_close
+    int index;
+} voice_detector_processor_t;
+
+struct voice_detector_nn_worker_s;
+
+// Neural VAD state of one direction. The session thread fills the window and reads the last
+// probability; input and state belong to the inference worker while a window is in flight.
+typedef struct {
+    struct voice_detector_nn_worker_s *worker;
+    int rate;
+    int window;     // Samples per inference
+    int fill;
+    int threshold;  // Per mille, voiced at or above
+    int release;    // Per mille, unvoiced below
+    int voiced;
+    volatile int inflight;
+    volatile int prob;  // Last speech probability, per mille
+    int16_t samples[VOICE_DETECTOR_NN_MAX_WINDOW];
+    float input[VOICE_DETECTOR_NN_MAX_WINDOW];
+    float state[VOICE_DETECTOR_NN_MAX_STATE];
+} voice_detector_nn_channel_t;
+
+// Inference worker: gathers full windows of many channels into one batch per model call
+typedef struct voice_detector_nn_worker_s {
+    switch_thread_t *thread;
+    voice_detector_queue_t *queue;            // voice_detector_nn_channel_t pointers
+    voice_detector_nn_model_t *model;
+    voice_detector_nn_channel_t **batch;      // nn_batch slots, in queue order
+    voice_detector_nn_channel_t **members;    // Channels of the tensor being run
+    float *input;                             // nn_batch x VOICE_DETECTOR_NN_MAX_WINDOW
+    float *state;                             // nn_batch x VOICE_DETECTOR_NN_MAX_STATE
+    float *probs;
+    int index;
+} voice_detector_nn_worker_t;
+
+// Session registry shard, sessions are spread over shards by UUID hash
+typedef struct {
+    switch_mutex_t *mutex;
+    switch_hash_t *sessions;
+} voice_detector_registry_shard_t;
+
+// Copy of one session's status, taken under its shard lock
+typedef struct {
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char leg[8];
+    int stream_rate;
+    int sample_rate;
+    int voice_detected;
+    int is_recording;
+    int total_frames;
+    uint32_t voice_starts;
+    uint32_t false_starts;
+    float energy_threshold;
+    int max_silence;
+} voice_detector_status_t;
+
+#define VOICE_DETECTOR_REGISTRY_SHARDS 64
+
+// Fixed-size session slab, freed sessions are kept for reuse so memory stays at peak concurrency.
+// Arena blocks are kept per size class the same way, a session only holds one while it is active.
+typedef struct {
+    switch_mutex_t *mutex;
+    struct voice_detector_session_s *free_list;
+    int allocated;
+    int in_use;
+    char *arena_free[VOICE_DETECTOR_ARENA_CLASSES];
+    int arena_allocated[VOICE_DETECTOR_ARENA_CLASSES];
+} voice_detector_slab_t;
+
 // Configuration structure
 typedef struct {
     char *api_url;
@@ -44,7 +413,57 @@ typedef struct {
     char *recording_prefix;
     switch_memory_pool_t *pool;
     switch_mutex_t *mutex;
-    switch_hash_t *sessions;
+    voice_detector_registry_shard_t registry[VOICE_DETECTOR_REGISTRY_SHARDS];
+    voice_detector_slab_t slab;
+    voice_detector_metrics_t *metrics;  // Striped, cache-line aligned, read without locks
+    // Named runtime parameter profiles, swapped wholesale on reloadxml
+    switch_thread_rwlock_t *profiles_lock;
+    switch_hash_t *profiles;
+    switch_memory_pool_t *profiles_pool;
+    int profile_count;
+    switch_event_node_t *reload_node;
+    // Recording writer pool
+    int writer_threads;
+    int writer_queue_size;
+    voice_detector_writer_t *writers;
+    // Encoder pool, 0 threads = MP3/OGG are encoded while they are written
+    int encoder_threads;
+    int encoder_queue_size;
+    voice_detector_queue_t *encoder_queue;   // Closed recordings waiting to be encoded
+    switch_thread_t **encoders;
+    volatile int encoders_running;
+    volatile int writers_running;
+    volatile switch_size_t recording_chunks_dropped;
+    // ASR streaming network threads
+    int stream_threads;
+    int stream_queue_size;
+    voice_detector_streamer_t *streamers;
+    volatile int streamers_running;
+    int stream_ws;   // libcurl can open ws:// URLs
+    int stream_wss;  // and wss:// URLs
+    volatile switch_size_t stream_chunks_dropped;
+    // Batched processing workers, 0 threads = detection on the media threads
+    int processing_threads;
+    int processing_queue_size;
+    int processing_batch;
+    int processing_affinity;
+    voice_detector_processor_t *processors;
+    volatile int processors_running;
+    volatile switch_size_t frames_dropped;
+    // Neural VAD inference workers, started when nn-model is set
+    char *nn_backend;
+    char *nn_model;
+    int nn_threads;
+    int nn_batch;
+    int nn_max_wait_ms;
+    int nn_queue_size;
+    voice_detector_nn_worker_t *nn_workers;
+    volatile int nn_running;
+    volatile switch_size_t nn_windows_skipped;
+    // Load shedding: sessions started above these limits get the cheap configuration, 0 = off
+    int overload_sessions;
+    float overload_idle_cpu;
+    int overload_analysis_time;
     int energy_threshold;
     int silence_threshold;
     int frame_size;
@@ -53,52 +472,194 @@ typedef struct {
     int max_silence_duration;
     int auto_record;
     int recording_format;
+    // Webhook dispatcher pool
+    int dispatcher_threads;
+    int event_queue_size;
+    int batch_max_events;      // 1 = one POST per event, >1 = JSON array per flush
+    int batch_max_latency_ms;
+    voice_detector_dispatcher_t *dispatchers;
+    volatile int running;
+    volatile switch_size_t events_dropped;
+    // Webhook spool, one journal per dispatcher, 0 events = off
+    char *spool_dir;
+    int spool_max_events;
+    int spool_retry_min_ms;
+    int spool_retry_max_ms;
+    // Webhook connection state, built once at config parse time
+    switch_curl_slist_t *http_headers;
+    CURLSH *curl_share;
+    switch_mutex_t *curl_share_locks[CURL_LOCK_DATA_LAST];
 } voice_detector_global_t;
 
-// Session-specific data structure
-typedef struct {
+// Session-specific data structure, recycled through the session slab
+typedef struct voice_detector_session_s {
+    struct voice_detector_session_s *next_free;  // Slab free list link
+    struct voice_detector_session_s *next_close; // Processor closing list link
+    switch_size_t close_after;                   // Queue position the worker must pass before the cleanup
     switch_core_session_t *session;
     switch_media_bug_t *bug;
-    switch_time_t last_voice_time;
-    switch_time_t last_api_call_time;
-    int voice_detected;
-    int silence_frames;
-    int total_frames;
-    char *uuid;
-    switch_memory_pool_t *pool;
+    voice_detector_processor_t *processor;  // Batched mode worker, NULL = inline
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
     // Recording specific fields
-    switch_record_session_t *record_session;
-    char *recording_file;
+    voice_detector_recording_t *recording;  // Handed to a writer thread, NULL when not recording
+    int recording_paused;                   // Speech mode: file open, nothing written between utterances
+    int segment_index;
+    uint64_t recorded_samples;
+    // ASR streaming: connection lives for the call, audio is only sent while the gate is open
+    voice_detector_stream_t *stream;
+    int stream_gate_open;
+    // Event sink: per-type CUSTOM events with the constant headers already set, duplicated on fire
+    switch_event_t *event_templates[VOICE_DETECTOR_EVENT_TYPES];
+    switch_bool_t record_write_stream;  // Direction that is recorded and buffered for pre-roll
+    voice_detector_ring_t preroll;      // Recent full-rate audio, only filled while not recording
+    uint32_t preroll_samples;           // Pre-roll length in stream samples, 0 = off
+    char recording_file[VOICE_DETECTOR_MAX_RECORDING_FILE];
     int is_recording;
     switch_time_t recording_start_time;
     switch_time_t recording_duration;
     // Runtime parameters
     voice_detector_runtime_params_t runtime_params;
-    // Advanced voice detection fields
-    int consecutive_hits;
-    int word_start_time;
-    int word_end_time;
-    int current_word_length;
-    int between_words_silence_frames;
-    int max_silence_frames;
+    // Timing of the monitored stream, the core may analyse it decimated
+    int stream_rate;
+    int stream_frame_samples;
+    // Detector state per direction: thresholds, hit counting and the word/silence state machine
+    voice_detector_core_t core[VOICE_DETECTOR_DIRECTIONS];
+    int monitored[VOICE_DETECTOR_DIRECTIONS];
+    int split_legs;  // leg=both: the bug returns stereo frames, split into one per direction
+    const voice_detector_g711_table_t *g711[VOICE_DETECTOR_DIRECTIONS];  // Native tap codec, NULL = detect on decoded frames
+    voice_detector_nn_channel_t *nn[VOICE_DETECTOR_DIRECTIONS];          // Neural VAD, NULL = the core classifies frames
+    int double_talk;  // Both directions in a voice period, leg=both only
+    volatile int finished;  // Analysis window over, the bug detaches on its next callback
+    // Bump arena for optional per-session state, returned to its size class with the session
+    char *arena;
+    int arena_class;  // -1 = no block, the session enables no optional state
+    switch_size_t arena_size;
+    switch_size_t arena_used;
 } voice_detector_session_t;
 
 // Function declarations
-static switch_status_t voice_detector_callback(switch_media_bug_t *bug, void *user_data, switch_frame_t *frame);
+static switch_status_t voice_detector_callback(switch_media_bug_t *bug, void *user_data, switch_frame_t *frame, switch_bool_t write_stream);
+static void voice_detector_bug_frame(switch_media_bug_t *bug, voice_detector_session_t *session_data, switch_frame_t *frame, switch_bool_t write_stream);
+static switch_bool_t voice_detector_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type);
+static void voice_detector_route_audio(voice_detector_session_t *session_data, const int16_t *audio_data, int samples, switch_bool_t write_stream);
+static void voice_detector_handle_events(voice_detector_session_t *session_data, switch_bool_t write_stream,
+                                         const voice_detector_core_event_t *events, int count);
+static void voice_detector_processor_push(voice_detector_session_t *session_data, int op, const void *data, int count, switch_bool_t write_stream,
+                                          int silent);
+static switch_media_bug_flag_t voice_detector_g711_setup(voice_detector_session_t *session_data);
+static voice_detector_nn_channel_t *voice_detector_nn_channel_create(voice_detector_session_t *session_data, int rate);
+static void voice_detector_nn_feed(voice_detector_session_t *session_data, int direction, const int16_t *pcm);
+static void voice_detector_nn_submit(voice_detector_nn_channel_t *channel);
+static void voice_detector_nn_run(voice_detector_nn_worker_t *worker, int count);
+static void *SWITCH_THREAD_FUNC voice_detector_nn_worker_thread(switch_thread_t *thread, void *obj);
+static switch_status_t voice_detector_nn_workers_start(void);
+static void voice_detector_nn_workers_stop(void);
+static int voice_detector_g711_process(voice_detector_session_t *session_data, const uint8_t *payload, int count, switch_bool_t write_stream,
+                                       uint64_t energy_sum, voice_detector_core_event_t *events);
+static void voice_detector_g711_frame(voice_detector_session_t *session_data, const switch_frame_t *frame, switch_bool_t write_stream);
+static void voice_detector_processor_close(voice_detector_session_t *session_data);
+static void voice_detector_processor_reap(voice_detector_processor_t *processor, int all);
+static switch_status_t voice_detector_processors_start(void);
+static void voice_detector_processors_stop(void);
+static void *SWITCH_THREAD_FUNC voice_detector_processor_thread(switch_thread_t *thread, void *obj);
+static void voice_detector_registry_init(switch_memory_pool_t *pool);
+static void voice_detector_registry_destroy(void);
+static switch_bool_t voice_detector_registry_contains(const char *uuid);
+static switch_bool_t voice_detector_registry_insert(voice_detector_session_t *session_data);
+static void voice_detector_registry_remove(voice_detector_session_t *session_data);
+static int voice_detector_registry_snapshot(voice_detector_registry_shard_t *shard, voice_detector_status_t **snapshot, int *snapshot_size);
 static switch_status_t voice_detector_session_cleanup(voice_detector_session_t *session_data);
-static switch_status_t voice_detector_api_call(const char *uuid, int voice_detected, int energy_level, const char *leg);
+static switch_status_t voice_detector_api_call(const char *uuid, int voice_detected, int energy_level, const char *leg, const char *recording_file,
+                                               int recording_encoded);
+static void voice_detector_encode(voice_detector_recording_t *recording);
+static void *SWITCH_THREAD_FUNC voice_detector_encoder_thread(switch_thread_t *thread, void *obj);
+static switch_status_t voice_detector_encoders_start(void);
+static void voice_detector_encoders_stop(void);
+static void voice_detector_subclasses_reserve(void);
+static void voice_detector_subclasses_free(void);
+static void voice_detector_emit(voice_detector_session_t *session_data, const char *leg, int type, int value);
+static void voice_detector_event_templates_create(voice_detector_session_t *session_data);
+static void voice_detector_event_templates_destroy(voice_detector_session_t *session_data);
+static void voice_detector_fire_event(voice_detector_session_t *session_data, const char *leg, int type, int value);
 static switch_status_t voice_detector_parse_config(switch_loadable_module_interface_t **mod_interface, switch_memory_pool_t *pool);
 static switch_status_t voice_detector_start_recording(voice_detector_session_t *session_data);
 static switch_status_t voice_detector_stop_recording(voice_detector_session_t *session_data);
-static switch_status_t voice_detector_get_recording_filename(voice_detector_session_t *session_data, char **filename);
+static void voice_detector_record_write(voice_detector_session_t *session_data, const int16_t *samples, uint32_t count);
+static void voice_detector_flush_preroll(voice_detector_session_t *session_data, switch_bool_t to_recording, switch_bool_t to_stream);
+static void voice_detector_segment_start(voice_detector_session_t *session_data);
+static void voice_detector_segment_end(voice_detector_session_t *session_data, switch_bool_t hangover);
+static switch_bool_t voice_detector_segment_idle(voice_detector_session_t *session_data);
+static void voice_detector_stream_open(voice_detector_session_t *session_data);
+static void voice_detector_stream_close(voice_detector_session_t *session_data);
+static switch_bool_t voice_detector_stream_push(voice_detector_stream_t *stream, int op, const int16_t *samples, uint32_t count);
+static void voice_detector_stream_teardown(voice_detector_streamer_t *streamer, voice_detector_stream_t *stream);
+static void voice_detector_streamer_reap(voice_detector_streamer_t *streamer, int all);
+static void voice_detector_stream_support(void);
+static int voice_detector_stream_supported(const char *url);
+static void voice_detector_stream_connect(voice_detector_stream_t *stream);
+static void voice_detector_stream_disconnect(voice_detector_stream_t *stream);
+static void voice_detector_stream_send(voice_detector_stream_t *stream);
+static void voice_detector_stream_audio(voice_detector_stream_t *stream, const int16_t *samples, uint32_t count);
+static void voice_detector_stream_receive(voice_detector_stream_t *stream);
+static void voice_detector_stream_result(voice_detector_stream_t *stream, const char *message);
+static switch_status_t voice_detector_streamers_start(void);
+static void voice_detector_streamers_stop(void);
+static void *SWITCH_THREAD_FUNC voice_detector_streamer_thread(switch_thread_t *thread, void *obj);
+static switch_bool_t voice_detector_writer_push(voice_detector_recording_t *recording, int op, const int16_t *samples, uint32_t count);
+static void voice_detector_writer_flush(voice_detector_recording_t *recording);
+static void voice_detector_writer_close(voice_detector_recording_t *recording);
+static void voice_detector_writer_reap(voice_detector_writer_t *writer, int all);
+static switch_status_t voice_detector_writers_start(void);
+static void voice_detector_writers_stop(void);
+static void *SWITCH_THREAD_FUNC voice_detector_writer_thread(switch_thread_t *thread, void *obj);
+static switch_size_t voice_detector_queue_depth(voice_detector_queue_t *queue);
+static switch_status_t voice_detector_get_recording_filename(voice_detector_session_t *session_data, char *filename, switch_size_t len);
 static switch_status_t voice_detector_parse_runtime_params(const char *data, voice_detector_runtime_params_t *params);
+static void voice_detector_runtime_params_defaults(voice_detector_runtime_params_t *params);
+static switch_status_t voice_detector_param_hash_init(void);
+static const voice_detector_param_def_t *voice_detector_param_lookup(const char *key);
+static switch_status_t voice_detector_set_param(voice_detector_runtime_params_t *params, const char *key, const char *value);
+static switch_status_t voice_detector_load_profiles(void);
+static void voice_detector_destroy_profiles(void);
+static switch_bool_t voice_detector_profile_get(const char *name, voice_detector_runtime_params_t *params);
 static switch_status_t voice_detector_apply_runtime_params(voice_detector_session_t *session_data, const voice_detector_runtime_params_t *params);
+static void voice_detector_core_setup(voice_detector_session_t *session_data, voice_detector_core_config_t *config, int direction);
+static voice_detector_session_t *voice_detector_session_alloc(void);
+static void voice_detector_session_release(voice_detector_session_t *session_data);
+static switch_size_t voice_detector_arena_need(voice_detector_session_t *session_data, const voice_detector_runtime_params_t *params);
+static void voice_detector_arena_reserve(voice_detector_session_t *session_data, switch_size_t size);
+static void *voice_detector_arena_alloc(voice_detector_session_t *session_data, switch_size_t size);
+static void voice_detector_init_timing(voice_detector_session_t *session_data, switch_bool_t write_stream);
 static switch_status_t voice_detector_app_function(switch_core_session_t *session, const char *data);
-static switch_status_t voice_detector_api_function(switch_core_session_t *session, const char *data, switch_io_data_stream_t *stream, switch_input_callback_t *write_callback);
-static switch_status_t voice_detector_event_hook(switch_event_t *event, void *user_data);
+static switch_status_t voice_detector_start_session(switch_core_session_t *session, const voice_detector_runtime_params_t *params);
+static switch_bool_t voice_detector_overloaded(void);
+static void voice_detector_degrade_params(voice_detector_runtime_params_t *params);
+static switch_status_t voice_detector_stop_session(switch_core_session_t *session, const char *uuid);
+static void voice_detector_api_bulk(switch_stream_handle_t *stream, switch_bool_t start, char *uuids, const char *data);
+static switch_status_t voice_detector_api_function(switch_core_session_t *session, const char *data, switch_stream_handle_t *stream, switch_input_callback_t *write_callback);
+static void voice_detector_event_hook(switch_event_t *event);
+static void voice_detector_metrics_export(switch_stream_handle_t *stream);
+static switch_size_t voice_detector_json_string(char *buf, switch_size_t pos, const char *str);
+static switch_size_t voice_detector_event_serialize(char *buf, switch_size_t pos, const voice_detector_event_t *event);
+static int voice_detector_event_valid(voice_detector_event_t *event);
+static switch_status_t voice_detector_http_post(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count);
+static void voice_detector_build_http_headers(void);
+static void voice_detector_curl_share_create(void);
+static switch_curl_handle_t *voice_detector_curl_handle_create(void);
+static switch_status_t voice_detector_dispatchers_start(void);
+static void voice_detector_dispatchers_stop(void);
+static void *SWITCH_THREAD_FUNC voice_detector_dispatcher_thread(switch_thread_t *thread, void *obj);
+static void voice_detector_dispatcher_spool(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count);
+static void voice_detector_dispatcher_backoff(voice_detector_dispatcher_t *dispatcher);
+static void voice_detector_dispatcher_deliver(voice_detector_dispatcher_t *dispatcher, const voice_detector_event_t *events, int count);
+static void voice_detector_dispatcher_replay(voice_detector_dispatcher_t *dispatcher);
+static voice_detector_queue_t *voice_detector_queue_create(switch_memory_pool_t *pool, switch_size_t capacity, switch_size_t elem_size);
+static switch_bool_t voice_detector_queue_push(voice_detector_queue_t *queue, const void *elem);
+static switch_bool_t voice_detector_queue_pop(voice_detector_queue_t *queue, void *elem);
+static uint32_t voice_detector_hash_uuid(const char *uuid);
 
 // Constants
-#define VOICE_DETECTOR_SYNTAX "<start|stop|status> [uuid]"
+#define VOICE_DETECTOR_SYNTAX "<start <uuid[,uuid...]> [params|profile=name]|stop <uuid[,uuid...]>|status|metrics>"
 #define DEFAULT_ENERGY_THRESHOLD 1000
 #define DEFAULT_SILENCE_THRESHOLD 100
 #define DEFAULT_FRAME_SIZE 160
@@ -107,34 +668,80 @@ static switch_status_t voice_detector_event_hook(switch_event_t *event, void *us
 #define DEFAULT_MAX_SILENCE_DURATION 2000
 #define DEFAULT_AUTO_RECORD 1
 #define DEFAULT_RECORDING_FORMAT 0
+#define DEFAULT_DISPATCHER_THREADS 2
+#define DEFAULT_EVENT_QUEUE_SIZE 4096
+#define DEFAULT_BATCH_MAX_EVENTS 1
+#define DEFAULT_BATCH_MAX_LATENCY_MS 50
+#define VOICE_DETECTOR_DISPATCHER_IDLE_US 5000
+// Events kept per dispatcher during an outage. A full spool evicts its oldest word and double-talk
+// events; voice, recording, AMD, beep and analysis events are never evicted, new ones are refused
+// (and counted) once the spool holds nothing else.
+#define DEFAULT_SPOOL_MAX_EVENTS 8192
+#define VOICE_DETECTOR_SPOOL_KEEP_PRIORITY 1  // Events at this priority are never evicted
+#define VOICE_DETECTOR_SPOOL_EVICT_DIV 16     // Evict at least capacity / 16 records per overflow
+#define DEFAULT_SPOOL_RETRY_MIN_MS 500
+#define DEFAULT_SPOOL_RETRY_MAX_MS 30000
+#define DEFAULT_WRITER_THREADS 1
+#define DEFAULT_WRITER_QUEUE_SIZE 4096
+#define DEFAULT_ENCODER_THREADS 0
+#define DEFAULT_ENCODER_QUEUE_SIZE 256
+#define DEFAULT_STREAM_THREADS 1
+#define DEFAULT_STREAM_QUEUE_SIZE 4096
+#define DEFAULT_PROCESSING_THREADS 0
+#define DEFAULT_PROCESSING_QUEUE_SIZE 2048
+#define DEFAULT_PROCESSING_BATCH 64
+#define DEFAULT_NN_BACKEND "gru"
+#define DEFAULT_NN_THREADS 1
+#define DEFAULT_NN_BATCH 64
+#define DEFAULT_NN_MAX_WAIT_MS 5
+#define DEFAULT_NN_QUEUE_SIZE 4096
+#define DEFAULT_NN_THRESHOLD 0.5f
+#define VOICE_DETECTOR_NN_HYSTERESIS 0.15f  // Probability drop below nn_threshold that ends a voiced run
+#define VOICE_DETECTOR_NN_IDLE_US 1000
+#define DEFAULT_OVERLOAD_ANALYSIS_TIME 2000
 
 // Runtime parameter defaults
 #define DEFAULT_SILENCE_MS 150
 #define DEFAULT_THRESHOLD 0.5f
 #define DEFAULT_HITS 2
-#define DEFAULT_TIMEOUT 2000
+#define DEFAULT_TIMEOUT 0
 #define DEFAULT_INTERRUPT_MS 50
 #define DEFAULT_RUNTIME_ENERGY_THRESHOLD 0.05f
-#define DEFAULT_TOTAL_ANALYSIS_TIME 4000
+#define DEFAULT_TOTAL_ANALYSIS_TIME 0
 #define DEFAULT_MIN_WORD_LENGTH 100
 #define DEFAULT_MAXIMUM_WORD_LENGTH 3500
 #define DEFAULT_BETWEEN_WORDS_SILENCE 50
 #define DEFAULT_MAX_SILENCE 2000
 #define DEFAULT_LEG "a"  // Default to leg A
+#define DEFAULT_SPECTRAL_FLATNESS 0.4f
+#define DEFAULT_SPECTRAL_BAND_RATIO 0.25f
+#define DEFAULT_SPECTRAL_ZCR 0.45f
+#define DEFAULT_NOISE_MARGIN 3.0f
+#define DEFAULT_NOISE_FLOOR_MIN 0.005f
+#define DEFAULT_PREROLL_MS 300
+#define DEFAULT_HANGOVER_MS 200
+#define DEFAULT_AMD_GREETING 1500
+#define DEFAULT_AMD_AFTER_GREETING_SILENCE 800
+#define DEFAULT_AMD_INITIAL_SILENCE 2500
+#define DEFAULT_AMD_MAX_WORDS 3
+#define DEFAULT_AMD_TOTAL_ANALYSIS_TIME 5000  // Used when total_analysis_time is unlimited
+#define DEFAULT_BEEP_MIN_LENGTH 160
+#define DEFAULT_BEEP_RATIO 0.6f
 
-// Event type constants
-#define VOICE_DETECTOR_EVENT_VOICE_START 1
-#define VOICE_DETECTOR_EVENT_VOICE_END 0
-#define VOICE_DETECTOR_EVENT_RECORDING_START 2
-#define VOICE_DETECTOR_EVENT_RECORDING_STOP 3
-#define VOICE_DETECTOR_EVENT_WORD_DETECTED 4
+// Recording modes: continuous from confirmation to max_silence, one file per utterance,
+// or one file holding only the speech
+#define VOICE_DETECTOR_RECORD_MODE_CONTINUOUS 0
+#define VOICE_DETECTOR_RECORD_MODE_SEGMENTS 1
+#define VOICE_DETECTOR_RECORD_MODE_SPEECH 2
+
+// Detector modes
+#define VOICE_DETECTOR_VAD_MODE_ENERGY 0
+#define VOICE_DETECTOR_VAD_MODE_SPECTRAL 1
+#define VOICE_DETECTOR_VAD_MODE_NN 2
 
 // Recording format constants
 #define RECORDING_FORMAT_WAV 0
 #define RECORDING_FORMAT_MP3 1
 #define RECORDING_FORMAT_OGG 2
 
-// Global configuration pointer
-extern voice_detector_global_t *globals;
-
 #endif // MOD_VOICE_DETECTOR_H
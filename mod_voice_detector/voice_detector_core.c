@@ -0,0 +1,363 @@
+#include <math.h>
+#include <string.h>
+
+#include "voice_detector_core.h"
+#include "voice_detector_energy.h"
+
+static int voice_detector_core_ms_to_samples(const voice_detector_core_t *core, int ms)
+{
+    return (int)((int64_t)ms * core->config.sample_rate / 1000);
+}
+
+// Effective threshold is noise floor x margin, never below noise_floor_min
+static void voice_detector_core_apply_noise_floor(voice_detector_core_t *core)
+{
+    uint64_t threshold = (core->noise_floor_sum * core->noise_margin_q8) >> 8;
+
+    core->threshold_sum = threshold > core->noise_floor_min_sum ? threshold : core->noise_floor_min_sum;
+}
+
+// Convert energy_threshold into a sum-of-squares threshold for frames of the given sample count.
+// sqrt(sum / samples) / 32768 > energy_threshold  <=>  sum > (energy_threshold * 32768)^2 * samples
+static void voice_detector_core_set_energy_threshold(voice_detector_core_t *core, int samples)
+{
+    double level = core->config.energy_threshold * 32768.0;
+    int previous_samples = core->threshold_samples;
+
+    core->threshold_samples = samples;
+    core->threshold_sum = level > 0 ? (uint64_t)(level * level * samples) : 0;
+
+    if (core->config.noise_floor) {
+        double margin = core->config.noise_margin;
+        double min_level = core->config.noise_floor_min * 32768.0;
+
+        core->noise_margin_q8 = margin > 0 ? (uint64_t)(margin * margin * 256) : 256;
+        core->noise_floor_min_sum = min_level > 0 ? (uint64_t)(min_level * min_level * samples) : 0;
+
+        if (previous_samples > 0) {
+            // Frame size changed, keep the tracked floor but rescale it to the new sample count
+            core->noise_floor_sum = core->noise_floor_sum * samples / previous_samples;
+        } else {
+            // Start from the configured threshold, the floor adapts from there
+            core->noise_floor_sum = (core->threshold_sum << 8) / core->noise_margin_q8;
+        }
+
+        voice_detector_core_apply_noise_floor(core);
+    }
+}
+
+// Track the channel's noise floor: an EMA over frames classified as silence, plus a slow
+// upward creep on loud frames outside of voice so noisy lines raise their own threshold
+static void voice_detector_core_update_noise_floor(voice_detector_core_t *core, uint64_t energy_sum, int frame_voiced)
+{
+    int64_t delta = (int64_t)energy_sum - (int64_t)core->noise_floor_sum;
+
+    if (!frame_voiced) {
+        core->noise_floor_sum += delta / VOICE_DETECTOR_NOISE_FLOOR_FAST_DIV;
+    } else if (!core->voice_detected) {
+        core->noise_floor_sum += delta / VOICE_DETECTOR_NOISE_FLOOR_SLOW_DIV;
+    } else {
+        return;
+    }
+
+    voice_detector_core_apply_noise_floor(core);
+}
+
+// Spectral check for a frame that already passed the energy gate: speech has most of its
+// power in the voice band, a non-flat spectrum and a moderate zero-crossing rate
+static int voice_detector_core_spectral_is_voice(voice_detector_core_t *core, const int16_t *audio, int samples)
+{
+    voice_detector_spectral_features_t features;
+
+    if (samples != core->spectral->frame_samples) {
+        voice_detector_spectral_configure(core->spectral, core->spectral->sample_rate, samples);
+    }
+
+    voice_detector_spectral_analyze(core->spectral, audio, samples, &features);
+
+    return features.band_ratio >= core->config.spectral_band_ratio &&
+           features.flatness <= core->config.spectral_flatness &&
+           features.zcr <= core->config.spectral_zcr;
+}
+
+static int voice_detector_core_debounced(voice_detector_core_t *core)
+{
+    if ((int64_t)core->position - core->last_report > core->debounce_samples) {
+        core->last_report = (int64_t)core->position;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Greeting heuristic, run once per frame until it decides: a short greeting followed by silence
+// is a person answering, a long or wordy greeting, a beep or silence from the start is a machine
+static int voice_detector_core_amd(voice_detector_core_t *core, int frame_voiced, int beep, int samples)
+{
+    int64_t end = (int64_t)core->position + samples;
+
+    if (beep) {
+        return VOICE_DETECTOR_AMD_MACHINE;
+    }
+
+    if (core->amd_greeting_start < 0) {
+        if (!core->voice_detected) {
+            return end > core->amd_initial_silence_samples ? VOICE_DETECTOR_AMD_MACHINE : 0;
+        }
+        // The greeting starts where the voice that was just confirmed began
+        core->amd_greeting_start = (int64_t)core->word_start;
+        core->amd_last_voiced = end;
+    } else if (frame_voiced) {
+        core->amd_last_voiced = end;
+    }
+
+    if (core->amd_last_voiced - core->amd_greeting_start > core->amd_greeting_samples ||
+        core->amd_words >= core->config.amd_max_words) {
+        return VOICE_DETECTOR_AMD_MACHINE;
+    }
+    if (end - core->amd_last_voiced >= core->amd_after_greeting_silence_samples) {
+        return VOICE_DETECTOR_AMD_HUMAN;
+    }
+
+    return end > core->amd_total_analysis_samples ? VOICE_DETECTOR_AMD_NOTSURE : 0;
+}
+
+int voice_detector_core_energy_level(uint64_t energy_sum, int samples)
+{
+    return (int)(sqrt((double)energy_sum / samples) / 32768.0 * 1000);
+}
+
+void voice_detector_core_init(voice_detector_core_t *core, const voice_detector_core_config_t *config,
+                              voice_detector_decimator_t *decimator, int16_t *analysis_buffer, voice_detector_spectral_t *spectral,
+                              voice_detector_tone_t *tone)
+{
+    memset(core, 0, sizeof(*core));
+    core->config = *config;
+    core->decimator = decimator;
+    core->analysis_buffer = analysis_buffer;
+    core->spectral = spectral;
+    core->tone = tone;
+
+    core->min_word_samples = voice_detector_core_ms_to_samples(core, config->min_word_length);
+    core->maximum_word_samples = voice_detector_core_ms_to_samples(core, config->maximum_word_length);
+    core->between_words_silence_samples = voice_detector_core_ms_to_samples(core, config->between_words_silence);
+    core->max_silence_samples = voice_detector_core_ms_to_samples(core, config->max_silence);
+    core->hangover_samples = voice_detector_core_ms_to_samples(core, config->hangover_ms);
+    core->debounce_samples = voice_detector_core_ms_to_samples(core, config->debounce_ms);
+    core->last_report = -core->debounce_samples - 1;
+    core->analysis_samples = voice_detector_core_ms_to_samples(core, config->analysis_time);
+    core->timeout_samples = voice_detector_core_ms_to_samples(core, config->timeout);
+    core->amd_greeting_samples = voice_detector_core_ms_to_samples(core, config->amd_greeting);
+    core->amd_after_greeting_silence_samples = voice_detector_core_ms_to_samples(core, config->amd_after_greeting_silence);
+    core->amd_initial_silence_samples = voice_detector_core_ms_to_samples(core, config->amd_initial_silence);
+    core->amd_total_analysis_samples = voice_detector_core_ms_to_samples(core, config->amd_total_analysis_time);
+    core->amd_greeting_start = -1;
+
+    // Precompute the integer energy threshold for the expected frame size
+    voice_detector_core_set_energy_threshold(core, config->frame_samples);
+
+    // Window and FFT tables are sized once here, not per frame
+    if (spectral) {
+        voice_detector_spectral_configure(spectral, config->sample_rate, config->frame_samples);
+    }
+    if (tone && voice_detector_tone_configure(tone, config->sample_rate, config->beep_min_length, config->beep_ratio)) {
+        core->tone = NULL;
+    }
+}
+
+// Word/silence state machine, AMD and the analysis window for one classified frame
+static int voice_detector_core_advance(voice_detector_core_t *core, int samples, uint64_t energy_sum, int frame_voiced, int beep,
+                                       voice_detector_core_event_t *events)
+{
+    int count = 0;
+
+    core->total_frames++;
+    core->last_frame_samples = samples;
+
+    if (frame_voiced) {
+        if (!core->voice_detected) {
+            core->consecutive_hits++;
+
+            // Reported on the first voiced frame, before confirmation
+            if (voice_detector_core_debounced(core)) {
+                events[count].type = VOICE_DETECTOR_CORE_VOICE_START;
+                events[count++].value = voice_detector_core_energy_level(energy_sum, samples);
+            }
+
+            // Voice is confirmed after consecutive hits
+            if (core->consecutive_hits >= core->config.hits) {
+                core->voice_detected = 1;
+                core->voice_starts++;
+                core->silence_frames = 0;
+                core->silence_samples = 0;
+                core->word_start = core->position;
+                core->current_word_samples = 0;
+                core->segment_open = 1;
+                core->segment_hits = 0;
+                events[count].type = VOICE_DETECTOR_CORE_SEGMENT_START;
+                events[count++].value = 0;
+            }
+        } else {
+            // Voice is continuing
+            core->consecutive_hits = 0;
+            core->silence_samples = 0;
+            core->current_word_samples += samples;
+
+            // Speech after a segment end needs the same hits to start the next one
+            if (!core->segment_open && ++core->segment_hits >= core->config.hits) {
+                core->segment_open = 1;
+                core->segment_hits = 0;
+                events[count].type = VOICE_DETECTOR_CORE_SEGMENT_START;
+                events[count++].value = 1;
+            }
+
+            // Word too long, might be noise - reset
+            if (core->current_word_samples > core->maximum_word_samples) {
+                core->voice_detected = 0;
+                core->false_starts++;
+                core->consecutive_hits = 0;
+                core->segment_open = 0;
+                events[count].type = VOICE_DETECTOR_CORE_FALSE_START;
+                events[count++].value = 0;
+            }
+        }
+    } else if (core->voice_detected) {
+        core->silence_frames++;
+        core->silence_samples += samples;
+        core->consecutive_hits = 0;
+        core->segment_hits = 0;
+
+        // The segment ends once the hangover has passed
+        if (core->segment_open && core->silence_samples > core->hangover_samples) {
+            core->segment_open = 0;
+            events[count].type = VOICE_DETECTOR_CORE_SEGMENT_END;
+            events[count++].value = 0;
+        }
+
+        if (core->silence_samples > core->max_silence_samples) {
+            // Long silence - voice over
+            core->voice_detected = 0;
+            core->segment_open = 0;
+            events[count].type = VOICE_DETECTOR_CORE_SILENCE_TIMEOUT;
+            events[count++].value = 0;
+
+            if (voice_detector_core_debounced(core)) {
+                events[count].type = VOICE_DETECTOR_CORE_VOICE_END;
+                events[count++].value = voice_detector_core_energy_level(energy_sum, samples);
+            }
+        } else if (core->silence_samples > core->between_words_silence_samples &&
+                   core->current_word_samples >= core->min_word_samples) {
+            // Short silence between words ends a word of valid length
+            events[count].type = VOICE_DETECTOR_CORE_WORD;
+            events[count++].value = (int)((core->position - core->word_start) / core->config.sample_rate);
+            core->word_start = core->position;
+            core->current_word_samples = 0;
+            core->amd_words++;
+        }
+    }
+
+    if (beep) {
+        events[count].type = VOICE_DETECTOR_CORE_BEEP;
+        events[count++].value = beep;
+    }
+    if (core->config.amd && !core->amd_result && (core->amd_result = voice_detector_core_amd(core, frame_voiced, beep, samples))) {
+        events[count].type = VOICE_DETECTOR_CORE_AMD;
+        events[count++].value = core->amd_result;
+    }
+
+    core->position += samples;
+
+    // Past the analysis window, or no voice within the timeout: the last event this core reports
+    if (core->analysis_samples && (int64_t)core->position >= core->analysis_samples) {
+        core->finished = VOICE_DETECTOR_FINISHED_ANALYSIS_TIME;
+    } else if (core->timeout_samples && !core->voice_starts && (int64_t)core->position >= core->timeout_samples) {
+        core->finished = VOICE_DETECTOR_FINISHED_TIMEOUT;
+    }
+    if (core->finished) {
+        events[count].type = VOICE_DETECTOR_CORE_FINISHED;
+        events[count++].value = core->finished;
+    }
+
+    return count;
+}
+
+int voice_detector_core_process_frame(voice_detector_core_t *core, const int16_t *pcm, int samples, voice_detector_core_event_t *events)
+{
+    if (core->finished) {
+        return 0;
+    }
+
+    // Bring wideband frames down to the analysis rate, everything below works on the decimated samples
+    if (core->decimator) {
+        if (samples > VOICE_DETECTOR_DECIMATOR_MAX_INPUT) {
+            samples = VOICE_DETECTOR_DECIMATOR_MAX_INPUT;
+        }
+        samples = voice_detector_decimator_process(core->decimator, pcm, samples, core->analysis_buffer);
+        pcm = core->analysis_buffer;
+    }
+    if (samples <= 0) {
+        return 0;
+    }
+
+    // Frame energy as an integer sum of squares, compared without sqrt or float math
+    return voice_detector_core_process_energy(core, pcm, samples, voice_detector_energy_sum_squares(pcm, samples), events);
+}
+
+int voice_detector_core_process_energy(voice_detector_core_t *core, const int16_t *pcm, int samples, uint64_t energy_sum,
+                                       voice_detector_core_event_t *events)
+{
+    int frame_loud, frame_voiced;
+    int beep = 0;
+
+    if (core->finished) {
+        return 0;
+    }
+
+    if (samples != core->threshold_samples) {
+        voice_detector_core_set_energy_threshold(core, samples);
+    }
+    frame_loud = energy_sum > core->threshold_sum;
+    frame_voiced = core->config.external_vad ? core->external_voiced : frame_loud;
+
+    // Beeps are looked for behind the energy gate only, the spectral check would reject a pure tone
+    if (core->tone) {
+        if (frame_loud) {
+            beep = voice_detector_tone_process(core->tone, pcm, samples, energy_sum);
+        } else {
+            voice_detector_tone_reset(core->tone);
+        }
+    }
+
+    // Spectral mode only analyses frames loud enough to be voice
+    if (frame_voiced && core->spectral) {
+        frame_voiced = voice_detector_core_spectral_is_voice(core, pcm, samples);
+    }
+
+    // Adaptive threshold: the next frame is compared against the updated noise floor
+    if (core->config.noise_floor) {
+        voice_detector_core_update_noise_floor(core, energy_sum, frame_voiced);
+    }
+
+    return voice_detector_core_advance(core, samples, energy_sum, frame_voiced, beep, events);
+}
+
+int voice_detector_core_process_silence(voice_detector_core_t *core, int samples, voice_detector_core_event_t *events)
+{
+    if (core->finished) {
+        return 0;
+    }
+
+    // Same analysis-rate duration the decimator would have produced
+    if (core->decimator && core->decimator->factor > 1) {
+        samples /= core->decimator->factor;
+    }
+    if (samples <= 0) {
+        return 0;
+    }
+
+    if (core->tone) {
+        voice_detector_tone_reset(core->tone);
+    }
+
+    return voice_detector_core_advance(core, samples, 0, 0, 0, events);
+}
@@ -0,0 +1,153 @@
+#ifndef VOICE_DETECTOR_CORE_H
+#define VOICE_DETECTOR_CORE_H
+
+#include <stdint.h>
+
+#include "voice_detector_decimator.h"
+#include "voice_detector_spectral.h"
+#include "voice_detector_tone.h"
+
+// Detector core: frame energy, noise floor, hit counting and the word/silence state machine.
+// Pure computation over caller-owned state, it never allocates, does I/O or reads a clock.
+// Time is counted in analysis samples, so replaying a recording gives the live results.
+#define VOICE_DETECTOR_CORE_MAX_EVENTS 6
+#define VOICE_DETECTOR_NOISE_FLOOR_FAST_DIV 8     // ~160 ms at 20 ms frames
+#define VOICE_DETECTOR_NOISE_FLOOR_SLOW_DIV 128   // ~2.5 s at 20 ms frames
+
+// Answering machine detection results, the value of a VOICE_DETECTOR_CORE_AMD event
+#define VOICE_DETECTOR_AMD_HUMAN 1
+#define VOICE_DETECTOR_AMD_MACHINE 2
+#define VOICE_DETECTOR_AMD_NOTSURE 3
+
+// Why the core stopped analysing, the value of a VOICE_DETECTOR_CORE_FINISHED event
+#define VOICE_DETECTOR_FINISHED_ANALYSIS_TIME 1
+#define VOICE_DETECTOR_FINISHED_TIMEOUT 2
+
+typedef enum {
+    VOICE_DETECTOR_CORE_VOICE_START,      // Voiced frame before confirmation, debounced, value = energy level
+    VOICE_DETECTOR_CORE_SEGMENT_START,    // Voice confirmed (value 0), or speech resumed after a segment end (value 1)
+    VOICE_DETECTOR_CORE_SEGMENT_END,      // Hangover passed, voice continues until max_silence
+    VOICE_DETECTOR_CORE_FALSE_START,      // Word longer than maximum_word_length, voice reset
+    VOICE_DETECTOR_CORE_SILENCE_TIMEOUT,  // max_silence reached, voice over
+    VOICE_DETECTOR_CORE_VOICE_END,        // Follows SILENCE_TIMEOUT when not debounced, value = energy level
+    VOICE_DETECTOR_CORE_WORD,             // Word ended, value = duration in seconds
+    VOICE_DETECTOR_CORE_BEEP,             // Steady tone in the beep range, value = frequency in Hz
+    VOICE_DETECTOR_CORE_AMD,              // Answering machine decision, once, value = VOICE_DETECTOR_AMD_*
+    VOICE_DETECTOR_CORE_FINISHED          // Analysis window over, later frames are ignored, value = VOICE_DETECTOR_FINISHED_*
+} voice_detector_core_event_type_t;
+
+typedef struct {
+    voice_detector_core_event_type_t type;
+    int value;
+} voice_detector_core_event_t;
+
+// Detection settings, times in milliseconds like the runtime parameters
+typedef struct {
+    int sample_rate;   // Analysis rate, after decimation
+    int frame_samples; // Expected analysis frame size
+    int hits;
+    int debounce_ms;
+    int min_word_length;
+    int maximum_word_length;
+    int between_words_silence;
+    int max_silence;
+    int hangover_ms;
+    float energy_threshold;
+    int noise_floor;
+    float noise_margin;
+    float noise_floor_min;
+    float spectral_flatness;
+    float spectral_band_ratio;
+    float spectral_zcr;
+    // Voicing decided outside the core (neural VAD), taken from external_voiced instead of the energy gate
+    int external_vad;
+    // Analysis window, 0 = unlimited
+    int analysis_time;    // Total time analysed
+    int timeout;          // Time allowed before the first confirmed voice
+    // Answering machine detection from the greeting, 0 = off
+    int amd;
+    int amd_greeting;                // Longer first utterance = machine
+    int amd_after_greeting_silence;  // Silence after a short greeting = human
+    int amd_initial_silence;         // Nothing said for this long = machine
+    int amd_max_words;               // This many words in the greeting = machine
+    int amd_total_analysis_time;     // Undecided after this long = not sure
+    // Tone stage, used when a tone state is given
+    int beep_min_length;
+    float beep_ratio;
+} voice_detector_core_config_t;
+
+typedef struct {
+    voice_detector_core_config_t config;
+    // Optional stages over caller-provided storage, NULL = off
+    voice_detector_decimator_t *decimator;
+    int16_t *analysis_buffer;  // VOICE_DETECTOR_DECIMATOR_MAX_INPUT / 2 + 1 samples
+    voice_detector_spectral_t *spectral;
+    voice_detector_tone_t *tone;
+    // Durations in analysis samples
+    int min_word_samples;
+    int maximum_word_samples;
+    int between_words_silence_samples;
+    int max_silence_samples;
+    int hangover_samples;
+    int64_t debounce_samples;
+    int64_t analysis_samples;
+    int64_t timeout_samples;
+    int64_t amd_greeting_samples;
+    int64_t amd_after_greeting_silence_samples;
+    int64_t amd_initial_silence_samples;
+    int64_t amd_total_analysis_samples;
+    // Integer energy threshold, valid for frames of threshold_samples samples
+    int threshold_samples;
+    uint64_t threshold_sum;
+    // Adaptive noise floor, in the same sum-of-squares domain as threshold_sum
+    uint64_t noise_floor_sum;
+    uint64_t noise_floor_min_sum;
+    uint64_t noise_margin_q8;  // margin^2 in Q8
+    // State machine
+    uint64_t position;      // Analysis samples processed
+    int64_t last_report;    // Position of the last debounced event
+    uint64_t word_start;
+    int voice_detected;
+    int consecutive_hits;
+    int segment_open;
+    int segment_hits;       // Voiced frames towards resuming a segment
+    int silence_frames;
+    int silence_samples;
+    int current_word_samples;
+    int finished;
+    int external_voiced;     // Set by the caller before each frame when config.external_vad is on
+    int last_frame_samples;  // Analysis samples of the last frame, in analysis_buffer when decimating
+    // Greeting analysis, positions in analysis samples
+    int amd_result;              // VOICE_DETECTOR_AMD_*, 0 = undecided
+    int64_t amd_greeting_start;  // -1 until the first voice is confirmed
+    int64_t amd_last_voiced;     // End of the last voiced frame of the greeting
+    int amd_words;
+    // Counters, written by the processing thread only
+    uint32_t total_frames;
+    uint32_t voice_starts;
+    uint32_t false_starts;
+} voice_detector_core_t;
+
+// Reset the state and derive sample counts and thresholds from config. The decimator, spectral
+// and tone state must already be allocated (and the decimator configured) by the caller.
+void voice_detector_core_init(voice_detector_core_t *core, const voice_detector_core_config_t *config,
+                              voice_detector_decimator_t *decimator, int16_t *analysis_buffer, voice_detector_spectral_t *spectral,
+                              voice_detector_tone_t *tone);
+
+// Run one frame of stream-rate PCM, writes up to VOICE_DETECTOR_CORE_MAX_EVENTS and returns their number.
+// Once the core has finished, frames are ignored without being analysed.
+int voice_detector_core_process_frame(voice_detector_core_t *core, const int16_t *pcm, int samples, voice_detector_core_event_t *events);
+
+// Second half of process_frame for callers that computed the frame energy themselves, e.g. over a
+// batch of channels. Only valid without a decimator, pcm is then the analysis frame.
+int voice_detector_core_process_energy(voice_detector_core_t *core, const int16_t *pcm, int samples, uint64_t energy_sum,
+                                       voice_detector_core_event_t *events);
+
+// Stream-rate frame the caller knows is silence (comfort noise, DTX, digital silence): advances
+// the state machine as an unvoiced frame without reading samples or moving the noise floor.
+int voice_detector_core_process_silence(voice_detector_core_t *core, int samples, voice_detector_core_event_t *events);
+
+// Normalized energy (0-1000) of a frame
+int voice_detector_core_energy_level(uint64_t energy_sum, int samples);
+
+#endif // VOICE_DETECTOR_CORE_H
@@ -0,0 +1,102 @@
+#include <math.h>
+#include <string.h>
+
+#include "voice_detector_decimator.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int16_t decimator_coeffs[VOICE_DETECTOR_DECIMATOR_MAX_FACTOR + 1][VOICE_DETECTOR_DECIMATOR_MAX_TAPS];
+
+// Hamming-windowed sinc low-pass at 90% of the output Nyquist, normalized to unity DC gain in Q15
+static void voice_detector_decimator_design(int factor, int16_t *coeffs)
+{
+    int taps = factor * VOICE_DETECTOR_DECIMATOR_TAPS_PER_PHASE;
+    double h[VOICE_DETECTOR_DECIMATOR_MAX_TAPS];
+    double cutoff = 0.9 / (2.0 * factor);
+    double center = (taps - 1) / 2.0;
+    double sum = 0;
+    int total = 0;
+    int k;
+
+    for (k = 0; k < taps; k++) {
+        double x = k - center;
+        double sinc = fabs(x) < 1e-9 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+        h[k] = sinc * (0.54 - 0.46 * cos(2.0 * M_PI * k / (taps - 1)));
+        sum += h[k];
+    }
+
+    for (k = 0; k < taps; k++) {
+        coeffs[k] = (int16_t)lrint(h[k] / sum * 32768.0);
+        total += coeffs[k];
+    }
+
+    // Put the rounding error on the center tap so the DC gain is exactly 1.0
+    coeffs[taps / 2] += (int16_t)(32768 - total);
+}
+
+void voice_detector_decimator_init(void)
+{
+    int factor;
+
+    for (factor = 2; factor <= VOICE_DETECTOR_DECIMATOR_MAX_FACTOR; factor++) {
+        voice_detector_decimator_design(factor, decimator_coeffs[factor]);
+    }
+}
+
+int voice_detector_decimator_configure(voice_detector_decimator_t *decimator, int in_rate, int out_rate)
+{
+    int factor;
+
+    if (in_rate <= 0 || out_rate <= 0 || in_rate % out_rate) {
+        return 0;
+    }
+
+    factor = in_rate / out_rate;
+    if (factor < 2 || factor > VOICE_DETECTOR_DECIMATOR_MAX_FACTOR) {
+        return 0;
+    }
+
+    decimator->factor = factor;
+    decimator->taps = factor * VOICE_DETECTOR_DECIMATOR_TAPS_PER_PHASE;
+    decimator->phase = 0;
+    decimator->coeffs = decimator_coeffs[factor];
+    memset(decimator->buffer, 0, sizeof(decimator->buffer));
+
+    return factor;
+}
+
+int voice_detector_decimator_process(voice_detector_decimator_t *decimator, const int16_t *in, int count, int16_t *out)
+{
+    const int history = decimator->taps - 1;
+    int produced = 0;
+    int chunk, i, k;
+
+    while (count > 0) {
+        chunk = count < VOICE_DETECTOR_DECIMATOR_MAX_INPUT ? count : VOICE_DETECTOR_DECIMATOR_MAX_INPUT;
+        memcpy(decimator->buffer + history, in, sizeof(int16_t) * chunk);
+
+        for (i = 0; i < chunk; i++) {
+            if (++decimator->phase < decimator->factor) {
+                continue;
+            }
+            decimator->phase = 0;
+
+            // x[0] is the newest sample, x[-k] the older ones
+            const int16_t *x = decimator->buffer + history + i;
+            int64_t acc = 1 << 14;
+            for (k = 0; k < decimator->taps; k++) {
+                acc += (int32_t)decimator->coeffs[k] * x[-k];
+            }
+            acc >>= 15;
+            out[produced++] = (int16_t)(acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc);
+        }
+
+        memmove(decimator->buffer, decimator->buffer + chunk, sizeof(int16_t) * history);
+        in += chunk;
+        count -= chunk;
+    }
+
+    return produced;
+}
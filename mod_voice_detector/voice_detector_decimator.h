@@ -0,0 +1,31 @@
+#ifndef VOICE_DETECTOR_DECIMATOR_H
+#define VOICE_DETECTOR_DECIMATOR_H
+
+#include <stdint.h>
+
+// Integer-factor polyphase decimator used to analyse wideband legs at a lower rate.
+// Only every factor-th output of the low-pass FIR is computed. Coefficient tables are
+// shared (built once), the per-session state holds just the filter history.
+#define VOICE_DETECTOR_DECIMATOR_MAX_FACTOR 6
+#define VOICE_DETECTOR_DECIMATOR_TAPS_PER_PHASE 8
+#define VOICE_DETECTOR_DECIMATOR_MAX_TAPS (VOICE_DETECTOR_DECIMATOR_MAX_FACTOR * VOICE_DETECTOR_DECIMATOR_TAPS_PER_PHASE)
+#define VOICE_DETECTOR_DECIMATOR_MAX_INPUT 2880  // 60 ms at 48 kHz, longer frames are processed in chunks
+
+typedef struct {
+    int factor;
+    int taps;
+    int phase;
+    const int16_t *coeffs;  // Q15
+    int16_t buffer[VOICE_DETECTOR_DECIMATOR_MAX_TAPS + VOICE_DETECTOR_DECIMATOR_MAX_INPUT];
+} voice_detector_decimator_t;
+
+// Build the low-pass tables for every supported factor, call once before use
+void voice_detector_decimator_init(void);
+
+// Set up decimation from in_rate to out_rate, returns the factor or 0 if the ratio is unsupported
+int voice_detector_decimator_configure(voice_detector_decimator_t *decimator, int in_rate, int out_rate);
+
+// Decimate count input samples into out, returns the number of output samples
+int voice_detector_decimator_process(voice_detector_decimator_t *decimator, const int16_t *in, int count, int16_t *out);
+
+#endif // VOICE_DETECTOR_DECIMATOR_H
@@ -0,0 +1,127 @@
+#include "voice_detector_energy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOICE_DETECTOR_ENERGY_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VOICE_DETECTOR_ENERGY_NEON 1
+#endif
+
+voice_detector_energy_func_t voice_detector_energy_sum_squares = voice_detector_energy_sum_squares_scalar;
+
+// Reference implementation
+uint64_t voice_detector_energy_sum_squares_scalar(const int16_t *samples, size_t count)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int32_t s = samples[i];
+        sum += (uint32_t)(s * s);
+    }
+
+    return sum;
+}
+
+int voice_detector_energy_is_zero(const int16_t *samples, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (samples[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef VOICE_DETECTOR_ENERGY_X86
+
+// madd_epi16 yields the sum of two squares per 32-bit lane. That is at most 2^31,
+// so lanes are treated as unsigned and zero-extended into 64-bit accumulators.
+#ifdef __SSE2__
+static uint64_t voice_detector_energy_sum_squares_sse2(const int16_t *samples, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    uint64_t lanes[2];
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, acc);
+
+    return lanes[0] + lanes[1] + voice_detector_energy_sum_squares_scalar(samples + i, count - i);
+}
+#endif
+
+__attribute__((target("avx2")))
+static uint64_t voice_detector_energy_sum_squares_avx2(const int16_t *samples, size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + i));
+        __m256i sq = _mm256_madd_epi16(v, v);
+        acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+        acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + voice_detector_energy_sum_squares_scalar(samples + i, count - i);
+}
+
+#endif // VOICE_DETECTOR_ENERGY_X86
+
+#ifdef VOICE_DETECTOR_ENERGY_NEON
+
+// vmull_s16 squares fit in int32 (at most 2^30), pairwise-accumulated into int64 lanes
+static uint64_t voice_detector_energy_sum_squares_neon(const int16_t *samples, size_t count)
+{
+    int64x2_t acc = vdupq_n_s64(0);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        int16x4_t lo = vget_low_s16(v);
+        int16x4_t hi = vget_high_s16(v);
+        acc = vpadalq_s32(acc, vmull_s16(lo, lo));
+        acc = vpadalq_s32(acc, vmull_s16(hi, hi));
+    }
+
+    return (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1)) + voice_detector_energy_sum_squares_scalar(samples + i, count - i);
+}
+
+#endif // VOICE_DETECTOR_ENERGY_NEON
+
+const char *voice_detector_energy_init(void)
+{
+#ifdef VOICE_DETECTOR_ENERGY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        voice_detector_energy_sum_squares = voice_detector_energy_sum_squares_avx2;
+        return "avx2";
+    }
+#ifdef __SSE2__
+    voice_detector_energy_sum_squares = voice_detector_energy_sum_squares_sse2;
+    return "sse2";
+#endif
+#elif defined(VOICE_DETECTOR_ENERGY_NEON)
+    voice_detector_energy_sum_squares = voice_detector_energy_sum_squares_neon;
+    return "neon";
+#endif
+
+    voice_detector_energy_sum_squares = voice_detector_energy_sum_squares_scalar;
+    return "scalar";
+}
@@ -0,0 +1,22 @@
+#ifndef VOICE_DETECTOR_ENERGY_H
+#define VOICE_DETECTOR_ENERGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame energy kernels: sum of squared int16 samples, exact in 64 bits.
+// The scalar version is the reference, SIMD versions must return the same value.
+typedef uint64_t (*voice_detector_energy_func_t)(const int16_t *samples, size_t count);
+
+// Kernel selected by voice_detector_energy_init(), scalar until then
+extern voice_detector_energy_func_t voice_detector_energy_sum_squares;
+
+// Pick the best kernel for this CPU, returns its name for logging
+const char *voice_detector_energy_init(void);
+
+uint64_t voice_detector_energy_sum_squares_scalar(const int16_t *samples, size_t count);
+
+// Digital silence check, stops at the first non-zero sample so voiced frames cost almost nothing
+int voice_detector_energy_is_zero(const int16_t *samples, size_t count);
+
+#endif // VOICE_DETECTOR_ENERGY_H
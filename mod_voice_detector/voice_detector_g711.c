@@ -0,0 +1,84 @@
+#include <strings.h>
+
+#include "voice_detector_g711.h"
+
+voice_detector_g711_table_t voice_detector_g711_ulaw;
+voice_detector_g711_table_t voice_detector_g711_alaw;
+
+// ITU-T G.711 expansion, the same values as the codec module's decoder
+static int16_t voice_detector_g711_ulaw_to_linear(uint8_t code)
+{
+    int t;
+
+    code = (uint8_t)~code;
+    t = (((code & 0x0f) << 3) + 0x84) << ((code & 0x70) >> 4);
+
+    return (int16_t)((code & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static int16_t voice_detector_g711_alaw_to_linear(uint8_t code)
+{
+    int seg, t;
+
+    code ^= 0x55;
+    t = (code & 0x0f) << 4;
+    seg = (code & 0x70) >> 4;
+    if (seg) {
+        t = (t + 0x108) << (seg - 1);
+    } else {
+        t += 8;
+    }
+
+    return (int16_t)((code & 0x80) ? t : -t);
+}
+
+void voice_detector_g711_init(void)
+{
+    int code;
+
+    for (code = 0; code < 256; code++) {
+        int32_t u = voice_detector_g711_ulaw_to_linear((uint8_t)code);
+        int32_t a = voice_detector_g711_alaw_to_linear((uint8_t)code);
+
+        voice_detector_g711_ulaw.linear[code] = (int16_t)u;
+        voice_detector_g711_ulaw.squares[code] = (uint32_t)(u * u);
+        voice_detector_g711_alaw.linear[code] = (int16_t)a;
+        voice_detector_g711_alaw.squares[code] = (uint32_t)(a * a);
+    }
+}
+
+const voice_detector_g711_table_t *voice_detector_g711_table(const char *iananame)
+{
+    if (!iananame) {
+        return NULL;
+    }
+    if (!strcasecmp(iananame, "PCMU")) {
+        return &voice_detector_g711_ulaw;
+    }
+    if (!strcasecmp(iananame, "PCMA")) {
+        return &voice_detector_g711_alaw;
+    }
+
+    return NULL;
+}
+
+uint64_t voice_detector_g711_sum_squares(const voice_detector_g711_table_t *table, const uint8_t *payload, size_t count)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        sum += table->squares[payload[i]];
+    }
+
+    return sum;
+}
+
+void voice_detector_g711_decode(const voice_detector_g711_table_t *table, const uint8_t *payload, size_t count, int16_t *out)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        out[i] = table->linear[payload[i]];
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef VOICE_DETECTOR_G711_H
+#define VOICE_DETECTOR_G711_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame energy straight from G.711 payload bytes. Each table maps a code to the linear sample
+// the standard decoder produces and to its square, so the sum matches the decoded frame's
+// voice_detector_energy_sum_squares exactly, without decoding or multiplying.
+typedef struct {
+    int16_t linear[256];
+    uint32_t squares[256];
+} voice_detector_g711_table_t;
+
+extern voice_detector_g711_table_t voice_detector_g711_ulaw;  // PCMU
+extern voice_detector_g711_table_t voice_detector_g711_alaw;  // PCMA
+
+// Build both tables, call once before use
+void voice_detector_g711_init(void);
+
+// Table for an RTP encoding name, NULL if it is not G.711
+const voice_detector_g711_table_t *voice_detector_g711_table(const char *iananame);
+
+// Sum of squared decoded samples of count payload bytes
+uint64_t voice_detector_g711_sum_squares(const voice_detector_g711_table_t *table, const uint8_t *payload, size_t count);
+
+// Decode count payload bytes into out, for the stages that need the waveform
+void voice_detector_g711_decode(const voice_detector_g711_table_t *table, const uint8_t *payload, size_t count, int16_t *out);
+
+#endif // VOICE_DETECTOR_G711_H
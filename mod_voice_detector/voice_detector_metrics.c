@@ -0,0 +1,107 @@
+#include <time.h>
+
+#include "voice_detector_metrics.h"
+
+static const uint64_t voice_detector_callback_ns_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+static const uint64_t voice_detector_webhook_us_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+static const uint64_t voice_detector_nn_batch_us_bounds[] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000, 40000
+};
+
+static const uint64_t *voice_detector_histogram_bounds[VOICE_DETECTOR_HISTOGRAM_COUNT] = {
+    voice_detector_callback_ns_bounds,
+    voice_detector_webhook_us_bounds,
+    voice_detector_nn_batch_us_bounds
+};
+
+static const int voice_detector_histogram_size[VOICE_DETECTOR_HISTOGRAM_COUNT] = {
+    sizeof(voice_detector_callback_ns_bounds) / sizeof(voice_detector_callback_ns_bounds[0]),
+    sizeof(voice_detector_webhook_us_bounds) / sizeof(voice_detector_webhook_us_bounds[0]),
+    sizeof(voice_detector_nn_batch_us_bounds) / sizeof(voice_detector_nn_batch_us_bounds[0])
+};
+
+// Threads are given stripes round-robin the first time they record anything
+static uint32_t voice_detector_next_stripe;
+static __thread int voice_detector_thread_stripe = -1;
+
+static voice_detector_metrics_stripe_t *voice_detector_metrics_stripe(voice_detector_metrics_t *metrics)
+{
+    if (voice_detector_thread_stripe < 0) {
+        voice_detector_thread_stripe = (int)(__atomic_fetch_add(&voice_detector_next_stripe, 1, __ATOMIC_RELAXED) % VOICE_DETECTOR_METRICS_STRIPES);
+    }
+
+    return &metrics->stripes[voice_detector_thread_stripe];
+}
+
+uint64_t voice_detector_metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void voice_detector_metrics_add(voice_detector_metrics_t *metrics, voice_detector_metric_t metric, uint64_t value)
+{
+    __atomic_fetch_add(&voice_detector_metrics_stripe(metrics)->counters[metric], value, __ATOMIC_RELAXED);
+}
+
+void voice_detector_metrics_observe(voice_detector_metrics_t *metrics, voice_detector_histogram_t histogram, uint64_t value)
+{
+    voice_detector_metrics_stripe_t *stripe = voice_detector_metrics_stripe(metrics);
+    const uint64_t *bounds = voice_detector_histogram_bounds[histogram];
+    int size = voice_detector_histogram_size[histogram];
+    int bucket = 0;
+
+    while (bucket < size && value > bounds[bucket]) {
+        bucket++;
+    }
+
+    __atomic_fetch_add(&stripe->buckets[histogram][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stripe->sums[histogram], value, __ATOMIC_RELAXED);
+}
+
+uint64_t voice_detector_metrics_counter(const voice_detector_metrics_t *metrics, voice_detector_metric_t metric)
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < VOICE_DETECTOR_METRICS_STRIPES; i++) {
+        total += __atomic_load_n(&metrics->stripes[i].counters[metric], __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+int voice_detector_metrics_bounds(voice_detector_histogram_t histogram, const uint64_t **bounds)
+{
+    *bounds = voice_detector_histogram_bounds[histogram];
+
+    return voice_detector_histogram_size[histogram];
+}
+
+void voice_detector_metrics_histogram(const voice_detector_metrics_t *metrics, voice_detector_histogram_t histogram,
+                                      uint64_t *cumulative, uint64_t *sum)
+{
+    int size = voice_detector_histogram_size[histogram];
+    uint64_t running = 0;
+    int i, bucket;
+
+    *sum = 0;
+    for (bucket = 0; bucket <= size; bucket++) {
+        for (i = 0; i < VOICE_DETECTOR_METRICS_STRIPES; i++) {
+            running += __atomic_load_n(&metrics->stripes[i].buckets[histogram][bucket], __ATOMIC_RELAXED);
+        }
+        cumulative[bucket] = running;
+    }
+    for (i = 0; i < VOICE_DETECTOR_METRICS_STRIPES; i++) {
+        *sum += __atomic_load_n(&metrics->stripes[i].sums[histogram], __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef VOICE_DETECTOR_METRICS_H
+#define VOICE_DETECTOR_METRICS_H
+
+#include <stdint.h>
+
+// Striped counters and histograms for the hot path. Each thread updates its own
+// cache-line-aligned stripe with relaxed atomics, so there is no lock and no shared
+// cache line between media threads. Readers sum the stripes, the totals may be a
+// few updates behind but never go backwards.
+#define VOICE_DETECTOR_METRICS_STRIPES 16
+#define VOICE_DETECTOR_METRICS_MAX_BUCKETS 12
+
+typedef enum {
+    VOICE_DETECTOR_METRIC_FRAMES,
+    VOICE_DETECTOR_METRIC_SILENT_FRAMES,  // Comfort noise, DTX or digital silence, not analysed
+    VOICE_DETECTOR_METRIC_VOICE_STARTS,
+    VOICE_DETECTOR_METRIC_FALSE_STARTS,  // Voice reset because the word exceeded maximum_word_length
+    VOICE_DETECTOR_METRIC_WEBHOOK_POSTS,
+    VOICE_DETECTOR_METRIC_WEBHOOK_EVENTS,
+    VOICE_DETECTOR_METRIC_WEBHOOK_FAILURES,
+    VOICE_DETECTOR_METRIC_RECORDING_BYTES,
+    VOICE_DETECTOR_METRIC_DEGRADED_SESSIONS,  // Sessions started with the overload configuration
+    VOICE_DETECTOR_METRIC_WEBHOOK_SPOOLED,    // Events written to a dispatcher spool
+    VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_DROPPED,  // Events lost on a full spool
+    VOICE_DETECTOR_METRIC_WEBHOOK_SPOOL_INVALID,  // Damaged spool records discarded on replay
+    VOICE_DETECTOR_METRIC_NN_BATCHES,         // Neural VAD model invocations
+    VOICE_DETECTOR_METRIC_NN_WINDOWS,         // Windows scored by them
+    VOICE_DETECTOR_METRIC_COUNT
+} voice_detector_metric_t;
+
+typedef enum {
+    VOICE_DETECTOR_HISTOGRAM_CALLBACK_NS,  // Time spent per media bug frame
+    VOICE_DETECTOR_HISTOGRAM_WEBHOOK_US,   // Webhook request latency
+    VOICE_DETECTOR_HISTOGRAM_NN_BATCH_US,  // Neural VAD inference time per batch
+    VOICE_DETECTOR_HISTOGRAM_COUNT
+} voice_detector_histogram_t;
+
+typedef struct {
+    uint64_t counters[VOICE_DETECTOR_METRIC_COUNT];
+    uint64_t buckets[VOICE_DETECTOR_HISTOGRAM_COUNT][VOICE_DETECTOR_METRICS_MAX_BUCKETS + 1];  // Last one is +Inf
+    uint64_t sums[VOICE_DETECTOR_HISTOGRAM_COUNT];
+} __attribute__((aligned(64))) voice_detector_metrics_stripe_t;
+
+typedef struct {
+    voice_detector_metrics_stripe_t stripes[VOICE_DETECTOR_METRICS_STRIPES];
+} voice_detector_metrics_t;
+
+// Monotonic clock in nanoseconds, for timing hot-path sections
+uint64_t voice_detector_metrics_now_ns(void);
+
+void voice_detector_metrics_add(voice_detector_metrics_t *metrics, voice_detector_metric_t metric, uint64_t value);
+
+void voice_detector_metrics_observe(voice_detector_metrics_t *metrics, voice_detector_histogram_t histogram, uint64_t value);
+
+// Sum of a counter over all stripes
+uint64_t voice_detector_metrics_counter(const voice_detector_metrics_t *metrics, voice_detector_metric_t metric);
+
+// Upper bounds of a histogram's finite buckets, returns their number
+int voice_detector_metrics_bounds(voice_detector_histogram_t histogram, const uint64_t **bounds);
+
+// Cumulative bucket counts (bucket count + 1 entries, the last is +Inf) and the sum of observations
+void voice_detector_metrics_histogram(const voice_detector_metrics_t *metrics, voice_detector_histogram_t histogram,
+                                      uint64_t *cumulative, uint64_t *sum);
+
+#endif // VOICE_DETECTOR_METRICS_H
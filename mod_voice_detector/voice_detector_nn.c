@@ -0,0 +1,469 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef VOICE_DETECTOR_WITH_ONNX
+#include <onnxruntime_c_api.h>
+#endif
+
+#include "voice_detector_nn.h"
+
+typedef struct {
+    const char *name;
+    void *(*load)(const char *path, int max_batch, char *error, size_t error_size);
+    int (*window)(const void *impl, int rate);
+    int (*state_size)(const void *impl);
+    int (*infer)(void *impl, int rate, int batch, const float *input, float *state, float *probs);
+    void (*destroy)(void *impl);
+} voice_detector_nn_backend_t;
+
+struct voice_detector_nn_model_s {
+    const voice_detector_nn_backend_t *backend;
+    void *impl;
+};
+
+// Both backends frame audio like Silero: 32 ms windows at 8 or 16 kHz
+static int voice_detector_nn_silero_window(int rate)
+{
+    if (rate == 8000) {
+        return 256;
+    }
+    if (rate == 16000) {
+        return 512;
+    }
+
+    return 0;
+}
+
+static float voice_detector_nn_sigmoid(float x)
+{
+    return 1.0f / (1.0f + expf(-x));
+}
+
+// Built-in GRU, gate order and biases as in PyTorch: r, z, n with separate input and hidden biases
+typedef struct {
+    int hidden;
+    float *w_ih;  // [3 * hidden][features]
+    float *w_hh;  // [3 * hidden][hidden]
+    float *b_ih;  // [3 * hidden]
+    float *b_hh;  // [3 * hidden]
+    float *w_out; // [hidden]
+    float b_out;
+    float *weights;
+} voice_detector_nn_gru_t;
+
+static void *voice_detector_nn_gru_load(const char *path, int max_batch, char *error, size_t error_size)
+{
+    voice_detector_nn_gru_t *gru;
+    char magic[4];
+    uint32_t header[3];
+    size_t count;
+    FILE *file;
+    int hidden;
+
+    if (!(file = fopen(path, "rb"))) {
+        snprintf(error, error_size, "cannot open %s", path);
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, VOICE_DETECTOR_NN_GRU_MAGIC, sizeof(magic)) ||
+        fread(header, sizeof(uint32_t), 3, file) != 3 || header[0] != VOICE_DETECTOR_NN_GRU_VERSION) {
+        snprintf(error, error_size, "%s is not a version %d VDNN file", path, VOICE_DETECTOR_NN_GRU_VERSION);
+        fclose(file);
+        return NULL;
+    }
+    hidden = (int)header[2];
+    if (header[1] != VOICE_DETECTOR_NN_GRU_FEATURES || hidden <= 0 || hidden > VOICE_DETECTOR_NN_MAX_STATE) {
+        snprintf(error, error_size, "%s has %u features and %d hidden units, expected %d and at most %d",
+                 path, header[1], hidden, VOICE_DETECTOR_NN_GRU_FEATURES, VOICE_DETECTOR_NN_MAX_STATE);
+        fclose(file);
+        return NULL;
+    }
+
+    count = (size_t)3 * hidden * VOICE_DETECTOR_NN_GRU_FEATURES + (size_t)3 * hidden * hidden + (size_t)6 * hidden + hidden + 1;
+    if (!(gru = calloc(1, sizeof(*gru))) || !(gru->weights = malloc(sizeof(float) * count))) {
+        snprintf(error, error_size, "out of memory");
+        free(gru);
+        fclose(file);
+        return NULL;
+    }
+    if (fread(gru->weights, sizeof(float), count, file) != count) {
+        snprintf(error, error_size, "%s is truncated", path);
+        free(gru->weights);
+        free(gru);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    gru->hidden = hidden;
+    gru->w_ih = gru->weights;
+    gru->w_hh = gru->w_ih + 3 * hidden * VOICE_DETECTOR_NN_GRU_FEATURES;
+    gru->b_ih = gru->w_hh + 3 * hidden * hidden;
+    gru->b_hh = gru->b_ih + 3 * hidden;
+    gru->w_out = gru->b_hh + 3 * hidden;
+    gru->b_out = gru->w_out[hidden];
+    (void)max_batch;
+
+    return gru;
+}
+
+static int voice_detector_nn_gru_window(const void *impl, int rate)
+{
+    (void)impl;
+    return voice_detector_nn_silero_window(rate);
+}
+
+static int voice_detector_nn_gru_state_size(const void *impl)
+{
+    return ((const voice_detector_nn_gru_t *)impl)->hidden;
+}
+
+static void voice_detector_nn_gru_features(const float *window, int samples, float *features)
+{
+    int block_samples = samples / VOICE_DETECTOR_NN_GRU_BLOCKS;
+    int block, i;
+
+    for (block = 0; block < VOICE_DETECTOR_NN_GRU_BLOCKS; block++) {
+        const float *x = window + block * block_samples;
+        float energy = 0, diff = 0;
+        int crossings = 0;
+
+        for (i = 0; i < block_samples; i++) {
+            energy += x[i] * x[i];
+            if (i) {
+                float d = x[i] - x[i - 1];
+                diff += d * d;
+                crossings += (x[i] >= 0) != (x[i - 1] >= 0);
+            }
+        }
+        features[3 * block] = log10f(energy / block_samples + 1e-10f);
+        features[3 * block + 1] = (float)crossings / block_samples;
+        features[3 * block + 2] = log10f((diff + 1e-10f) / (energy + 1e-10f));
+    }
+}
+
+static int voice_detector_nn_gru_infer(void *impl, int rate, int batch, const float *input, float *state, float *probs)
+{
+    voice_detector_nn_gru_t *gru = (voice_detector_nn_gru_t *)impl;
+    int window = voice_detector_nn_silero_window(rate);
+    int hidden = gru->hidden;
+    float features[VOICE_DETECTOR_NN_GRU_FEATURES];
+    float gates[3 * VOICE_DETECTOR_NN_MAX_STATE];   // W_ih x + b_ih
+    float recur[3 * VOICE_DETECTOR_NN_MAX_STATE];   // W_hh h + b_hh
+    int b, j, k;
+
+    if (!window) {
+        return -1;
+    }
+
+    for (b = 0; b < batch; b++) {
+        float *h = state + (size_t)b * hidden;
+        float out = gru->b_out;
+
+        voice_detector_nn_gru_features(input + (size_t)b * window, window, features);
+
+        for (j = 0; j < 3 * hidden; j++) {
+            const float *wi = gru->w_ih + (size_t)j * VOICE_DETECTOR_NN_GRU_FEATURES;
+            const float *wh = gru->w_hh + (size_t)j * hidden;
+            float gi = gru->b_ih[j], gh = gru->b_hh[j];
+
+            for (k = 0; k < VOICE_DETECTOR_NN_GRU_FEATURES; k++) {
+                gi += wi[k] * features[k];
+            }
+            for (k = 0; k < hidden; k++) {
+                gh += wh[k] * h[k];
+            }
+            gates[j] = gi;
+            recur[j] = gh;
+        }
+
+        for (j = 0; j < hidden; j++) {
+            float r = voice_detector_nn_sigmoid(gates[j] + recur[j]);
+            float z = voice_detector_nn_sigmoid(gates[hidden + j] + recur[hidden + j]);
+            float n = tanhf(gates[2 * hidden + j] + r * recur[2 * hidden + j]);
+
+            h[j] = (1.0f - z) * n + z * h[j];
+            out += gru->w_out[j] * h[j];
+        }
+
+        probs[b] = voice_detector_nn_sigmoid(out);
+    }
+
+    return 0;
+}
+
+static void voice_detector_nn_gru_destroy(void *impl)
+{
+    voice_detector_nn_gru_t *gru = (voice_detector_nn_gru_t *)impl;
+
+    free(gru->weights);
+    free(gru);
+}
+
+static const voice_detector_nn_backend_t voice_detector_nn_gru_backend = {
+    "gru",
+    voice_detector_nn_gru_load,
+    voice_detector_nn_gru_window,
+    voice_detector_nn_gru_state_size,
+    voice_detector_nn_gru_infer,
+    voice_detector_nn_gru_destroy
+};
+
+#ifdef VOICE_DETECTOR_WITH_ONNX
+
+// Silero VAD v5: input [batch, context + window], state [2, batch, 128], sr int64 scalar -> output [batch, 1], stateN.
+// Each window is prefixed with the last 64 samples (32 at 8 kHz) of the channel's previous one,
+// as the reference wrapper does. Channel state: [2][128] recurrent, then the context tail.
+#define VOICE_DETECTOR_NN_ONNX_UNITS 128
+#define VOICE_DETECTOR_NN_ONNX_MAX_CONTEXT 64
+#define VOICE_DETECTOR_NN_ONNX_STATE (2 * VOICE_DETECTOR_NN_ONNX_UNITS + VOICE_DETECTOR_NN_ONNX_MAX_CONTEXT)
+
+typedef struct {
+    const OrtApi *api;
+    OrtEnv *env;
+    OrtSession *session;
+    OrtMemoryInfo *memory;
+    float *input;  // [max_batch][context + window]
+    float *state;  // [2][max_batch][128], the layout the model wants
+} voice_detector_nn_onnx_t;
+
+static int voice_detector_nn_onnx_context(int rate)
+{
+    return rate == 16000 ? 64 : 32;
+}
+
+static int voice_detector_nn_onnx_failed(const OrtApi *api, OrtStatus *status, char *error, size_t error_size)
+{
+    if (!status) {
+        return 0;
+    }
+    if (error) {
+        snprintf(error, error_size, "%s", api->GetErrorMessage(status));
+    }
+    api->ReleaseStatus(status);
+
+    return 1;
+}
+
+static void voice_detector_nn_onnx_destroy(void *impl)
+{
+    voice_detector_nn_onnx_t *onnx = (voice_detector_nn_onnx_t *)impl;
+
+    if (onnx->memory) {
+        onnx->api->ReleaseMemoryInfo(onnx->memory);
+    }
+    if (onnx->session) {
+        onnx->api->ReleaseSession(onnx->session);
+    }
+    if (onnx->env) {
+        onnx->api->ReleaseEnv(onnx->env);
+    }
+    free(onnx->input);
+    free(onnx->state);
+    free(onnx);
+}
+
+static void *voice_detector_nn_onnx_load(const char *path, int max_batch, char *error, size_t error_size)
+{
+    voice_detector_nn_onnx_t *onnx;
+    OrtSessionOptions *options = NULL;
+    const OrtApi *api = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+
+    if (!api) {
+        snprintf(error, error_size, "ONNX Runtime API version %d not available", ORT_API_VERSION);
+        return NULL;
+    }
+    if (!(onnx = calloc(1, sizeof(*onnx))) ||
+        !(onnx->input = malloc(sizeof(float) * (VOICE_DETECTOR_NN_ONNX_MAX_CONTEXT + VOICE_DETECTOR_NN_MAX_WINDOW) * (size_t)max_batch)) ||
+        !(onnx->state = malloc(sizeof(float) * 2 * VOICE_DETECTOR_NN_ONNX_UNITS * (size_t)max_batch))) {
+        snprintf(error, error_size, "out of memory");
+        if (onnx) {
+            free(onnx->input);
+        }
+        free(onnx);
+        return NULL;
+    }
+    onnx->api = api;
+
+    // One intra-op thread: parallelism comes from the worker pool and the batch
+    if (voice_detector_nn_onnx_failed(api, api->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "voice_detector", &onnx->env), error, error_size) ||
+        voice_detector_nn_onnx_failed(api, api->CreateSessionOptions(&options), error, error_size) ||
+        voice_detector_nn_onnx_failed(api, api->SetIntraOpNumThreads(options, 1), error, error_size) ||
+        voice_detector_nn_onnx_failed(api, api->SetSessionGraphOptimizationLevel(options, ORT_ENABLE_ALL), error, error_size) ||
+        voice_detector_nn_onnx_failed(api, api->CreateSession(onnx->env, path, options, &onnx->session), error, error_size) ||
+        voice_detector_nn_onnx_failed(api, api->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &onnx->memory), error, error_size)) {
+        if (options) {
+            api->ReleaseSessionOptions(options);
+        }
+        voice_detector_nn_onnx_destroy(onnx);
+        return NULL;
+    }
+    api->ReleaseSessionOptions(options);
+
+    return onnx;
+}
+
+static int voice_detector_nn_onnx_window(const void *impl, int rate)
+{
+    (void)impl;
+    return voice_detector_nn_silero_window(rate);
+}
+
+static int voice_detector_nn_onnx_state_size(const void *impl)
+{
+    (void)impl;
+    return VOICE_DETECTOR_NN_ONNX_STATE;
+}
+
+static int voice_detector_nn_onnx_infer(void *impl, int rate, int batch, const float *input, float *state, float *probs)
+{
+    static const char *input_names[] = { "input", "state", "sr" };
+    static const char *output_names[] = { "output", "stateN" };
+    voice_detector_nn_onnx_t *onnx = (voice_detector_nn_onnx_t *)impl;
+    const OrtApi *api = onnx->api;
+    int window = voice_detector_nn_silero_window(rate);
+    int context = voice_detector_nn_onnx_context(rate);
+    int64_t input_shape[2] = { batch, context + window };
+    int64_t state_shape[3] = { 2, batch, VOICE_DETECTOR_NN_ONNX_UNITS };
+    int64_t sr = rate;
+    OrtValue *inputs[3] = { NULL, NULL, NULL };
+    OrtValue *outputs[2] = { NULL, NULL };
+    float *output, *state_out;
+    int result = -1;
+    float *channel, *row;
+    int b, layer;
+
+    if (!window) {
+        return -1;
+    }
+
+    // Per-channel state [2][128] into the model's [2][batch][128], the context tail ahead of each window
+    for (b = 0; b < batch; b++) {
+        channel = state + (size_t)b * VOICE_DETECTOR_NN_ONNX_STATE;
+        for (layer = 0; layer < 2; layer++) {
+            memcpy(onnx->state + ((size_t)layer * batch + b) * VOICE_DETECTOR_NN_ONNX_UNITS,
+                   channel + (size_t)layer * VOICE_DETECTOR_NN_ONNX_UNITS, sizeof(float) * VOICE_DETECTOR_NN_ONNX_UNITS);
+        }
+        row = onnx->input + (size_t)b * (context + window);
+        memcpy(row, channel + 2 * VOICE_DETECTOR_NN_ONNX_UNITS, sizeof(float) * context);
+        memcpy(row + context, input + (size_t)b * window, sizeof(float) * window);
+    }
+
+    if (voice_detector_nn_onnx_failed(api, api->CreateTensorWithDataAsOrtValue(onnx->memory, onnx->input,
+                                                                               sizeof(float) * (size_t)batch * (context + window),
+                                                                               input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &inputs[0]), NULL, 0) ||
+        voice_detector_nn_onnx_failed(api, api->CreateTensorWithDataAsOrtValue(onnx->memory, onnx->state,
+                                                                               sizeof(float) * 2 * (size_t)batch * VOICE_DETECTOR_NN_ONNX_UNITS,
+                                                                               state_shape, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &inputs[1]), NULL, 0) ||
+        voice_detector_nn_onnx_failed(api, api->CreateTensorWithDataAsOrtValue(onnx->memory, &sr, sizeof(sr), NULL, 0,
+                                                                               ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &inputs[2]), NULL, 0) ||
+        voice_detector_nn_onnx_failed(api, api->Run(onnx->session, NULL, input_names, (const OrtValue *const *)inputs, 3,
+                                                    output_names, 2, outputs), NULL, 0) ||
+        voice_detector_nn_onnx_failed(api, api->GetTensorMutableData(outputs[0], (void **)&output), NULL, 0) ||
+        voice_detector_nn_onnx_failed(api, api->GetTensorMutableData(outputs[1], (void **)&state_out), NULL, 0)) {
+        goto done;
+    }
+
+    for (b = 0; b < batch; b++) {
+        channel = state + (size_t)b * VOICE_DETECTOR_NN_ONNX_STATE;
+        probs[b] = output[b];
+        for (layer = 0; layer < 2; layer++) {
+            memcpy(channel + (size_t)layer * VOICE_DETECTOR_NN_ONNX_UNITS,
+                   state_out + ((size_t)layer * batch + b) * VOICE_DETECTOR_NN_ONNX_UNITS, sizeof(float) * VOICE_DETECTOR_NN_ONNX_UNITS);
+        }
+        memcpy(channel + 2 * VOICE_DETECTOR_NN_ONNX_UNITS, input + (size_t)b * window + window - context, sizeof(float) * context);
+    }
+    result = 0;
+
+done:
+    for (b = 0; b < 3; b++) {
+        if (inputs[b]) {
+            api->ReleaseValue(inputs[b]);
+        }
+    }
+    for (b = 0; b < 2; b++) {
+        if (outputs[b]) {
+            api->ReleaseValue(outputs[b]);
+        }
+    }
+
+    return result;
+}
+
+static const voice_detector_nn_backend_t voice_detector_nn_onnx_backend = {
+    "onnx",
+    voice_detector_nn_onnx_load,
+    voice_detector_nn_onnx_window,
+    voice_detector_nn_onnx_state_size,
+    voice_detector_nn_onnx_infer,
+    voice_detector_nn_onnx_destroy
+};
+
+#endif // VOICE_DETECTOR_WITH_ONNX
+
+static const voice_detector_nn_backend_t *voice_detector_nn_backends[] = {
+    &voice_detector_nn_gru_backend,
+#ifdef VOICE_DETECTOR_WITH_ONNX
+    &voice_detector_nn_onnx_backend,
+#endif
+    NULL
+};
+
+voice_detector_nn_model_t *voice_detector_nn_load(const char *backend, const char *path, int max_batch, char *error, size_t error_size)
+{
+    const voice_detector_nn_backend_t *const *candidate;
+    voice_detector_nn_model_t *model;
+    void *impl;
+
+    for (candidate = voice_detector_nn_backends; *candidate; candidate++) {
+        if (!strcasecmp((*candidate)->name, backend)) {
+            break;
+        }
+    }
+    if (!*candidate) {
+        snprintf(error, error_size, "unknown backend %s", backend);
+        return NULL;
+    }
+
+    if (!(impl = (*candidate)->load(path, max_batch, error, error_size))) {
+        return NULL;
+    }
+    if ((*candidate)->state_size(impl) > VOICE_DETECTOR_NN_MAX_STATE || !(model = malloc(sizeof(*model)))) {
+        snprintf(error, error_size, "model state does not fit");
+        (*candidate)->destroy(impl);
+        return NULL;
+    }
+    model->backend = *candidate;
+    model->impl = impl;
+
+    return model;
+}
+
+int voice_detector_nn_window(const voice_detector_nn_model_t *model, int rate)
+{
+    return model->backend->window(model->impl, rate);
+}
+
+int voice_detector_nn_state_size(const voice_detector_nn_model_t *model)
+{
+    return model->backend->state_size(model->impl);
+}
+
+int voice_detector_nn_infer(voice_detector_nn_model_t *model, int rate, int batch, const float *input, float *state, float *probs)
+{
+    if (batch <= 0) {
+        return 0;
+    }
+
+    return model->backend->infer(model->impl, rate, batch, input, state, probs);
+}
+
+void voice_detector_nn_destroy(voice_detector_nn_model_t *model)
+{
+    if (model) {
+        model->backend->destroy(model->impl);
+        free(model);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef VOICE_DETECTOR_NN_H
+#define VOICE_DETECTOR_NN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Neural VAD models behind one batched interface. A call scores one fixed window of analysis-rate
+// audio for each of many channels: the caller gathers the windows and the channels' recurrent
+// state into contiguous arrays, the backend updates the state in place and writes one speech
+// probability per window. A model is used by one thread at a time.
+//   gru   built in: single-layer GRU over per-window energy and zero-crossing features,
+//         PyTorch nn.GRU + nn.Linear weights from a VDNN file
+//   onnx  ONNX Runtime with Silero VAD v5 inputs and outputs, built with VOICE_DETECTOR_WITH_ONNX;
+//         the channel state also carries the previous window's tail the model takes as context
+#define VOICE_DETECTOR_NN_MAX_WINDOW 512  // 32 ms at 16 kHz
+#define VOICE_DETECTOR_NN_MAX_STATE 320   // Floats of recurrent state per channel
+
+// Built-in GRU: the window is split into blocks, each gives log energy, zero-crossing rate and
+// the log ratio of first-difference to plain energy (a spectral tilt proxy)
+#define VOICE_DETECTOR_NN_GRU_BLOCKS 4
+#define VOICE_DETECTOR_NN_GRU_FEATURES (3 * VOICE_DETECTOR_NN_GRU_BLOCKS)
+#define VOICE_DETECTOR_NN_GRU_MAGIC "VDNN"
+#define VOICE_DETECTOR_NN_GRU_VERSION 1
+
+typedef struct voice_detector_nn_model_s voice_detector_nn_model_t;
+
+// Load a model for batches of up to max_batch windows, NULL with a message in error on failure
+voice_detector_nn_model_t *voice_detector_nn_load(const char *backend, const char *path, int max_batch, char *error, size_t error_size);
+
+// Samples per window at rate, 0 if the model cannot run at that rate
+int voice_detector_nn_window(const voice_detector_nn_model_t *model, int rate);
+
+// Floats of recurrent state per channel, at most VOICE_DETECTOR_NN_MAX_STATE. A new channel starts from zeros.
+int voice_detector_nn_state_size(const voice_detector_nn_model_t *model);
+
+// Score batch windows at rate. input holds batch * window samples in [-1, 1], state holds
+// batch * state_size floats and is updated, probs gets batch probabilities. Returns 0 on success.
+int voice_detector_nn_infer(voice_detector_nn_model_t *model, int rate, int batch, const float *input, float *state, float *probs);
+
+void voice_detector_nn_destroy(voice_detector_nn_model_t *model);
+
+#endif // VOICE_DETECTOR_NN_H
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "voice_detector_ring.h"
+
+uint32_t voice_detector_ring_ceil_pow2(uint32_t count)
+{
+    uint32_t pow2 = 1;
+
+    while (pow2 < count) {
+        pow2 <<= 1;
+    }
+
+    return pow2;
+}
+
+void voice_detector_ring_init(voice_detector_ring_t *ring, int16_t *storage, uint32_t capacity)
+{
+    ring->data = storage;
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->reserve, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, 0, __ATOMIC_RELAXED);
+}
+
+void voice_detector_ring_write(voice_detector_ring_t *ring, const int16_t *samples, uint32_t count)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t offset, first;
+
+    if (!ring->capacity) {
+        return;
+    }
+
+    // Only the newest capacity samples can survive
+    if (count > ring->capacity) {
+        samples += count - ring->capacity;
+        head += count - ring->capacity;
+        count = ring->capacity;
+    }
+
+    // Announce the slots about to be overwritten before touching them
+    __atomic_store_n(&ring->reserve, head + count, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    offset = head & ring->mask;
+    first = ring->capacity - offset < count ? ring->capacity - offset : count;
+    memcpy(ring->data + offset, samples, sizeof(int16_t) * first);
+    memcpy(ring->data, samples + first, sizeof(int16_t) * (count - first));
+
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+}
+
+void voice_detector_ring_keep_latest(voice_detector_ring_t *ring, uint32_t count)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    if (head - tail > count) {
+        __atomic_store_n(&ring->tail, head - count, __ATOMIC_RELAXED);
+    }
+}
+
+void voice_detector_ring_clear(voice_detector_ring_t *ring)
+{
+    __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
+
+uint32_t voice_detector_ring_read(voice_detector_ring_t *ring, int16_t *out, uint32_t count)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t offset, first, overrun;
+
+    if (!ring->capacity) {
+        return 0;
+    }
+
+    // Samples older than one capacity behind head are already gone
+    if (head - tail > ring->capacity) {
+        tail = head - ring->capacity;
+    }
+    if (count > head - tail) {
+        count = head - tail;
+    }
+
+    offset = tail & ring->mask;
+    first = ring->capacity - offset < count ? ring->capacity - offset : count;
+    memcpy(out, ring->data + offset, sizeof(int16_t) * first);
+    memcpy(out + first, ring->data, sizeof(int16_t) * (count - first));
+
+    // Anything the producer lapped (or is writing) while we copied is torn, drop it from the front
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+    overrun = head - tail > ring->capacity ? head - tail - ring->capacity : 0;
+    if (overrun >= count) {
+        __atomic_store_n(&ring->tail, head - ring->capacity, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (overrun) {
+        memmove(out, out + overrun, sizeof(int16_t) * (count - overrun));
+        count -= overrun;
+    }
+
+    __atomic_store_n(&ring->tail, tail + overrun + count, __ATOMIC_RELAXED);
+
+    return count;
+}
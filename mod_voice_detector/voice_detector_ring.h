@@ -0,0 +1,37 @@
+#ifndef VOICE_DETECTOR_RING_H
+#define VOICE_DETECTOR_RING_H
+
+#include <stdint.h>
+
+// Single-producer single-consumer ring of 16-bit samples over caller-provided storage.
+// The producer never blocks and never allocates: when the ring is full it overwrites the
+// oldest samples, so the ring always holds the most recent audio (pre-roll). A consumer
+// that is overrun mid-read drops the samples that were overwritten under it.
+typedef struct {
+    int16_t *data;
+    uint32_t capacity;  // Power of two
+    uint32_t mask;
+    uint32_t head;      // Samples ever written, producer-owned
+    uint32_t reserve;   // head plus the samples currently being written, lets readers detect laps
+    uint32_t tail;      // Samples ever consumed, consumer-owned
+} voice_detector_ring_t;
+
+// Smallest power of two not below count
+uint32_t voice_detector_ring_ceil_pow2(uint32_t count);
+
+// Set up a ring over storage, capacity must be a power of two
+void voice_detector_ring_init(voice_detector_ring_t *ring, int16_t *storage, uint32_t capacity);
+
+// Producer: append count samples, overwriting the oldest when full
+void voice_detector_ring_write(voice_detector_ring_t *ring, const int16_t *samples, uint32_t count);
+
+// Consumer: keep at most the latest count samples, older ones are skipped
+void voice_detector_ring_keep_latest(voice_detector_ring_t *ring, uint32_t count);
+
+// Consumer: drop everything currently buffered
+void voice_detector_ring_clear(voice_detector_ring_t *ring);
+
+// Consumer: copy up to count of the oldest buffered samples into out, returns the number copied
+uint32_t voice_detector_ring_read(voice_detector_ring_t *ring, int16_t *out, uint32_t count);
+
+#endif // VOICE_DETECTOR_RING_H
@@ -0,0 +1,168 @@
+#include <math.h>
+#include <string.h>
+
+#include "voice_detector_spectral.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// exp(-2*pi*i*k/MAX_FFT), smaller FFTs stride through the same table
+static float spectral_cos[VOICE_DETECTOR_SPECTRAL_MAX_FFT / 2];
+static float spectral_sin[VOICE_DETECTOR_SPECTRAL_MAX_FFT / 2];
+
+void voice_detector_spectral_init(void)
+{
+    int k;
+
+    for (k = 0; k < VOICE_DETECTOR_SPECTRAL_MAX_FFT / 2; k++) {
+        spectral_cos[k] = (float)cos(2.0 * M_PI * k / VOICE_DETECTOR_SPECTRAL_MAX_FFT);
+        spectral_sin[k] = (float)-sin(2.0 * M_PI * k / VOICE_DETECTOR_SPECTRAL_MAX_FFT);
+    }
+}
+
+int voice_detector_spectral_configure(voice_detector_spectral_t *spectral, int sample_rate, int frame_samples)
+{
+    int bits = 0;
+    int i, j;
+
+    if (sample_rate <= 0 || frame_samples <= 0) {
+        return -1;
+    }
+
+    spectral->sample_rate = sample_rate;
+    spectral->frame_samples = frame_samples;
+    spectral->fft_size = 2;
+    while (spectral->fft_size < frame_samples && spectral->fft_size < VOICE_DETECTOR_SPECTRAL_MAX_FFT) {
+        spectral->fft_size <<= 1;
+    }
+    while ((1 << bits) < spectral->fft_size) {
+        bits++;
+    }
+
+    // Hann window over the real frame length, the rest of the FFT input is zero padding
+    if (frame_samples > spectral->fft_size) {
+        frame_samples = spectral->fft_size;
+    }
+    for (i = 0; i < spectral->fft_size; i++) {
+        spectral->window[i] = i < frame_samples ? (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / (frame_samples > 1 ? frame_samples - 1 : 1))) : 0.0f;
+    }
+
+    for (i = 0; i < spectral->fft_size; i++) {
+        int r = 0;
+        for (j = 0; j < bits; j++) {
+            r |= ((i >> j) & 1) << (bits - 1 - j);
+        }
+        spectral->bitrev[i] = (uint16_t)r;
+    }
+
+    spectral->band_low_bin = VOICE_DETECTOR_SPECTRAL_BAND_LOW_HZ * spectral->fft_size / sample_rate;
+    spectral->band_high_bin = VOICE_DETECTOR_SPECTRAL_BAND_HIGH_HZ * spectral->fft_size / sample_rate;
+    if (spectral->band_low_bin < 1) {
+        spectral->band_low_bin = 1;
+    }
+    if (spectral->band_high_bin > spectral->fft_size / 2) {
+        spectral->band_high_bin = spectral->fft_size / 2;
+    }
+
+    return 0;
+}
+
+// In-place iterative radix-2 FFT of spectral->re/im
+static void voice_detector_spectral_fft(voice_detector_spectral_t *spectral)
+{
+    float *re = spectral->re;
+    float *im = spectral->im;
+    int n = spectral->fft_size;
+    int len, half, step, i, k;
+
+    for (i = 0; i < n; i++) {
+        int j = spectral->bitrev[i];
+        if (j > i) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        half = len >> 1;
+        step = VOICE_DETECTOR_SPECTRAL_MAX_FFT / len;
+        for (i = 0; i < n; i += len) {
+            for (k = 0; k < half; k++) {
+                float wr = spectral_cos[k * step];
+                float wi = spectral_sin[k * step];
+                int a = i + k;
+                int b = a + half;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+// Windowed FFT of up to fft_size samples, adds the hop's band ratio and flatness to features
+static void voice_detector_spectral_hop(voice_detector_spectral_t *spectral, const int16_t *samples, int count,
+                                        voice_detector_spectral_features_t *features)
+{
+    double total = 0, band = 0, log_sum = 0;
+    int bins, i;
+
+    for (i = 0; i < count; i++) {
+        spectral->re[i] = samples[i] * spectral->window[i];
+    }
+    memset(spectral->re + count, 0, sizeof(float) * (spectral->fft_size - count));
+    memset(spectral->im, 0, sizeof(float) * spectral->fft_size);
+
+    voice_detector_spectral_fft(spectral);
+
+    // re[] is reused to hold the power spectrum
+    for (i = 1; i <= spectral->fft_size / 2; i++) {
+        float p = spectral->re[i] * spectral->re[i] + spectral->im[i] * spectral->im[i];
+        spectral->re[i] = p;
+        total += p;
+    }
+
+    for (i = spectral->band_low_bin; i <= spectral->band_high_bin; i++) {
+        band += spectral->re[i];
+        log_sum += log(spectral->re[i] + 1e-3);
+    }
+    bins = spectral->band_high_bin - spectral->band_low_bin + 1;
+
+    features->band_ratio += total > 0 ? (float)(band / total) : 0.0f;
+    features->flatness += band > 0 ? (float)(exp(log_sum / bins) / (band / bins)) : 1.0f;
+}
+
+void voice_detector_spectral_analyze(voice_detector_spectral_t *spectral, const int16_t *samples, int count,
+                                     voice_detector_spectral_features_t *features)
+{
+    int crossings = 0;
+    int length = count < spectral->fft_size ? count : spectral->fft_size;
+    int hops = 1, i;
+
+    for (i = 1; i < count; i++) {
+        if ((samples[i] ^ samples[i - 1]) < 0) {
+            crossings++;
+        }
+    }
+
+    // A long frame is split into the fewest full-size hops that cover it, spread evenly with overlap
+    if (count > spectral->fft_size) {
+        hops = (count + spectral->fft_size - 1) / spectral->fft_size;
+    }
+
+    features->band_ratio = 0.0f;
+    features->flatness = 0.0f;
+    for (i = 0; i < hops; i++) {
+        int offset = hops > 1 ? (int)((int64_t)i * (count - length) / (hops - 1)) : 0;
+
+        voice_detector_spectral_hop(spectral, samples + offset, length, features);
+    }
+    features->band_ratio /= hops;
+    features->flatness /= hops;
+    features->zcr = count > 1 ? (float)crossings / (count - 1) : 0.0f;
+}
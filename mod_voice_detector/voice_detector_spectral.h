@@ -0,0 +1,42 @@
+#ifndef VOICE_DETECTOR_SPECTRAL_H
+#define VOICE_DETECTOR_SPECTRAL_H
+
+#include <stdint.h>
+
+// Spectral VAD: windowed FFT of one frame, then band energy ratio, spectral
+// flatness and zero-crossing rate. Tables are built once, analysis never allocates.
+#define VOICE_DETECTOR_SPECTRAL_MAX_FFT 512
+#define VOICE_DETECTOR_SPECTRAL_BAND_LOW_HZ 300
+#define VOICE_DETECTOR_SPECTRAL_BAND_HIGH_HZ 3400
+
+typedef struct {
+    float band_ratio;  // speech band power / total power, 0-1
+    float flatness;    // geometric / arithmetic mean of the band power, 0 (tonal) - 1 (white noise)
+    float zcr;         // zero crossings per sample, 0-1
+} voice_detector_spectral_features_t;
+
+// Per-session analysis state, sized for the session's frame length
+typedef struct {
+    int sample_rate;
+    int frame_samples;
+    int fft_size;
+    int band_low_bin;
+    int band_high_bin;
+    float window[VOICE_DETECTOR_SPECTRAL_MAX_FFT];
+    float re[VOICE_DETECTOR_SPECTRAL_MAX_FFT];
+    float im[VOICE_DETECTOR_SPECTRAL_MAX_FFT];
+    uint16_t bitrev[VOICE_DETECTOR_SPECTRAL_MAX_FFT];
+} voice_detector_spectral_t;
+
+// Build the shared twiddle tables, call once before any analysis
+void voice_detector_spectral_init(void);
+
+// Size the window and FFT for frames of frame_samples at sample_rate, returns 0 on success
+int voice_detector_spectral_configure(voice_detector_spectral_t *spectral, int sample_rate, int frame_samples);
+
+// Analyse one frame. Frames longer than the largest FFT are covered by overlapping full-size hops
+// whose band ratio and flatness are averaged; the zero-crossing rate always spans the whole frame.
+void voice_detector_spectral_analyze(voice_detector_spectral_t *spectral, const int16_t *samples, int count,
+                                     voice_detector_spectral_features_t *features);
+
+#endif // VOICE_DETECTOR_SPECTRAL_H
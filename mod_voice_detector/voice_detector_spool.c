@@ -0,0 +1,173 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "voice_detector_spool.h"
+
+int voice_detector_spool_open(voice_detector_spool_t *spool, const char *path, uint32_t record_size, uint32_t capacity)
+{
+    voice_detector_spool_header_t *header;
+    size_t map_size = sizeof(voice_detector_spool_header_t) + (size_t)record_size * capacity;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(spool, 0, sizeof(*spool));
+    spool->fd = -1;
+
+    if (!record_size || !capacity) {
+        return -1;
+    }
+    if ((fd = open(path, O_RDWR | O_CREAT, 0640)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != map_size && ftruncate(fd, (off_t)map_size) < 0)) {
+        close(fd);
+        return -1;
+    }
+    if ((map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    header = (voice_detector_spool_header_t *)map;
+    // A new, resized or foreign file starts empty, its records do not fit the current layout
+    if ((size_t)st.st_size != map_size || header->magic != VOICE_DETECTOR_SPOOL_MAGIC || header->version != VOICE_DETECTOR_SPOOL_VERSION ||
+        header->record_size != record_size || header->capacity != capacity ||
+        header->head < header->tail || header->head - header->tail > capacity) {
+        header->magic = VOICE_DETECTOR_SPOOL_MAGIC;
+        header->version = VOICE_DETECTOR_SPOOL_VERSION;
+        header->record_size = record_size;
+        header->capacity = capacity;
+        header->head = 0;
+        header->tail = 0;
+    }
+
+    spool->header = header;
+    spool->records = (char *)map + sizeof(voice_detector_spool_header_t);
+    spool->map_size = map_size;
+    spool->record_size = record_size;
+    spool->capacity = capacity;
+    spool->fd = fd;
+
+    return (int)voice_detector_spool_depth(spool);
+}
+
+uint32_t voice_detector_spool_depth(const voice_detector_spool_t *spool)
+{
+    if (!spool->header) {
+        return 0;
+    }
+
+    return (uint32_t)(__atomic_load_n(&spool->header->head, __ATOMIC_RELAXED) - __atomic_load_n(&spool->header->tail, __ATOMIC_RELAXED));
+}
+
+uint32_t voice_detector_spool_append(voice_detector_spool_t *spool, const void *records, uint32_t count)
+{
+    uint64_t head;
+    uint32_t space, i;
+
+    if (!spool->header) {
+        return 0;
+    }
+
+    head = spool->header->head;
+    space = spool->capacity - (uint32_t)(head - spool->header->tail);
+    if (count > space) {
+        count = space;
+    }
+
+    for (i = 0; i < count; i++) {
+        memcpy(spool->records + (size_t)((head + i) % spool->capacity) * spool->record_size,
+               (const char *)records + (size_t)i * spool->record_size, spool->record_size);
+    }
+
+    // Records land before the head that publishes them, a crash never replays a torn record
+    __atomic_store_n(&spool->header->head, head + count, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+uint32_t voice_detector_spool_peek(const voice_detector_spool_t *spool, void *out, uint32_t count)
+{
+    uint64_t tail;
+    uint32_t depth = voice_detector_spool_depth(spool);
+    uint32_t i;
+
+    if (count > depth) {
+        count = depth;
+    }
+
+    tail = spool->header ? spool->header->tail : 0;
+    for (i = 0; i < count; i++) {
+        memcpy((char *)out + (size_t)i * spool->record_size,
+               spool->records + (size_t)((tail + i) % spool->capacity) * spool->record_size, spool->record_size);
+    }
+
+    return count;
+}
+
+void voice_detector_spool_consume(voice_detector_spool_t *spool, uint32_t count)
+{
+    uint32_t depth = voice_detector_spool_depth(spool);
+
+    if (count > depth) {
+        count = depth;
+    }
+    if (count) {
+        __atomic_store_n(&spool->header->tail, spool->header->tail + count, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t voice_detector_spool_evict(voice_detector_spool_t *spool, int (*evictable)(const void *record, void *arg), void *arg, uint32_t count)
+{
+    uint64_t head, cursor, i;
+    uint32_t removed = 0;
+    char *record;
+
+    if (!spool->header || !count) {
+        return 0;
+    }
+
+    head = spool->header->head;
+    cursor = spool->header->tail;
+    for (i = cursor; i < head; i++) {
+        record = spool->records + (size_t)(i % spool->capacity) * spool->record_size;
+        if (removed < count && evictable(record, arg)) {
+            removed++;
+            continue;
+        }
+        if (cursor != i) {
+            memcpy(spool->records + (size_t)(cursor % spool->capacity) * spool->record_size, record, spool->record_size);
+        }
+        cursor++;
+    }
+
+    if (removed) {
+        __atomic_store_n(&spool->header->head, cursor, __ATOMIC_RELEASE);
+    }
+
+    return removed;
+}
+
+void voice_detector_spool_sync(voice_detector_spool_t *spool)
+{
+    if (spool->header) {
+        msync(spool->header, spool->map_size, MS_ASYNC);
+    }
+}
+
+void voice_detector_spool_close(voice_detector_spool_t *spool)
+{
+    if (spool->header) {
+        msync(spool->header, spool->map_size, MS_SYNC);
+        munmap(spool->header, spool->map_size);
+        spool->header = NULL;
+    }
+    if (spool->fd >= 0) {
+        close(spool->fd);
+        spool->fd = -1;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef VOICE_DETECTOR_SPOOL_H
+#define VOICE_DETECTOR_SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded journal of fixed-size records in a memory-mapped file, used by one webhook
+// dispatcher to keep events across endpoint outages and restarts. Records are appended at
+// the head and replayed from the tail in order; the file never grows, appends fail once
+// capacity records are pending. Single writer and reader (the dispatcher thread), depth
+// may be read from any thread.
+#define VOICE_DETECTOR_SPOOL_MAGIC 0x4c4f5053  // "SPOL"
+#define VOICE_DETECTOR_SPOOL_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint64_t head;  // Records ever appended
+    uint64_t tail;  // Records ever replayed
+} voice_detector_spool_header_t;
+
+typedef struct {
+    voice_detector_spool_header_t *header;  // NULL = not open
+    char *records;
+    size_t map_size;
+    uint32_t record_size;
+    uint32_t capacity;
+    int fd;
+} voice_detector_spool_t;
+
+// Map path as a journal of capacity records, creating or resizing the file as needed. Pending
+// records left by a previous run are kept when the layout matches, otherwise they are discarded.
+// Returns the number of pending records, or -1 on error.
+int voice_detector_spool_open(voice_detector_spool_t *spool, const char *path, uint32_t record_size, uint32_t capacity);
+
+// Pending records
+uint32_t voice_detector_spool_depth(const voice_detector_spool_t *spool);
+
+// Append up to count records, returns the number stored before the journal filled up
+uint32_t voice_detector_spool_append(voice_detector_spool_t *spool, const void *records, uint32_t count);
+
+// Copy up to count of the oldest pending records into out without consuming them, returns the number copied
+uint32_t voice_detector_spool_peek(const voice_detector_spool_t *spool, void *out, uint32_t count);
+
+// Drop count records from the tail once they have been delivered
+void voice_detector_spool_consume(voice_detector_spool_t *spool, uint32_t count);
+
+// Remove up to count of the oldest pending records evictable selects, the rest keep their order.
+// Returns the number removed. The pending records are moved in place, a crash midway can
+// replay some of them twice or leave one damaged, so readers should not trust record contents.
+uint32_t voice_detector_spool_evict(voice_detector_spool_t *spool, int (*evictable)(const void *record, void *arg), void *arg, uint32_t count);
+
+// Schedule write-back of the mapping, does not wait for the disk
+void voice_detector_spool_sync(voice_detector_spool_t *spool);
+
+// Flush and unmap, pending records stay in the file for the next open
+void voice_detector_spool_close(voice_detector_spool_t *spool);
+
+#endif // VOICE_DETECTOR_SPOOL_H
@@ -0,0 +1,94 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "voice_detector_tone.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+int voice_detector_tone_configure(voice_detector_tone_t *tone, int sample_rate, int min_ms, float min_ratio)
+{
+    int i;
+
+    if (sample_rate <= 0) {
+        return -1;
+    }
+
+    tone->sample_rate = sample_rate;
+    tone->bins = 0;
+    for (i = 0; i < VOICE_DETECTOR_TONE_BINS; i++) {
+        int frequency = VOICE_DETECTOR_TONE_MIN_HZ + i * VOICE_DETECTOR_TONE_STEP_HZ;
+
+        if (frequency * 2 >= sample_rate) {
+            break;
+        }
+        tone->coeff[i] = (float)(2.0 * cos(2.0 * M_PI * frequency / sample_rate));
+        tone->bins++;
+    }
+
+    tone->min_ratio = min_ratio;
+    tone->min_samples = (int)((int64_t)min_ms * sample_rate / 1000);
+    voice_detector_tone_reset(tone);
+
+    return tone->bins ? 0 : -1;
+}
+
+void voice_detector_tone_reset(voice_detector_tone_t *tone)
+{
+    tone->tone_bin = -1;
+    tone->tone_samples = 0;
+    tone->reported = 0;
+}
+
+int voice_detector_tone_process(voice_detector_tone_t *tone, const int16_t *samples, int count, uint64_t energy_sum)
+{
+    float best_power = 0.0f;
+    int best_bin = -1;
+    int i, k;
+
+    if (count <= 0 || !energy_sum) {
+        voice_detector_tone_reset(tone);
+        return 0;
+    }
+
+    for (k = 0; k < tone->bins; k++) {
+        float coeff = tone->coeff[k];
+        float s1 = 0.0f, s2 = 0.0f, s0, power;
+
+        for (i = 0; i < count; i++) {
+            s0 = samples[i] + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+
+        power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+        if (power > best_power) {
+            best_power = power;
+            best_bin = k;
+        }
+    }
+
+    // A pure tone on a bin gives |X|^2 = (A N / 2)^2 against a frame energy of A^2 N / 2,
+    // so 2 |X|^2 / (N * energy) is the share of the frame in that bin
+    if (best_bin < 0 || 2.0 * best_power < tone->min_ratio * (double)count * (double)energy_sum) {
+        voice_detector_tone_reset(tone);
+        return 0;
+    }
+
+    // The tone may sit between two bins and alternate, a neighbour counts as the same tone
+    if (tone->tone_bin >= 0 && abs(best_bin - tone->tone_bin) <= 1) {
+        tone->tone_samples += count;
+    } else {
+        tone->tone_samples = count;
+        tone->reported = 0;
+    }
+    tone->tone_bin = best_bin;
+
+    if (!tone->reported && tone->tone_samples >= tone->min_samples) {
+        tone->reported = 1;
+        return VOICE_DETECTOR_TONE_MIN_HZ + best_bin * VOICE_DETECTOR_TONE_STEP_HZ;
+    }
+
+    return 0;
+}
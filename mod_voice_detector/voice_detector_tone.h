@@ -0,0 +1,35 @@
+#ifndef VOICE_DETECTOR_TONE_H
+#define VOICE_DETECTOR_TONE_H
+
+#include <stdint.h>
+
+// Beep detection: a Goertzel filter bank over the usual answering machine beep range.
+// Coefficients are computed once per rate, analysis never allocates.
+#define VOICE_DETECTOR_TONE_MIN_HZ 400
+#define VOICE_DETECTOR_TONE_MAX_HZ 2000
+#define VOICE_DETECTOR_TONE_STEP_HZ 25  // Half the 50 Hz resolution of a 20 ms frame, so a tone never falls between bins
+#define VOICE_DETECTOR_TONE_BINS ((VOICE_DETECTOR_TONE_MAX_HZ - VOICE_DETECTOR_TONE_MIN_HZ) / VOICE_DETECTOR_TONE_STEP_HZ + 1)
+
+// Per-session state: the bank for the analysis rate and the tone being tracked
+typedef struct {
+    int sample_rate;
+    int bins;                                   // Bins below Nyquist
+    float coeff[VOICE_DETECTOR_TONE_BINS];      // 2 cos(2 pi f / rate)
+    float min_ratio;                            // Share of the frame energy a single bin must hold
+    int min_samples;                            // Steady tone length before it is reported
+    int tone_bin;                               // Bin of the tracked tone, -1 = none
+    int tone_samples;
+    int reported;
+} voice_detector_tone_t;
+
+// Build the bank for sample_rate, a tone is reported after min_ms above min_ratio. Returns 0 on success.
+int voice_detector_tone_configure(voice_detector_tone_t *tone, int sample_rate, int min_ms, float min_ratio);
+
+// Forget the tracked tone, e.g. on a quiet frame
+void voice_detector_tone_reset(voice_detector_tone_t *tone);
+
+// Analyse one frame with its sum-of-squares energy. Returns the beep frequency in Hz once, on
+// the frame where a steady tone reaches its minimum length, and 0 otherwise.
+int voice_detector_tone_process(voice_detector_tone_t *tone, const int16_t *samples, int count, uint64_t energy_sum);
+
+#endif // VOICE_DETECTOR_TONE_H